@@ -99,6 +99,8 @@ public:
 
 	core &get_boot_core() const { return get_core(0); }
 
+	int nr_cores() const { return nr_cores_; }
+
 	void register_core(core &c);
 
 	__noreturn void go();
@@ -61,6 +61,8 @@ feature(f16c, 1, ecx, 29)
 feature(rdrnd, 1, ecx, 30)
 feature(hypervisor, 1, ecx, 31)
 
+feature(pdpe1gb, 0x80000001, edx, 26)
+
 feature2(fsgsbase, 7, 0, ebx, 0)
 feature2(sgx, 7, 0, ebx, 2)
 feature2(bmi1, 7, 0, ebx, 3)
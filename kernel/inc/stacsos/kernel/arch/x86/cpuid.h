@@ -22,7 +22,7 @@ enum class cpuid_features {
 enum class cpuid_feature_reg { eax, ebx, ecx, edx };
 
 struct cpuid_mapping {
-	int fn, ext;
+	u32 fn, ext;
 	cpuid_feature_reg rg;
 	int bit;
 	cpuid_features feat;
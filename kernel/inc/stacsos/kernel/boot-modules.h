@@ -0,0 +1,67 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2025
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+namespace stacsos::kernel {
+/**
+ * @brief Records the modules that the boot loader loaded into memory alongside the kernel.  Modules
+ * are recorded before memory has been initialised, so their details are kept in static storage.
+ */
+class boot_modules {
+	DEFINE_SINGLETON(boot_modules)
+
+private:
+	boot_modules()
+		: nr_modules_(0)
+	{
+	}
+
+public:
+	static const int max_modules = 4;
+	static const int max_cmdline_length = 63;
+
+	struct boot_module {
+		u64 start; // physical address of the module
+		u64 length;
+		char cmdline[max_cmdline_length + 1];
+
+		const void *data() const { return phys_to_virt(start); }
+	};
+
+	/**
+	 * @brief Records a module.  Modules beyond the first max_modules are ignored.
+	 */
+	void add(u64 start, u64 length, const char *cmdline)
+	{
+		if (nr_modules_ == max_modules) {
+			return;
+		}
+
+		boot_module &mod = modules_[nr_modules_++];
+		mod.start = start;
+		mod.length = length;
+
+		int i = 0;
+		while (cmdline && cmdline[i] && i < max_cmdline_length) {
+			mod.cmdline[i] = cmdline[i];
+			i++;
+		}
+
+		mod.cmdline[i] = 0;
+	}
+
+	int count() const { return nr_modules_; }
+
+	boot_module &get(int index) { return modules_[index]; }
+	const boot_module &get(int index) const { return modules_[index]; }
+
+private:
+	boot_module modules_[max_modules];
+	int nr_modules_;
+};
+} // namespace stacsos::kernel
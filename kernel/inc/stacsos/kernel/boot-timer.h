@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+namespace stacsos::kernel {
+/**
+ * @brief Records how long each phase of the boot process takes.  Phases are timed with the raw
+ * TSC, since this is usable before the timers have been calibrated, and are converted into
+ * wall-clock time when the report is produced.
+ */
+class boot_timer {
+	DEFINE_SINGLETON(boot_timer)
+
+private:
+	boot_timer()
+		: nr_phases_(0)
+		, current_phase_(-1)
+	{
+	}
+
+public:
+	static const int max_phases = 24;
+
+	/**
+	 * @brief Starts timing a new boot phase, ending the current one (if any).
+	 *
+	 * @param name The name of the phase, which must be a string literal.
+	 */
+	void begin(const char *name);
+
+	/**
+	 * @brief Ends the current boot phase.
+	 */
+	void end();
+
+	/**
+	 * @brief Prints the time taken by each recorded boot phase.
+	 */
+	void report() const;
+
+private:
+	struct boot_phase {
+		const char *name;
+		u64 start, end;
+	};
+
+	boot_phase phases_[max_phases];
+	int nr_phases_, current_phase_;
+};
+} // namespace stacsos::kernel
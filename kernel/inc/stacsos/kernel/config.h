@@ -42,6 +42,25 @@ public:
 		return dfl;
 	}
 
+	/**
+	 * @brief Retrieves an option as an unsigned decimal number, or returns the default if the
+	 * option is not present (or is not a number).
+	 */
+	u64 get_option_u64_or_default(const char *name, u64 dfl) const
+	{
+		const char *value = get_option(name);
+		if (!value || *value < '0' || *value > '9') {
+			return dfl;
+		}
+
+		u64 result = 0;
+		while (*value >= '0' && *value <= '9') {
+			result = (result * 10) + (*value++ - '0');
+		}
+
+		return result;
+	}
+
 private:
 	char command_line_[256];
 	config_option options_[32];
@@ -44,6 +44,8 @@ namespace acpi {
 		bool parse_dsdt(const dsdt *fadt);
 		bool parse_hpet(const hpet *fadt);
 		bool parse_mcfg(const mcfg *mcfg);
+		bool parse_srat(const srat *srat);
+		bool parse_slit(const slit *slit);
 	};
 } // namespace acpi
 } // namespace stacsos::kernel::dev
@@ -179,4 +179,52 @@ struct mcfg {
 	u64 reserved;
 	configuration_space_base_address_allocation base_addresses[];
 } __packed;
+
+struct srat_record_header {
+	u8 type, length;
+} __packed;
+
+struct srat_record_lapic_affinity {
+	srat_record_header header;
+	u8 proximity_domain_low;
+	u8 apic_id;
+	u32 flags;
+	u8 local_sapic_eid;
+	u8 proximity_domain_high[3];
+	u32 clock_domain;
+} __packed;
+
+struct srat_record_memory_affinity {
+	srat_record_header header;
+	u32 proximity_domain;
+	u16 reserved1;
+	u64 base_address;
+	u64 length;
+	u32 reserved2;
+	u32 flags;
+	u64 reserved3;
+} __packed;
+
+struct srat_record_x2apic_affinity {
+	srat_record_header header;
+	u16 reserved1;
+	u32 proximity_domain;
+	u32 x2apic_id;
+	u32 flags;
+	u32 clock_domain;
+	u32 reserved2;
+} __packed;
+
+struct srat {
+	sdt_header header;
+	u32 reserved1;
+	u64 reserved2;
+	srat_record_header records; // VARIABLE LENGTH
+} __packed;
+
+struct slit {
+	sdt_header header;
+	u64 nr_localities;
+	u8 entries[]; // nr_localities * nr_localities matrix
+} __packed;
 } // namespace stacsos::kernel::dev::acpi
@@ -11,6 +11,7 @@
 #include <stacsos/kernel/fs/file.h>
 #include <stacsos/kernel/fs/filesystem.h>
 #include <stacsos/kernel/fs/fs-node.h>
+#include <stacsos/list.h>
 
 namespace stacsos::kernel::dev {
 using namespace stacsos::kernel::fs;
@@ -52,7 +53,11 @@ public:
 protected:
 	virtual fs_node *resolve_child(const string &name) override;
 
+	// Devices can be registered at any time, so a missing name may appear later.
+	virtual bool cache_missing_children() const override { return false; }
+
 private:
 	device *dev_;
+	list<devfs_node *> children_;
 };
 } // namespace stacsos::kernel::dev
@@ -94,8 +94,31 @@ public:
 
 	pci_device_configuration &config() const { return config_; }
 
+	/**
+	 * @brief Returns the physical address that a memory BAR has been assigned, combining both
+	 * halves of a 64-bit BAR.
+	 */
+	u64 bar_address(int index);
+
+	/**
+	 * @brief Allows the device to decode memory accesses, and to initiate DMA.
+	 */
+	void enable_bus_mastering();
+
 	void register_msi(arch::x86::irq::irq_handler_fn handler, void *arg);
 
+	/**
+	 * @brief Returns the number of entries in the device's MSI-X table, or zero if the device
+	 * does not support MSI-X.
+	 */
+	int nr_msix_vectors();
+
+	/**
+	 * @brief Allocates an interrupt for an entry of the device's MSI-X table, and enables MSI-X.
+	 * Returns false if the device does not support MSI-X, or the entry does not exist.
+	 */
+	bool register_msix(int entry, arch::x86::irq::irq_handler_fn handler, void *arg);
+
 private:
 	pci_device_configuration &config_;
 };
@@ -15,11 +15,15 @@ namespace stacsos::kernel::dev::storage {
 
 enum class ahci_port_type { none, sata, other };
 
+class ahci_storage_device;
+
 class ahci_controller : public bus {
 public:
 	ahci_controller(bus &parent, pci::pci_device &pcidev)
 		: bus(parent)
 		, pcidev_(pcidev)
+		, abar_(nullptr)
+		, port_devices_ { nullptr }
 	{
 	}
 
@@ -27,7 +31,13 @@ public:
 
 private:
 	ahci_port_type detect_port(volatile hba_port *port);
-	void activate_port(volatile hba_port *port, u64 clb, u64 fis);
+	void activate_port(int port_index, volatile hba_port *port, u64 clb, u64 fis);
+
+	static void ahci_irq_handler(u8 irq, void *ctx, void *arg);
+	void handle_interrupt();
+
 	pci::pci_device &pcidev_;
+	volatile hba_mem *abar_;
+	ahci_storage_device *port_devices_[32];
 };
 } // namespace stacsos::kernel::dev::storage
@@ -9,16 +9,24 @@
 
 #include <stacsos/kernel/dev/storage/ahci-structures.h>
 #include <stacsos/kernel/dev/storage/block-device.h>
+#include <stacsos/kernel/lock.h>
+#include <stacsos/kernel/mem/page-table.h>
+#include <stacsos/list.h>
 
 namespace stacsos::kernel::dev::storage {
 class ahci_storage_device : public block_device {
 public:
 	static device_class ahci_storage_device_class;
 
-	ahci_storage_device(bus &parent, volatile hba_port *port)
+	ahci_storage_device(bus &parent, volatile hba_port *port, u32 host_capabilities)
 		: block_device(ahci_storage_device_class, parent)
 		, port_(port)
+		, host_capabilities_(host_capabilities)
 		, nr_blocks_(0)
+		, ncq_(false)
+		, nr_slots_(1)
+		, outstanding_(0)
+		, slot_requests_ { nullptr }
 	{
 	}
 
@@ -28,17 +36,41 @@ public:
 
 	virtual u64 nr_blocks() const override { return nr_blocks_; }
 
+	/**
+	 * @brief Retires completed commands and issues queued ones.  Called from the controller's
+	 * interrupt handler when this port has raised an interrupt.
+	 */
+	void handle_interrupt();
+
 protected:
 	virtual void submit_real_io_request(block_io_request &request) override;
 
 private:
 	volatile hba_port *port_;
+	u32 host_capabilities_;
 	u64 nr_blocks_;
 
+	bool ncq_;
+	u32 nr_slots_;
+
+	// A request waiting for a free command slot, along with the page table its buffer must be
+	// translated with -- it may be issued later from an unrelated context.
+	struct pending_request {
+		block_io_request *request;
+		mem::page_table *pgt;
+	};
+
+	spinlock_irq lock_;
+	u32 outstanding_;
+	block_io_request *slot_requests_[32];
+	list<pending_request> pending_requests_;
+
 	volatile hba_cmd_header *get_free_cmd_slot(int &slot_index);
+	volatile hba_cmd_header *cmd_slot(int slot_index) const;
 	void identify();
 	void detect_partitions();
 
-	void do_read_block_sync(void *buffer, u64 start, u64 count);
+	u16 build_prdt(volatile hba_cmd_table *cmdtbl, mem::page_table &pgt, void *buffer, u64 length, u16 nr_entries = 0);
+	void issue_request(int slot_index, block_io_request &request, mem::page_table &pgt);
 };
 } // namespace stacsos::kernel::dev::storage
@@ -14,12 +14,20 @@ namespace stacsos::kernel::dev::storage {
 #define HBA_PxCMD_FRE 0x0010
 #define HBA_PxCMD_FR 0x4000
 #define HBA_PxCMD_CR 0x8000
+#define HBA_PxIS_DHRS (1u << 0)
+#define HBA_PxIS_SDBS (1u << 3)
 #define HBA_PxIS_TFES (1u << 30)
 
+#define HBA_CAP_SNCQ (1u << 30)
+#define HBA_GHC_IE (1u << 1)
+
 #define ATA_DEV_BUSY 0x80
 #define ATA_DEV_DRQ 0x08
 
 #define ATA_CMD_READ_DMA_EX 0xc8
+#define ATA_CMD_READ_FPDMA_QUEUED 0x60
+#define ATA_CMD_WRITE_DMA_EX 0x35
+#define ATA_CMD_WRITE_FPDMA_QUEUED 0x61
 #define ATA_CMD_IDENTIFY 0xec
 
 enum class fis_type : u8 {
@@ -161,4 +169,12 @@ struct hba_cmd_table {
 	hba_prdt_entry prdt_entry[]; // Physical region descriptor table entries, 0 ~ 65535
 } __packed;
 
+// Each command slot gets a 16 KB command table, which leaves room for 1016 PRDT entries -- enough
+// to describe a buffer of just under 4 MB, even if none of its pages are physically contiguous.
+static const u64 ahci_cmd_table_size = 0x4000;
+static const u64 ahci_max_prdt_entries = (ahci_cmd_table_size - sizeof(hba_cmd_table)) / sizeof(hba_prdt_entry);
+
+// A single PRDT entry can describe at most 4 MB.
+static const u64 ahci_max_prdt_entry_size = 0x400000;
+
 } // namespace stacsos::kernel::dev::storage
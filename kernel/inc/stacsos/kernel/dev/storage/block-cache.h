@@ -0,0 +1,189 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2025
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+#include <stacsos/kernel/lock.h>
+#include <stacsos/kernel/sched/event.h>
+
+namespace stacsos {
+struct meminfo;
+}
+
+namespace stacsos::kernel::mem {
+class page;
+}
+
+namespace stacsos::kernel::dev::storage {
+class block_device;
+class block_cache;
+struct block_io_request;
+
+/**
+ * @brief A cached, page-sized, run of consecutive device blocks.
+ */
+struct block_buffer {
+	u64 index; // buffer number, i.e. first block / blocks_per_buffer
+	mem::page *storage;
+	u8 *data;
+	u32 valid_blocks; // number of blocks actually present (less than a full buffer at the end of the device)
+	u32 refcount;
+	sched::manual_reset_event ready; // triggered once the data has been read in from the device
+	bool dirty; // the data has been modified, and not yet written back to the device
+
+	block_buffer *hash_next;
+	block_buffer *lru_prev, *lru_next;
+	block_buffer *dirty_next;
+};
+
+/**
+ * @brief A reference to a buffer held in a block cache.  The buffer cannot be evicted while
+ * a reference to it exists.
+ */
+class block_buffer_ref {
+public:
+	block_buffer_ref()
+		: cache_(nullptr)
+		, buffer_(nullptr)
+	{
+	}
+
+	block_buffer_ref(block_cache *cache, block_buffer *buffer)
+		: cache_(cache)
+		, buffer_(buffer)
+	{
+	}
+
+	block_buffer_ref(block_buffer_ref &&o)
+		: cache_(o.cache_)
+		, buffer_(o.buffer_)
+	{
+		o.buffer_ = nullptr;
+	}
+
+	block_buffer_ref(const block_buffer_ref &) = delete;
+	block_buffer_ref &operator=(const block_buffer_ref &) = delete;
+
+	~block_buffer_ref() { release(); }
+
+	void release();
+
+	bool valid() const { return buffer_ != nullptr; }
+	const u8 *data() const { return buffer_->data; }
+	block_buffer *buffer() const { return buffer_; }
+
+private:
+	block_cache *cache_;
+	block_buffer *buffer_;
+};
+
+/**
+ * @brief A hashed, LRU-evicting, write-back cache of fixed-size buffers sitting in front of a
+ * block device.  Dirty buffers are never evicted; they are written back by flush(), which is
+ * called periodically by the writeback thread, on fsync, and when the cache fills up.
+ */
+class block_cache {
+	friend class block_buffer_ref;
+
+public:
+	static const u64 block_size = 512;
+	static const u64 buffer_size = PAGE_SIZE;
+	static const u64 blocks_per_buffer = buffer_size / block_size;
+
+	block_cache(block_device &bdev, u64 capacity);
+	~block_cache();
+
+	/**
+	 * @brief Returns a reference to the buffer containing the given block, reading it in from the
+	 * device if necessary.  The returned reference is invalid if no buffer could be obtained.
+	 */
+	block_buffer_ref get(u64 block, u64 &offset_in_buffer);
+
+	/**
+	 * @brief Reads length bytes, starting at the given byte offset on the device, through the cache.
+	 *
+	 * @return Returns the number of bytes read, which is less than length at the end of the device.
+	 */
+	size_t read(void *buffer, u64 offset, size_t length);
+
+	/**
+	 * @brief Starts reading the given range of blocks into the cache in the background, without
+	 * waiting for the data to arrive.  Blocks that are already cached are skipped.
+	 */
+	void prefetch(u64 start_block, u64 count);
+
+	/**
+	 * @brief Writes length bytes, starting at the given byte offset on the device, into the cache.
+	 * The data reaches the device when the modified buffers are next flushed.
+	 *
+	 * @return Returns the number of bytes written, which is less than length at the end of the device.
+	 */
+	size_t write(const void *buffer, u64 offset, size_t length);
+
+	/**
+	 * @brief Writes every dirty buffer back to the device.
+	 */
+	void flush();
+
+	/**
+	 * @brief Discards any cached copies of the given range of blocks, e.g. after they have been
+	 * written to the device directly.
+	 */
+	void invalidate(u64 start_block, u64 count);
+
+	u64 capacity() const { return capacity_; }
+
+	/**
+	 * @brief Adds the statistics for all block caches to the memory statistics.
+	 */
+	static void collect_stats(meminfo &info);
+
+	/**
+	 * @brief Flushes every block cache in the system.
+	 */
+	static void flush_all();
+
+	/**
+	 * @brief Starts the kernel thread that periodically flushes every block cache.  The period
+	 * (in milliseconds) is taken from the writeback-interval command-line option.
+	 */
+	static void start_writeback();
+
+private:
+	block_device &bdev_;
+	u64 capacity_;
+	u64 nr_buffers_;
+
+	spinlock_irq lock_;
+
+	block_buffer **buckets_;
+	u64 nr_buckets_;
+
+	// Unreferenced clean buffers, most recently used at the head.
+	block_buffer *lru_head_, *lru_tail_;
+
+	// Buffers waiting to be written back, whether referenced or not.
+	block_buffer *dirty_head_;
+	u64 nr_dirty_;
+
+	// Every block cache in the system, for the writeback thread.
+	block_cache *next_cache_;
+
+	block_buffer *lookup(u64 index);
+	void hash_insert(block_buffer *buffer);
+	void hash_remove(block_buffer *buffer);
+	void lru_insert(block_buffer *buffer);
+	void lru_remove(block_buffer *buffer);
+
+	block_buffer *acquire(u64 index, bool &needs_fill);
+	void put(block_buffer *buffer);
+	void fill(block_buffer *buffer);
+	static void prefetch_complete(block_io_request *request, void *state);
+	static void writeback_complete(block_io_request *request, void *state);
+	void mark_dirty(block_buffer *buffer);
+};
+} // namespace stacsos::kernel::dev::storage
@@ -8,6 +8,13 @@
 #pragma once
 
 #include <stacsos/kernel/dev/device.h>
+#include <stacsos/kernel/dev/storage/block-cache.h>
+#include <stacsos/kernel/lock.h>
+#include <stacsos/kernel/mem/page-table.h>
+
+namespace stacsos::kernel::mem {
+class address_space;
+}
 
 namespace stacsos::kernel::dev::storage {
 enum class block_io_request_direction { read, write };
@@ -17,35 +24,196 @@ typedef void (*io_request_cb)(block_io_request *, void *);
 
 struct block_io_request {
 	block_io_request_direction direction;
-	u64 start_block;
+	u64 start_block; // may be remapped by devices that the request passes through, e.g. partitions
 	u64 block_count;
 	void *buffer;
 	io_request_cb callback;
 	void *cb_state;
+
+	// Filled in by the block layer, for devices that queue requests.  If segments is set, the
+	// data is scattered across that chain of requests (linked through next), in block order, and
+	// buffer is the buffer of the first of them.  If pgt is set, the buffers must be translated
+	// with it, rather than the current page table, as the request may be dispatched from an
+	// unrelated context.
+	block_io_request *segments = nullptr;
+	block_io_request *next = nullptr;
+	mem::page_table *pgt = nullptr;
 };
 
+/**
+ * @brief Calls fn(buffer, length) for each piece of a request's data, in order.
+ */
+template <typename F> void for_each_request_buffer(const block_io_request &request, F fn)
+{
+	if (!request.segments) {
+		fn(request.buffer, request.block_count * 512);
+		return;
+	}
+
+	for (const block_io_request *segment = request.segments; segment; segment = segment->next) {
+		fn(segment->buffer, segment->block_count * 512);
+	}
+}
+
+class block_plug;
+
 class block_device : public device {
+	friend class block_cache;
+	friend class block_plug;
+
 public:
 	static device_class block_device_class;
 
 	block_device(device_class &devclass, bus &parent)
 		: device(devclass, parent)
+		, cache_(nullptr)
+		, staging_queues_(nullptr)
+		, free_slots_(nullptr)
+		, queue_depth_(0)
+		, max_request_blocks_(0)
 	{
 	}
 
-	virtual ~block_device() { }
+	virtual ~block_device() { delete cache_; }
 
 	virtual u64 nr_blocks() const = 0;
 
+	/**
+	 * @brief Returns the contents of the device, if they are directly addressable in memory, or
+	 * nullptr otherwise.
+	 */
+	virtual const void *mapped_contents() const { return nullptr; }
+
+	/**
+	 * @brief Returns true if a buffer is aligned well enough for any device to transfer to it
+	 * directly.  Devices need at least dword alignment (NVMe PRP entries require it).
+	 */
+	static bool is_dma_aligned(const void *buffer) { return ((u64)buffer & 3) == 0; }
+
+	/**
+	 * @brief Submits a request, which completes asynchronously through its callback.  If the
+	 * device queues requests, the request is staged on this core's software queue, where it may
+	 * be merged with requests for adjacent blocks, and is dispatched to the hardware once there is
+	 * room for it.  If the submitting thread holds a plug on the device, the request is held by
+	 * the plug until it is released.
+	 */
 	void submit_io_request(block_io_request &request);
 
+	/**
+	 * @brief Returns the device that queues this device's requests, which is the one that a
+	 * block_plug applies to.
+	 */
+	virtual block_device &queueing_device() { return *this; }
+
 	void read_blocks_sync(void *buffer, u64 start, u64 count);
 	void write_blocks_sync(const void *buffer, u64 start, u64 count);
 
+	/**
+	 * @brief Reads blocks straight into a buffer in the given address space, bypassing the cache.
+	 * The memory behind the buffer is pinned for the duration of the transfer.
+	 *
+	 * @return Returns false (having transferred nothing) if the buffer does not lie within a
+	 * single writable region of the address space, or is not suitably aligned for DMA.
+	 */
+	bool read_blocks_direct(mem::address_space &as, void *buffer, u64 start, u64 count);
+
+	/**
+	 * @brief Returns the buffer cache for this device, creating it on first use.  Its capacity
+	 * (in buffers) is taken from the bcache-capacity command-line option.
+	 */
+	block_cache &cache();
+
 protected:
+	/**
+	 * @brief The hardware dispatch interface.  Called with each request that is to be issued to
+	 * the device.  For devices that queue requests, no more than the configured queue depth are
+	 * outstanding at once, merged requests are no larger than the configured maximum, and this
+	 * may be called from interrupt context.
+	 */
 	virtual void submit_real_io_request(block_io_request &request) = 0;
 
+	/**
+	 * @brief Puts the block layer's software queues in front of this device.  The queue depth
+	 * given by the driver (normally the number of requests the hardware can have outstanding) can
+	 * be overridden by the blk-queue-depth command-line option.
+	 *
+	 * @param max_request_blocks The largest request that merging may produce.
+	 */
+	void enable_queueing(u32 queue_depth, u64 max_request_blocks);
+
+	/**
+	 * @brief Issues a request that is too large for the hardware as a series of requests of at
+	 * most max_blocks, through submit_real_io_request(), and completes the original request when
+	 * the last of them completes.
+	 */
+	void split_request(block_io_request &request, u64 max_blocks);
+
 private:
+	block_cache *cache_;
+
+	// Requests staged on one core, in block order wherever that does not reorder overlapping
+	// requests.
+	struct staging_queue {
+		staging_queue()
+			: head(nullptr)
+			, nr_staged(0)
+		{
+		}
+
+		spinlock_irq lock;
+		block_io_request *head;
+		u64 nr_staged;
+	};
+
+	// A request issued to the hardware, standing in for the staged requests merged into it.
+	struct dispatch_slot {
+		block_io_request request;
+		block_device *owner;
+		dispatch_slot *next_free;
+	};
+
+	staging_queue *staging_queues_;
+
+	spinlock_irq dispatch_lock_;
+	dispatch_slot *free_slots_;
+	u32 queue_depth_;
+	u64 max_request_blocks_;
+
+	void stage_request(staging_queue &q, block_io_request &request);
+	void release_plugged(block_plug &plug);
+	void dispatch_staged();
+	bool dispatch_one(staging_queue &q);
+	static void dispatch_complete(block_io_request *request, void *state);
+	static void split_request_cb(block_io_request *request, void *state);
+
 	void submit_sync_request(block_io_request_direction direction, void *buffer, u64 start, u64 count);
 };
+
+/**
+ * @brief Holds back the requests that the current thread submits to a block device, for as long
+ * as the object is in scope, so that they can be batched and merged.  Other threads' requests are
+ * unaffected.  Plugs nest, and only the outermost plug on a device takes effect.  Synchronous
+ * requests release the plug before waiting, but a thread must not otherwise wait for its own
+ * requests while it holds one.
+ */
+class block_plug {
+	DELETE_DEFAULT_COPY_AND_MOVE(block_plug)
+
+	friend class block_device;
+
+public:
+	block_plug(block_device &bdev);
+	~block_plug();
+
+private:
+	block_device &bdev_;
+	bool active_;
+	block_plug *outer_;
+
+	block_io_request *held_head_;
+	block_io_request **held_tail_;
+	u64 nr_held_;
+
+	static block_plug *find(block_device &bdev);
+};
 } // namespace stacsos::kernel::dev::storage
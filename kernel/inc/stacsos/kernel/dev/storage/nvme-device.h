@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2025
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+#include <stacsos/kernel/arch/core-manager.h>
+#include <stacsos/kernel/dev/pci/pci-device.h>
+#include <stacsos/kernel/dev/storage/block-device.h>
+#include <stacsos/kernel/dev/storage/nvme-structures.h>
+#include <stacsos/kernel/lock.h>
+#include <stacsos/kernel/mem/page-table.h>
+#include <stacsos/list.h>
+
+namespace stacsos::kernel::dev::storage {
+/**
+ * @brief The first namespace of an NVMe controller.  One I/O submission/completion queue pair is
+ * created per core (as far as the controller allows), each completing through its own MSI-X
+ * vector, so that cores do not contend on a single queue.  Admin commands are only issued while
+ * the device is being configured, and are polled for.
+ */
+class nvme_device : public block_device {
+public:
+	static device_class nvme_device_class;
+
+	nvme_device(bus &parent, pci::pci_device &pcidev)
+		: block_device(nvme_device_class, parent)
+		, pcidev_(pcidev)
+		, regs_(nullptr)
+		, doorbell_stride_(0)
+		, nsid_(0)
+		, nr_blocks_(0)
+		, max_blocks_(0)
+		, admin_(nullptr)
+		, nr_queues_(0)
+	{
+	}
+
+	virtual ~nvme_device() { }
+
+	virtual void configure() override;
+
+	virtual u64 nr_blocks() const override { return nr_blocks_; }
+
+protected:
+	virtual void submit_real_io_request(block_io_request &request) override;
+
+private:
+	// A request waiting for a free command identifier, along with the page table its buffer must
+	// be translated with -- it may be issued later from an unrelated context.
+	struct pending_request {
+		block_io_request *request;
+		mem::page_table *pgt;
+	};
+
+	struct queue_pair {
+		nvme_device *owner;
+		u16 id, size;
+
+		volatile nvme_command *sq;
+		volatile nvme_completion *cq;
+		u64 sq_phys, cq_phys;
+		volatile u32 *sq_doorbell, *cq_doorbell;
+
+		u16 sq_tail, cq_head;
+		u16 cq_phase;
+
+		spinlock_irq lock;
+
+		// Outstanding requests, indexed by command identifier, and the identifiers not in use.
+		block_io_request **requests;
+		u16 *free_cids;
+		u16 nr_free_cids;
+
+		// One page of PRP list per command identifier.
+		u64 prp_lists_phys;
+
+		list<pending_request> pending;
+	};
+
+	pci::pci_device &pcidev_;
+	volatile u8 *regs_;
+	u32 doorbell_stride_;
+
+	u32 nsid_;
+	u64 nr_blocks_;
+	u64 max_blocks_;
+
+	queue_pair *admin_;
+
+	int nr_queues_;
+	queue_pair *queues_[arch::core_manager::max_cores];
+
+	u32 read32(u32 reg) const { return *(volatile u32 *)(regs_ + reg); }
+	u64 read64(u32 reg) const { return *(volatile u64 *)(regs_ + reg); }
+	void write32(u32 reg, u32 value) { *(volatile u32 *)(regs_ + reg) = value; }
+	void write64(u32 reg, u64 value) { *(volatile u64 *)(regs_ + reg) = value; }
+
+	bool reset_controller();
+	bool identify(u64 identify_phys);
+	void create_io_queues();
+
+	queue_pair *create_queue_pair(u16 id, u16 size);
+	u16 admin_command(nvme_command &cmd, u32 *result = nullptr);
+	void submit_command(queue_pair &qp, nvme_command &cmd);
+	static bool next_completion(queue_pair &qp, nvme_completion &completion);
+
+	bool issue_request(queue_pair &qp, block_io_request &request, mem::page_table &pgt);
+
+	static void queue_irq_handler(u8 irq, void *ctx, void *arg);
+	void handle_queue_interrupt(queue_pair &qp);
+
+	void detect_partitions();
+};
+} // namespace stacsos::kernel::dev::storage
@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2025
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+namespace stacsos::kernel::dev::storage {
+// Controller registers
+#define NVME_REG_CAP 0x00
+#define NVME_REG_VS 0x08
+#define NVME_REG_INTMS 0x0c
+#define NVME_REG_INTMC 0x10
+#define NVME_REG_CC 0x14
+#define NVME_REG_CSTS 0x1c
+#define NVME_REG_AQA 0x24
+#define NVME_REG_ASQ 0x28
+#define NVME_REG_ACQ 0x30
+#define NVME_REG_DOORBELL_BASE 0x1000
+
+#define NVME_CC_EN (1u << 0)
+#define NVME_CC_IOSQES (6u << 16) // 64-byte submission queue entries
+#define NVME_CC_IOCQES (4u << 20) // 16-byte completion queue entries
+
+#define NVME_CSTS_RDY (1u << 0)
+#define NVME_CSTS_CFS (1u << 1)
+
+// Admin command opcodes
+#define NVME_ADMIN_CREATE_SQ 0x01
+#define NVME_ADMIN_CREATE_CQ 0x05
+#define NVME_ADMIN_IDENTIFY 0x06
+#define NVME_ADMIN_SET_FEATURES 0x09
+
+#define NVME_IDENTIFY_NAMESPACE 0x00
+#define NVME_IDENTIFY_CONTROLLER 0x01
+#define NVME_IDENTIFY_ACTIVE_NAMESPACES 0x02
+
+#define NVME_FEATURE_NUMBER_OF_QUEUES 0x07
+
+// I/O command opcodes
+#define NVME_CMD_WRITE 0x01
+#define NVME_CMD_READ 0x02
+
+struct nvme_command {
+	u8 opcode;
+	u8 flags;
+	u16 cid;
+	u32 nsid;
+	u64 reserved;
+	u64 mptr;
+	u64 prp1;
+	u64 prp2;
+	u32 cdw10;
+	u32 cdw11;
+	u32 cdw12;
+	u32 cdw13;
+	u32 cdw14;
+	u32 cdw15;
+} __packed;
+
+static_assert(sizeof(nvme_command) == 64, "NVMe submission queue entry has incorrect size");
+
+struct nvme_completion {
+	u32 result;
+	u32 reserved;
+	u16 sq_head;
+	u16 sq_id;
+	u16 cid;
+	u16 status; // bit 0 is the phase tag
+} __packed;
+
+static_assert(sizeof(nvme_completion) == 16, "NVMe completion queue entry has incorrect size");
+} // namespace stacsos::kernel::dev::storage
@@ -50,41 +50,19 @@ public:
 
 	virtual u64 nr_blocks() const override { return nr_blocks_; }
 
+	// Requests are queued by the underlying device, so that is the one to plug.
+	virtual block_device &queueing_device() override { return owner_.queueing_device(); }
+
 protected:
 	virtual void submit_real_io_request(block_io_request &request) override
 	{
-		block_io_request *underlying_request = new block_io_request();
-		underlying_request->direction = request.direction;
-		underlying_request->block_count = request.block_count;
-		underlying_request->start_block = request.start_block + block_offset_;
-		underlying_request->buffer = request.buffer;
-		underlying_request->callback = partition_request_cb;
-
-		callback_state *cb_state = new callback_state();
-		cb_state->original_request = &request;
-
-		underlying_request->cb_state = cb_state;
-
-		owner_.submit_io_request(*underlying_request);
+		// The request is passed straight through to the underlying device, with its start block
+		// remapped in place.  Completion is signalled to the original callback by that device.
+		request.start_block += block_offset_;
+		owner_.submit_io_request(request);
 	}
 
 private:
-	struct callback_state {
-		block_io_request *original_request;
-	};
-
-	static void partition_request_cb(block_io_request *request, void *state)
-	{
-		callback_state *cb_state = (callback_state *)state;
-
-		if (cb_state->original_request->callback) {
-			cb_state->original_request->callback(cb_state->original_request, cb_state->original_request->cb_state);
-		}
-
-		delete cb_state;
-		delete request;
-	}
-
 	block_device &owner_;
 	u64 block_offset_;
 	u64 nr_blocks_;
@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2025
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+#include <stacsos/kernel/dev/storage/block-device.h>
+
+namespace stacsos::kernel::dev::storage {
+/**
+ * @brief A block device whose contents are held in memory, e.g. an image loaded by the boot
+ * loader.  Requests are completed immediately, by copying to or from the image.
+ */
+class ram_block_device : public block_device {
+public:
+	static device_class ram_block_device_class;
+
+	ram_block_device(bus &parent, void *data, u64 size)
+		: block_device(ram_block_device_class, parent)
+		, data_((u8 *)data)
+		, nr_blocks_(size / 512)
+	{
+	}
+
+	virtual ~ram_block_device() { }
+
+	virtual void configure() override { }
+
+	virtual u64 nr_blocks() const override { return nr_blocks_; }
+
+	virtual const void *mapped_contents() const override { return data_; }
+
+protected:
+	virtual void submit_real_io_request(block_io_request &request) override;
+
+private:
+	u8 *data_;
+	u64 nr_blocks_;
+};
+} // namespace stacsos::kernel::dev::storage
@@ -0,0 +1,93 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2025
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+#include <stacsos/kernel/arch/core-manager.h>
+#include <stacsos/kernel/dev/storage/block-device.h>
+#include <stacsos/kernel/lock.h>
+#include <stacsos/kernel/mem/page-table.h>
+#include <stacsos/list.h>
+
+namespace stacsos::kernel::dev::virtio {
+class virtio_pci_transport;
+class virtqueue;
+} // namespace stacsos::kernel::dev::virtio
+
+namespace stacsos::kernel::dev::storage {
+struct virtio_blk_req_header {
+	u32 type;
+	u32 reserved;
+	u64 sector;
+} __packed;
+
+/**
+ * @brief A virtio block device.  If the device offers multiple queues, one is used per core (up to
+ * the number of cores), so that cores submitting requests concurrently do not contend on a
+ * single queue lock.  Each queue completes requests through its own MSI-X vector.
+ */
+class virtio_block_device : public block_device {
+public:
+	static device_class virtio_block_device_class;
+
+	virtio_block_device(bus &parent, virtio::virtio_pci_transport &transport)
+		: block_device(virtio_block_device_class, parent)
+		, transport_(transport)
+		, nr_blocks_(0)
+		, max_segments_(0)
+		, nr_queues_(0)
+	{
+	}
+
+	virtual ~virtio_block_device() { }
+
+	virtual void configure() override;
+
+	virtual u64 nr_blocks() const override { return nr_blocks_; }
+
+protected:
+	virtual void submit_real_io_request(block_io_request &request) override;
+
+private:
+	// A request waiting for free descriptors, along with the page table its buffer must be
+	// translated with -- it may be issued later from an unrelated context.
+	struct pending_request {
+		block_io_request *request;
+		mem::page_table *pgt;
+	};
+
+	// Per-queue state.  Request headers and status bytes live in DMA-able memory, indexed by the
+	// head descriptor of the request's chain.
+	struct request_queue {
+		virtio_block_device *owner;
+		virtio::virtqueue *vq;
+
+		spinlock_irq lock;
+		block_io_request **requests;
+		volatile virtio_blk_req_header *headers;
+		volatile u8 *statuses;
+		u64 headers_phys, statuses_phys;
+
+		list<pending_request> pending;
+	};
+
+	virtio::virtio_pci_transport &transport_;
+	u64 nr_blocks_;
+	u32 max_segments_;
+
+	int nr_queues_;
+	request_queue *queues_[arch::core_manager::max_cores];
+
+	void create_queue(int index, u16 msix_vector);
+	void detect_partitions();
+
+	bool issue_request(request_queue &q, block_io_request &request, mem::page_table &pgt);
+
+	static void queue_irq_handler(u8 irq, void *ctx, void *arg);
+	void handle_queue_interrupt(request_queue &q);
+};
+} // namespace stacsos::kernel::dev::storage
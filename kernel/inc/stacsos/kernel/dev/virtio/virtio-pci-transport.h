@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2025
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+#include <stacsos/kernel/dev/pci/pci-device.h>
+
+namespace stacsos::kernel::dev::virtio {
+class virtqueue;
+
+enum virtio_status : u8 { acknowledge = 1, driver = 2, driver_ok = 4, features_ok = 8, failed = 0x80 };
+
+// Feature bits common to all device types.
+static const u64 virtio_f_version_1 = 1ull << 32;
+
+/**
+ * @brief The common configuration structure of a modern virtio PCI device.
+ */
+struct virtio_pci_common_cfg {
+	u32 device_feature_select;
+	u32 device_feature;
+	u32 driver_feature_select;
+	u32 driver_feature;
+	u16 config_msix_vector;
+	u16 num_queues;
+	u8 device_status;
+	u8 config_generation;
+
+	u16 queue_select;
+	u16 queue_size;
+	u16 queue_msix_vector;
+	u16 queue_enable;
+	u16 queue_notify_off;
+	u64 queue_desc;
+	u64 queue_driver;
+	u64 queue_device;
+} __packed;
+
+/**
+ * @brief Drives a virtio device through the modern (virtio 1.0) PCI interface, in which the
+ * configuration structures are located through vendor-specific PCI capabilities.
+ */
+class virtio_pci_transport {
+public:
+	static const u16 no_vector = 0xffff;
+
+	virtio_pci_transport(pci::pci_device &pcidev)
+		: pcidev_(pcidev)
+		, common_(nullptr)
+		, notify_base_(0)
+		, notify_multiplier_(0)
+		, device_cfg_(nullptr)
+	{
+	}
+
+	pci::pci_device &pcidev() const { return pcidev_; }
+
+	/**
+	 * @brief Locates the device's configuration structures.  Returns false if the device does not
+	 * provide the modern interface.
+	 */
+	bool probe();
+
+	/**
+	 * @brief Resets the device, then acknowledges it and negotiates features.  The driver must
+	 * call ready() once its queues have been set up.
+	 *
+	 * @param wanted The features the driver can make use of.  VERSION_1 is always requested.
+	 * @return Returns the features that were accepted, or zero if negotiation failed.
+	 */
+	u64 initialise(u64 wanted);
+
+	void ready() { common_->device_status = common_->device_status | virtio_status::driver_ok; }
+	void fail() { common_->device_status = common_->device_status | virtio_status::failed; }
+
+	u16 nr_queues() const { return common_->num_queues; }
+
+	/**
+	 * @brief Returns the largest size the device supports for a queue, or zero if the queue does
+	 * not exist.
+	 */
+	u16 max_queue_size(u16 index);
+
+	/**
+	 * @brief Tells the device where a queue's rings are, routes its interrupts to an MSI-X table
+	 * entry (or no_vector), and enables it.  Returns false if the device rejected the vector.
+	 */
+	bool setup_queue(virtqueue &vq, u16 msix_vector);
+
+	/**
+	 * @brief Tells the device that new chains are available in a queue.
+	 */
+	void notify(const virtqueue &vq);
+
+	template <typename T> T read_device_config(u32 offset) const { return *(volatile T *)((uintptr_t)device_cfg_ + offset); }
+
+private:
+	pci::pci_device &pcidev_;
+
+	volatile virtio_pci_common_cfg *common_;
+	uintptr_t notify_base_;
+	u32 notify_multiplier_;
+	volatile void *device_cfg_;
+
+	u16 notify_offsets_[64];
+};
+} // namespace stacsos::kernel::dev::virtio
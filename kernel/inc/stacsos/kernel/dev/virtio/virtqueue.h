@@ -0,0 +1,106 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2025
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+namespace stacsos::kernel::dev::virtio {
+struct virtq_desc {
+	u64 addr;
+	u32 len;
+	u16 flags;
+	u16 next;
+} __packed;
+
+struct virtq_avail {
+	u16 flags;
+	u16 idx;
+	u16 ring[];
+} __packed;
+
+struct virtq_used_elem {
+	u32 id;
+	u32 len;
+} __packed;
+
+struct virtq_used {
+	u16 flags;
+	u16 idx;
+	virtq_used_elem ring[];
+} __packed;
+
+/**
+ * @brief A buffer to be placed in a virtqueue, given by its physical address.
+ */
+struct virtq_buffer {
+	u64 address;
+	u32 length;
+	bool device_writable;
+};
+
+/**
+ * @brief A split virtqueue.  The descriptor table, available ring and used ring are allocated
+ * together, in physically contiguous memory.  The queue does no locking of its own.
+ */
+class virtqueue {
+public:
+	static const u16 desc_f_next = 1;
+	static const u16 desc_f_write = 2;
+
+	static const u16 used_f_no_notify = 1;
+
+	virtqueue(u16 index, u16 size);
+
+	u16 index() const { return index_; }
+	u16 size() const { return size_; }
+	u16 nr_free() const { return nr_free_; }
+
+	u64 desc_address() const { return base_; }
+	u64 avail_address() const { return base_ + avail_offset_; }
+	u64 used_address() const { return base_ + used_offset_; }
+
+	/**
+	 * @brief Returns the head descriptor that the next chain added to the queue will use, so that
+	 * per-request state can be prepared before the chain is made available.
+	 */
+	u16 next_head() const { return free_head_; }
+
+	/**
+	 * @brief Places a chain of buffers in the descriptor table, and makes it available to the
+	 * device.  The device must be notified separately.
+	 *
+	 * @return Returns the index of the head descriptor, which identifies the chain when the
+	 * device has used it, or -1 if there are not enough free descriptors.
+	 */
+	int add_chain(const virtq_buffer *buffers, int count);
+
+	/**
+	 * @brief Retrieves the next chain that the device has finished with, and returns its
+	 * descriptors to the free list.
+	 *
+	 * @return Returns false if there are no more used chains.
+	 */
+	bool next_used(u16 &head, u32 &length);
+
+	/**
+	 * @brief Returns true if the device wants to be notified of newly available chains.
+	 */
+	bool needs_notification() const { return !(used_->flags & used_f_no_notify); }
+
+private:
+	u16 index_, size_;
+
+	u64 base_;
+	u64 avail_offset_, used_offset_;
+
+	volatile virtq_desc *desc_;
+	volatile virtq_avail *avail_;
+	volatile virtq_used *used_;
+
+	u16 free_head_, nr_free_;
+	u16 last_used_;
+};
+} // namespace stacsos::kernel::dev::virtio
@@ -0,0 +1,86 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2025
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+#include <stacsos/kernel/lock.h>
+
+namespace stacsos::kernel::fs {
+class fs_node;
+
+/**
+ * @brief Caches the result of resolving a name within a directory, keyed on a hash of the parent
+ * node and the name.  Names that do not exist are cached too (as negative entries), and the least
+ * recently used entry is recycled when the cache is full.
+ *
+ * All storage is statically allocated.  Nodes are never freed by their filesystems, so cached
+ * node pointers remain valid for as long as they are in the cache.
+ */
+class dentry_cache {
+	DEFINE_SINGLETON(dentry_cache)
+
+private:
+	dentry_cache();
+
+public:
+	static const int max_entries = 1024;
+	static const int nr_buckets = 2048;
+
+	// Longer names are not cached, and are always resolved by the filesystem.
+	static const int max_name_length = 47;
+
+	/**
+	 * @brief Looks up a name within a directory.
+	 *
+	 * @param child Set to the cached child, which is nullptr if the name is known not to exist.
+	 * @return Returns true if the cache held an entry for the name.
+	 */
+	bool lookup(const fs_node *parent, const char *name, fs_node *&child);
+
+	/**
+	 * @brief Records the result of resolving a name within a directory.  A null child records
+	 * that the name does not exist.
+	 */
+	void insert(const fs_node *parent, const char *name, fs_node *child);
+
+	/**
+	 * @brief Discards any cached entry for a name within a directory, e.g. because it has been
+	 * created.
+	 */
+	void invalidate(const fs_node *parent, const char *name);
+
+	u64 hits() const { return hits_; }
+	u64 misses() const { return misses_; }
+
+private:
+	struct entry {
+		const fs_node *parent;
+		fs_node *child;
+		u32 hash;
+		char name[max_name_length + 1];
+
+		entry *hash_next;
+		entry *lru_prev, *lru_next;
+	};
+
+	spinlock_irq lock_;
+
+	entry entries_[max_entries];
+	entry *buckets_[nr_buckets];
+	int nr_used_;
+
+	// In-use entries, most recently used at the head.
+	entry *lru_head_, *lru_tail_;
+
+	u64 hits_, misses_;
+
+	entry *find(const fs_node *parent, const char *name, u32 hash);
+	void remove(entry *e);
+	void lru_insert(entry *e);
+	void lru_remove(entry *e);
+};
+} // namespace stacsos::kernel::fs
@@ -16,72 +16,146 @@
 namespace stacsos::kernel::fs {
 class fat_filesystem;
 class fat_file;
+class fat_node;
+
+/**
+ * @brief A run of physically contiguous clusters in a file.
+ */
+struct fat_extent {
+	u64 file_cluster; // index of the first cluster of the run, within the file
+	u64 first_cluster; // the first cluster of the run, on disk
+	u64 length; // number of clusters in the run
+};
 
 class fat_file : public file {
 public:
-	fat_file(fat_filesystem &fs, u64 first_cluster, u64 file_size)
-		: file(file_size)
-		, fs_(fs)
-		, clusters_(nullptr)
-		, nr_clusters_(0)
-	{
-		read_cluster_list(first_cluster, file_size);
-	}
+	fat_file(fat_filesystem &fs, fat_node &node);
+
+	virtual ~fat_file() { }
 
-	virtual ~fat_file() { delete[] clusters_; }
+	// The size is kept by the node, so that every open handle sees the file grow.
+	virtual u64 size() const override;
 
 	virtual size_t pread(void *buffer, size_t offset, size_t length);
 	virtual size_t pwrite(const void *buffer, size_t offset, size_t length);
 
+	virtual size_t write(const void *buffer, size_t length) override
+	{
+		// Unlike the default, writes are not limited by the current size -- they grow the file.
+		size_t result = pwrite(buffer, cur_offset_, length);
+		cur_offset_ += result;
+
+		return result;
+	}
+
+	virtual void fsync() override;
+
+	virtual u64 ioctl(u64 cmd, void *buffer, size_t length) override;
+
 private:
-	void read_cluster_list(u64 first_cluster, u64 file_size);
+	void write_data(const void *buffer, u64 offset, u64 length);
+
+	void readahead(u64 offset, u64 length);
+	void prefetch_clusters(u64 first_cluster, u64 end_cluster);
+
+	bool read_direct(void *buffer, u64 device_offset, u64 length);
 
 	fat_filesystem &fs_;
-	u64 *clusters_;
-	u64 nr_clusters_;
+	fat_node &node_;
+
+	// Sequential read-ahead state.  Windows are measured in clusters.
+	u64 ra_min_window_, ra_max_window_, ra_window_;
+	u64 ra_prev_end_; // the file offset just past the previous read
+	u64 ra_start_, ra_end_; // the range of file clusters that has been read ahead
+	u64 ra_hits_, ra_misses_;
+	u64 ra_batch_misses_; // misses since the last batch of read-ahead was issued
+
+	// Sector-aligned reads into user memory bypass the cache, and are transferred by the device
+	// straight into the caller's buffer.
+	bool direct_io_;
 };
 
 class fat_node : public fs_node {
 	friend class fat_filesystem;
+	friend class fat_file;
 
 public:
-	fat_node(filesystem &fs, fs_node *parent, fs_node_kind kind, const string &name, u64 sector, u64 cluster, u64 data_size)
-		: fs_node(fs, parent, kind, name)
+	fat_node(filesystem &fs, fs_node *parent, fs_node_kind kind, string name, u64 sector, u64 cluster, u64 data_size, u64 dentry_offset = 0)
+		: fs_node(fs, parent, kind, move(name))
 		, sector_(sector)
 		, cluster_(cluster)
 		, data_size_(data_size)
+		, dentry_offset_(dentry_offset)
 		, loaded_(false)
+		, load_(nullptr)
+		, children_(nullptr)
+		, nr_children_(0)
+		, children_capacity_(0)
+		, index_(nullptr)
+		, index_size_(0)
+		, index_next_(nullptr)
+		, extents_ready_(false)
+		, extents_(nullptr)
+		, nr_extents_(0)
+		, extents_capacity_(0)
+		, mapped_clusters_(0)
+		, next_chain_cluster_(0)
+		, nr_clusters_(0)
 	{
 	}
 
-	virtual ~fat_node() { }
+	virtual ~fat_node();
 
-	virtual shared_ptr<file> open() override { return shared_ptr<file>(new fat_file((fat_filesystem &)fs(), cluster_, data_size_)); }
+	virtual shared_ptr<file> open() override { return shared_ptr<file>(new fat_file((fat_filesystem &)fs(), *this)); }
 	virtual fs_node *mkdir(const char *name) override;
 
-	// P3: public helper methods to be able to access file properties for listdir system call
-
-	// load and get children list
-	list<fat_node*> &children() {
-		load();
-		return children_;
-	}
-
-	// get file size 
-	u64 data_size() const {
-		return data_size_;
-	}
+	virtual u64 size() const override { return data_size_; }
+	virtual fs_node *child_at(u64 index) override;
 
 protected:
 	virtual fs_node *resolve_child(const string &name) override;
 
 private:
-	void load();
+	struct load_state;
+
+	void load_next_chunk();
+	void parse_lfn_entry(const u8 *dentry);
+
+	void add_child(fat_node *child);
+	fat_node *find_child(const string &name) const;
+
+	void init_extents();
+	const fat_extent *find_extent(u64 file_cluster);
+	bool map_extents_to(u64 file_cluster);
+	void append_extent(u64 file_cluster, u64 first_cluster);
+	u64 grow_to(u64 nr_clusters);
 
 	u64 sector_, cluster_;
 	u64 data_size_;
+	u64 dentry_offset_; // byte offset of the directory entry on the device, or zero if there isn't one
+
+	// Directories are parsed a cluster at a time, and only as far as a lookup needs to go.  The
+	// parsing state is kept until the last entry has been seen.
 	bool loaded_;
-	list<fat_node *> children_;
+	load_state *load_;
+
+	// Children, in directory order.
+	fat_node **children_;
+	u64 nr_children_, children_capacity_;
+
+	// Children are also indexed by a hash of their name.
+	fat_node **index_;
+	u64 index_size_;
+	fat_node *index_next_; // the next node in the same bucket of the parent's index
+
+	// The extent map of a file is built lazily, by following the cluster chain only as far as it
+	// has been accessed.  It belongs to the node, so that it is shared by every open handle.
+	bool extents_ready_;
+	fat_extent *extents_;
+	u64 nr_extents_, extents_capacity_;
+	u64 mapped_clusters_; // number of file clusters covered by the extent map
+	u64 next_chain_cluster_; // the next cluster in the chain, after the mapped clusters
+	u64 nr_clusters_;
 };
 
 class fat_filesystem : public physical_filesystem {
@@ -92,11 +166,24 @@ public:
 	fat_filesystem(dev::storage::block_device &bdev)
 		: physical_filesystem(bdev)
 		, root_(*this, nullptr, fs_node_kind::directory, "", 0, 0, 0)
+		, fat_type_(16)
+		, fat_table_(nullptr)
+		, nr_fat_entries_(0)
+		, nr_free_clusters_(0)
+		, fsinfo_offset_(0)
+		, cluster_bitmap_(nullptr)
+		, nr_bitmap_words_(0)
+		, next_free_hint_(0)
+		, last_allocated_cluster_(0)
 	{
 		init();
 	}
 
-	virtual ~fat_filesystem() { }
+	virtual ~fat_filesystem()
+	{
+		delete[] fat_table_;
+		delete[] cluster_bitmap_;
+	}
 
 	virtual fs_node &root() override { return root_; }
 
@@ -108,11 +195,41 @@ private:
 	shared_ptr<u8> read_cluster(u64 cluster) { return read_cluster_from_sector(compute_sector_for_cluster(cluster)); }
 	shared_ptr<u8> read_cluster_from_sector(u64 sector);
 
-	u64 next_cluster(u64 this_cluster);
+	// FAT entries at or above this value mark the end of a chain.  FAT16 entries are widened to
+	// their FAT32 equivalents when the FAT is loaded, so this holds for both.
+	static const u32 end_of_chain = 0x0ffffff8;
+
+	static bool is_end_of_chain(u64 cluster) { return cluster < 2 || cluster >= end_of_chain; }
+
+	u64 next_cluster(u64 this_cluster) const { return this_cluster < nr_fat_entries_ ? fat_table_[this_cluster] : 0x0fffffff; }
+
+	void load_fat();
+
+	u64 allocate_cluster();
+	void set_fat_entry(u64 cluster, u32 value);
+	void update_fsinfo();
+	void update_dentry(const fat_node &node);
 
 	fat_node root_;
 
+	int fat_type_; // 16 or 32
+
+	// The FAT is read into memory at mount, so following cluster chains needs no I/O.
+	u32 *fat_table_;
+	u64 nr_fat_entries_;
+	u64 nr_free_clusters_;
+
+	// Byte offset of the FAT32 FSInfo sector on the device, or zero if there isn't one.
+	u64 fsinfo_offset_;
+
+	// One bit per cluster, set if the cluster is in use.
+	u64 *cluster_bitmap_;
+	u64 nr_bitmap_words_;
+	u64 next_free_hint_; // the bitmap word to start searching from
+	u64 last_allocated_cluster_; // recorded in the FSInfo sector, or zero if unknown
+
 	u64 total_sectors;
+	u64 nr_fats;
 	u64 fat_size;
 	u64 root_dir_sectors;
 	u64 first_fat_sector;
@@ -7,7 +7,36 @@
  */
 #pragma once
 
+#include <stacsos/syscalls.h>
+
 namespace stacsos::kernel::fs {
+/**
+ * @brief Calls op(segment, transferred) for each segment in turn, accumulating the number of bytes
+ * transferred in total.  op returns false if the operation failed.  Stops at the first segment
+ * that fails, or that is not transferred completely.
+ *
+ * @return Returns false if the first segment failed, i.e. nothing was transferred.
+ */
+template <typename Operation> bool for_each_io_segment(const io_segment *segments, size_t count, u64 &total, Operation op)
+{
+	total = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		u64 transferred = 0;
+		if (!op(segments[i], transferred)) {
+			return total > 0;
+		}
+
+		total += transferred;
+
+		if (transferred < segments[i].length) {
+			break;
+		}
+	}
+
+	return true;
+}
+
 class filesystem;
 class file {
 public:
@@ -21,14 +50,22 @@ public:
 
 	virtual u64 ioctl(u64 cmd, void *buffer, size_t length) { return 0; }
 
+	virtual u64 size() const { return size_; }
+
+	/**
+	 * @brief Writes any modified data for this file that is still being held in memory back
+	 * to the underlying storage.
+	 */
+	virtual void fsync() { }
+
 	virtual size_t pread(void *buffer, size_t offset, size_t length) = 0;
 	virtual size_t pwrite(const void *buffer, size_t offset, size_t length) = 0;
 
 	virtual size_t read(void *buffer, size_t length)
 	{
 		u64 read_length = length;
-		if ((cur_offset_ + read_length) > size_) {
-			read_length = size_ - cur_offset_;
+		if ((cur_offset_ + read_length) > size()) {
+			read_length = size() - cur_offset_;
 		}
 
 		size_t result = pread(buffer, cur_offset_, read_length);
@@ -40,8 +77,8 @@ public:
 	virtual size_t write(const void *buffer, size_t length)
 	{
 		u64 write_length = length;
-		if ((cur_offset_ + write_length) > size_) {
-			write_length = size_ - cur_offset_;
+		if ((cur_offset_ + write_length) > size()) {
+			write_length = size() - cur_offset_;
 		}
 
 		size_t result = pwrite(buffer, cur_offset_, write_length);
@@ -50,8 +87,46 @@ public:
 		return result;
 	}
 
-private:
+	/**
+	 * @brief Vectored variants of pread, pwrite, read and write.  By default, these issue one
+	 * operation per segment, stopping at the first segment that is not transferred completely.
+	 *
+	 * @return Returns the total number of bytes transferred.
+	 */
+	virtual size_t preadv(const io_segment *segments, size_t count)
+	{
+		return for_each_segment(segments, count, [this](const io_segment &s) { return pread(s.buffer, s.offset, s.length); });
+	}
+
+	virtual size_t pwritev(const io_segment *segments, size_t count)
+	{
+		return for_each_segment(segments, count, [this](const io_segment &s) { return pwrite(s.buffer, s.offset, s.length); });
+	}
+
+	virtual size_t readv(const io_segment *segments, size_t count)
+	{
+		return for_each_segment(segments, count, [this](const io_segment &s) { return read(s.buffer, s.length); });
+	}
+
+	virtual size_t writev(const io_segment *segments, size_t count)
+	{
+		return for_each_segment(segments, count, [this](const io_segment &s) { return write(s.buffer, s.length); });
+	}
+
+protected:
 	u64 size_;
 	u64 cur_offset_;
+
+private:
+	template <typename Operation> static size_t for_each_segment(const io_segment *segments, size_t count, Operation op)
+	{
+		u64 total;
+		for_each_io_segment(segments, count, total, [&op](const io_segment &s, u64 &transferred) {
+			transferred = op(s);
+			return true;
+		});
+
+		return total;
+	}
 };
 } // namespace stacsos::kernel::fs
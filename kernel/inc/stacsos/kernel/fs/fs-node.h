@@ -19,12 +19,12 @@ class file;
 
 class fs_node {
 public:
-	fs_node(filesystem &parent_fs, fs_node *parent_node, fs_node_kind kind, const string &name)
+	fs_node(filesystem &parent_fs, fs_node *parent_node, fs_node_kind kind, string name)
 		: fs_(parent_fs)
 		, parent_node_(parent_node)
 		, kind_(kind)
 		, mounted_fs_(nullptr)
-		, name_(name)
+		, name_(move(name))
 	{
 	}
 
@@ -38,6 +38,20 @@ public:
 	filesystem &fs() const { return fs_; }
 
 	const string &name() const { return name_; }
+	fs_node *parent() const { return parent_node_; }
+
+	/**
+	 * @brief Returns the size of the node's data, in bytes.
+	 */
+	virtual u64 size() const { return 0; }
+
+	/**
+	 * @brief Enumerates the children of a directory.
+	 *
+	 * @param index The position of the child, counting from zero.
+	 * @return Returns the child at the given position, or nullptr if there are no more children.
+	 */
+	virtual fs_node *child_at(u64 index) { return nullptr; }
 
 	virtual shared_ptr<file> open() = 0;
 	virtual fs_node *mkdir(const char *name) = 0;
@@ -45,6 +59,12 @@ public:
 protected:
 	virtual fs_node *resolve_child(const string &name) { return nullptr; }
 
+	/**
+	 * @brief Returns true if a name that does not resolve may be cached as not existing.  Nodes
+	 * whose children can appear without the filesystem knowing (e.g. devices) return false.
+	 */
+	virtual bool cache_missing_children() const { return true; }
+
 private:
 	filesystem &fs_;
 	fs_node *parent_node_;
@@ -52,4 +72,19 @@ private:
 	filesystem *mounted_fs_;
 	string name_;
 };
+
+/**
+ * @brief Hashes a name (FNV-1a) together with the directory node that contains it, for indexing
+ * directory entries.
+ */
+static inline u64 hash_child_name(const fs_node *parent, const char *name)
+{
+	u64 hash = 0xcbf29ce484222325ull ^ ((u64)parent * 0x9e3779b97f4a7c15ull);
+
+	while (*name) {
+		hash = (hash ^ (u8)*name++) * 0x100000001b3ull;
+	}
+
+	return hash;
+}
 } // namespace stacsos::kernel::fs
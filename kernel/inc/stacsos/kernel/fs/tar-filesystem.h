@@ -44,55 +44,68 @@ public:
 	virtual size_t pwrite(const void *buffer, size_t offset, size_t length);
 
 private:
+	bool read_blocks(void *buffer, u64 start, u64 count);
+
 	tar_filesystem &fs_;
 	u64 data_start_;
-
-	void read_file_blocks(void *buffer, u64 offset, u64 count);
 };
 
 class tarfs_node : public fs_node {
 	friend class tar_filesystem;
 
 public:
-	tarfs_node(filesystem &fs, fs_node *parent, fs_node_kind kind, const string &name, u64 data_start, u64 data_size)
-		: fs_node(fs, parent, kind, name)
+	tarfs_node(filesystem &fs, fs_node *parent, fs_node_kind kind, string name, u64 data_start, u64 data_size)
+		: fs_node(fs, parent, kind, move(name))
 		, data_start_(data_start)
 		, data_size_(data_size)
+		, children_(nullptr)
+		, nr_children_(0)
+		, children_capacity_(0)
+		, index_hash_(0)
+		, index_next_(nullptr)
 	{
 	}
 
+	virtual ~tarfs_node() { delete[] children_; }
+
 	virtual shared_ptr<file> open() override { return shared_ptr<file>(new tarfs_file((tar_filesystem &)fs(), data_start_, data_size_)); }
 	virtual fs_node *mkdir(const char *name) override;
 
+	virtual u64 size() const override { return data_size_; }
+	virtual fs_node *child_at(u64 index) override { return index < nr_children_ ? children_[index] : nullptr; }
+
 protected:
 	virtual fs_node *resolve_child(const string &name) override;
 
 private:
-	tarfs_node *add_child(const string &name, fs_node_kind kind, u64 data_start, u64 data_size)
-	{
-		auto *node = new tarfs_node(fs(), this, kind, name, data_start, data_size);
-		children_.append(node);
-		return node;
-	}
+	tarfs_node *add_child(const char *name, fs_node_kind kind, u64 data_start, u64 data_size);
 
-	bool has_child(const string &name);
-
-	list<tarfs_node *> children_;
 	u64 data_start_, data_size_;
+
+	tarfs_node **children_;
+	u64 nr_children_, children_capacity_;
+
+	u64 index_hash_; // hash of this node's parent and name
+	tarfs_node *index_next_; // the next node in the same bucket of the filesystem's index
 };
 
 class tar_filesystem : public physical_filesystem {
 	friend class tarfs_file;
+	friend class tarfs_node;
 
 public:
 	tar_filesystem(dev::storage::block_device &bdev)
 		: physical_filesystem(bdev)
 		, root_(*this, nullptr, fs_node_kind::directory, "", 0, 0)
+		, image_((const u8 *)bdev.mapped_contents())
+		, index_(nullptr)
+		, index_size_(0)
+		, nr_indexed_(0)
 	{
 		load_tree();
 	}
 
-	virtual ~tar_filesystem() { }
+	virtual ~tar_filesystem() { delete[] index_; }
 
 	virtual fs_node &root() override { return root_; }
 
@@ -100,6 +113,18 @@ private:
 	void load_tree();
 	void register_file(const tar_file_header *header, u64 data_block_start, u64 data_size);
 
+	tarfs_node *find_node(const tarfs_node *parent, const char *name) const;
+	void index_node(tarfs_node *node);
+
 	tarfs_node root_;
+
+	// If the device's contents are in memory (e.g. an initrd), headers and file data are read
+	// straight from them, bypassing both the device and the cache.
+	const u8 *image_;
+
+	// Every node is indexed by a hash of its parent and name, so that neither lookups nor
+	// building the tree at mount need to search through directories.
+	tarfs_node **index_;
+	u64 index_size_, nr_indexed_;
 };
 } // namespace stacsos::kernel::fs
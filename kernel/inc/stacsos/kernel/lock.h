@@ -16,6 +16,39 @@ extern "C" void spinlock_irq_acquire(spinlock_var_t *lv, u64 *flags);
 extern "C" void spinlock_irq_release(spinlock_var_t *lv, u64 flags);
 
 namespace stacsos::kernel {
+/**
+ * @brief Disables interrupts on this core, and returns the previous state for irq_restore().
+ */
+static inline u64 irq_save()
+{
+	u64 flags;
+	asm volatile("pushf; pop %0; cli" : "=r"(flags)::"memory");
+
+	return flags;
+}
+
+/**
+ * @brief Re-enables interrupts on this core, if they were enabled when irq_save() was called.
+ */
+static inline void irq_restore(u64 flags)
+{
+	if (flags & 0x200) {
+		asm volatile("sti" ::: "memory");
+	}
+}
+
+/**
+ * @brief Returns true if interrupts are enabled on this core, i.e. if this is neither interrupt
+ * context nor code running under an irq lock.
+ */
+static inline bool irqs_enabled()
+{
+	u64 flags;
+	asm volatile("pushf; pop %0" : "=r"(flags)::"memory");
+
+	return flags & 0x200;
+}
+
 class spinlock {
 public:
 	spinlock()
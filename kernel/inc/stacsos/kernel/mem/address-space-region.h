@@ -19,5 +19,9 @@ public:
 	u64 base, size;
 	region_flags flags;
 	page *storage;
+	bool allocated; // created by alloc_region, so its owner may free it
+
+	u32 pin_count; // number of transfers the storage is pinned for
+	bool removed; // removed from its address space while pinned, so unmapped and freed on the last unpin
 };
 } // namespace stacsos::kernel::mem
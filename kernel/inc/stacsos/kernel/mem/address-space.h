@@ -7,14 +7,26 @@
  */
 #pragma once
 
+#include <stacsos/kernel/lock.h>
 #include <stacsos/kernel/mem/address-space-region.h>
 #include <stacsos/kernel/mem/page-table.h>
-#include <stacsos/list.h>
+#include <stacsos/map.h>
 
 namespace stacsos::kernel::mem {
 class page_table_allocator;
 class memory_manager;
 
+/**
+ * @brief Key for the size-ordered free range index.  Ranges are ordered by size, and then by
+ * base address, so that every key is unique and the smallest sufficient range is found first.
+ */
+struct free_range_key {
+	u64 size, base;
+
+	bool operator==(const free_range_key &other) const { return size == other.size && base == other.base; }
+	bool operator<(const free_range_key &other) const { return size < other.size || (size == other.size && base < other.base); }
+};
+
 class address_space {
 	friend class memory_manager;
 
@@ -22,6 +34,7 @@ public:
 	address_space(page_table_allocator &pta, u64 alloc_rgn_start)
 		: pta_(pta)
 		, pt_(page_table::create_empty(pta))
+		, alloc_rgn_start_(alloc_rgn_start)
 		, next_alloc_rgn_(alloc_rgn_start)
 	{
 	}
@@ -32,17 +45,54 @@ public:
 
 	address_space_region *alloc_region(u64 size, region_flags flags, bool allocate);
 	address_space_region *add_region(u64 base, u64 size, region_flags flags, bool allocate);
-	void remove_region(u64 base, u64 size, region_flags flags);
+
+	/**
+	 * @brief Removes the region that starts at the given base address, unmapping it and releasing
+	 * any backing storage.  If the region lies in the allocation area, its address range is made
+	 * available for reuse by alloc_region.
+	 *
+	 * @param base The base address of the region to remove.
+	 * @return true if a region was removed, false if no region starts at that address.
+	 */
+	bool remove_region(u64 base);
+
+	/**
+	 * @brief Removes a region that was created by alloc_region, as remove_region does.  This is
+	 * the only way for a process to remove its own regions, so that it cannot remove e.g. its
+	 * ELF segments or stack.
+	 *
+	 * @return true if a region was removed, false if no allocated region starts at that address.
+	 */
+	bool free_region(u64 base);
+
+	/**
+	 * @brief Pins the region that wholly contains the given range, so that its backing storage
+	 * stays allocated and mapped (e.g. while a device transfers data into it) even if the region
+	 * is removed.
+	 *
+	 * @return The pinned region, or nullptr if no single region with backing storage contains the
+	 * range, or if the region lacks the required access.
+	 */
+	address_space_region *pin_range(u64 base, u64 length, region_flags required_flags);
+
+	/**
+	 * @brief Releases a pin taken with pin_range.
+	 */
+	void unpin(address_space_region *rgn);
 
 	address_space_region *get_region_from_address(u64 address)
 	{
-		for (address_space_region *rgn : regions_) {
-			if (address >= rgn->base && address < (rgn->base + rgn->size)) {
-				return rgn;
-			}
+		unique_irq_lock l(lock_);
+
+		// Regions never overlap, so the only candidate is the region with the greatest base
+		// address that is not above the address being looked up.
+		u64 base;
+		address_space_region *rgn;
+		if (!regions_.try_get_floor(address, base, rgn)) {
+			return nullptr;
 		}
 
-		return nullptr;
+		return address < (rgn->base + rgn->size) ? rgn : nullptr;
 	}
 
 	address_space *create_linked(u64 alloc_rgn_start);
@@ -51,6 +101,7 @@ private:
 	address_space(page_table_allocator &pta, page_table *pt, u64 alloc_rgn_start)
 		: pta_(pta)
 		, pt_(pt)
+		, alloc_rgn_start_(alloc_rgn_start)
 		, next_alloc_rgn_(alloc_rgn_start)
 	{
 	}
@@ -58,7 +109,21 @@ private:
 	page_table_allocator &pta_;
 	page_table *pt_;
 
-	list<address_space_region *> regions_;
+	spinlock_irq lock_;
+
+	map<u64, address_space_region *> regions_;
+	map<u64, u64> free_ranges_;
+	map<free_range_key, u64> free_ranges_by_size_;
+
+	u64 alloc_rgn_start_;
 	u64 next_alloc_rgn_;
+
+	void remove_region_locked(address_space_region *rgn);
+	void release_region(address_space_region *rgn);
+
+	u64 take_free_range(u64 size);
+	void release_range(u64 base, u64 size);
+	void insert_free_range(u64 base, u64 size);
+	void remove_free_range(u64 base, u64 size);
 };
 } // namespace stacsos::kernel::mem
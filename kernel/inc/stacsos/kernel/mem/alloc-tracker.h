@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+#include <stacsos/kernel/lock.h>
+
+namespace stacsos::kernel::mem {
+/**
+ * @brief Tracks live kernel heap allocations, and which call sites they came from.  This is only
+ * hooked into operator new/delete when USE_ALLOC_TRACKER is defined (see stacsos-config.h).
+ *
+ * All storage is statically allocated, so that the tracker never allocates from the heap that
+ * it is tracking.
+ */
+class alloc_tracker {
+	DEFINE_SINGLETON(alloc_tracker)
+
+private:
+	alloc_tracker()
+		: nr_live_(0)
+		, nr_sites_(0)
+		, dropped_(0)
+	{
+	}
+
+public:
+	static const int max_live_objects = 8192;
+	static const int max_sites = 512;
+
+	void track_alloc(void *ptr, size_t size, void *site);
+	void track_free(void *ptr);
+
+	/**
+	 * @brief Writes a report of the call sites with the most outstanding bytes into the given
+	 * buffer.
+	 *
+	 * @return Returns the length of the report.
+	 */
+	size_t report(char *buffer, size_t size);
+
+private:
+	// A live allocation, keyed on its address.
+	struct live_object {
+		void *ptr;
+		u32 size;
+		u16 site;
+		u64 timestamp;
+	};
+
+	// A call site, keyed on its return address.
+	struct alloc_site {
+		void *site;
+		u64 nr_allocs, nr_frees;
+		u64 live_bytes, total_bytes;
+		u64 last_timestamp;
+	};
+
+	spinlock_irq lock_;
+
+	live_object live_[max_live_objects];
+	alloc_site sites_[max_sites];
+	int nr_live_, nr_sites_;
+	u64 dropped_;
+
+	int find_or_add_site(void *site);
+};
+} // namespace stacsos::kernel::mem
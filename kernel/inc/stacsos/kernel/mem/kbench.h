@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+namespace stacsos::kernel::mem {
+/**
+ * @brief In-kernel memory allocator microbenchmarks, selected with the kbench= command-line option.
+ */
+class kbench {
+public:
+	/**
+	 * @brief Runs the requested benchmarks, prints the results to the debug console, and then
+	 * powers off the machine.
+	 *
+	 * @param mode Which benchmarks to run: one of "all", "pgalloc", "objalloc", "loa" or "map".
+	 */
+	static __noreturn void run(const char *mode);
+};
+} // namespace stacsos::kernel::mem
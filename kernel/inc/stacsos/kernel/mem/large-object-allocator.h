@@ -22,17 +22,26 @@ public:
 		: region_base_(region_base)
 		, base_(region_base)
 		, size_(region_size)
+		, live_objects_(0)
 	{
 	}
 
 	void *allocate(size_t size);
 	bool free(void *ptr);
 
+	void collect_stats(meminfo &info) const
+	{
+		info.loa_region_size = size_;
+		info.loa_mapped = (uintptr_t)base_ - (uintptr_t)region_base_;
+		info.loa_live_objects = live_objects_;
+	}
+
 	bool ptr_in_region(void *ptr) const { return ((uintptr_t)ptr >= (uintptr_t)region_base_) && ((uintptr_t)ptr < ((uintptr_t)region_base_ + size_)); }
 
 private:
 	void *region_base_;
 	void *base_;
 	size_t size_;
+	u64 live_objects_;
 };
 } // namespace stacsos::kernel::mem
@@ -7,6 +7,7 @@
  */
 #pragma once
 
+#include <stacsos/kernel/lock.h>
 #include <stacsos/kernel/mem/address-space.h>
 #include <stacsos/kernel/mem/object-allocator.h>
 #include <stacsos/kernel/mem/page-allocator.h>
@@ -20,14 +21,54 @@ private:
 	memory_manager()
 		: pgalloc_(nullptr)
 		, root_address_space_(nullptr)
+		, managed_pages_(0)
+		, nr_page_descriptors_(0)
+		, deferred_init_pfn_(0)
 	{
 	}
 
 public:
+	// All physical memory is mapped 1-1 from this address, and everything from here up belongs to
+	// the kernel.
+	static const u64 direct_map_base = 0xffff'8000'0000'0000;
+
+	/**
+	 * @brief Returns true if the address lies in the kernel's half of the address space.
+	 */
+	static bool is_kernel_address(u64 address) { return address >= direct_map_base; }
+
+	/**
+	 * @brief Sizes the memory block table, before any blocks are added.
+	 *
+	 * @param count The number of memory blocks that will be added.
+	 * @param end_address The end (exclusive) of the highest memory block that will be added.
+	 * @return Returns the physical address of the (page-aligned) end of the dynamic data area,
+	 * which is overwritten when memory is initialised.
+	 */
+	static u64 reserve_memory_blocks(int count, u64 end_address);
 	static void add_memory_block(u64 start, u64 length, bool avail);
 
+	/**
+	 * @brief Keeps a range of physical memory that holds boot data (e.g. a boot module) out of
+	 * the page allocator.
+	 */
+	static void reserve_boot_memory(u64 start, u64 length);
+
 	void init();
 
+	/**
+	 * @brief Splits physical memory into per-node zones, if the platform reported a NUMA
+	 * topology.  Must be called once the platform has been probed.
+	 */
+	void init_numa();
+
+	/**
+	 * @brief Initialises the page descriptors for, and frees, any memory that was not needed
+	 * during early boot.  This is done a chunk at a time, so may be called while the system is
+	 * running.
+	 */
+	void complete_deferred_init();
+
 	page_allocator &pgalloc() const { return *pgalloc_; }
 
 	page_table_allocator &ptalloc() { return ptalloc_; }
@@ -40,16 +81,28 @@ public:
 
 	bool try_handle_page_fault(u64 faulting_address);
 
+	/**
+	 * @brief Takes a snapshot of the current memory statistics.
+	 */
+	void collect_stats(meminfo &info);
+
 private:
-	void initialise_page_descriptors(u64 nr_page_descriptors);
-	void initialise_page_allocator(u64 nr_page_descriptors);
+	page_allocator *create_page_allocator(void *storage);
+	void initialise_page_descriptors(u64 first_pfn, u64 last_pfn);
+	void initialise_page_allocator(u64 low, u64 high, bool verbose = true);
+	bool initialise_deferred_chunk();
 	void initialise_object_allocator();
-	void activate_primary_mapping();
+	void activate_primary_mapping(u64 end_address);
 
 	page_allocator *pgalloc_;
 	page_table_allocator ptalloc_;
 	object_allocator objalloc_;
 
 	address_space *root_address_space_;
+	u64 managed_pages_;
+
+	u64 nr_page_descriptors_;
+	u64 deferred_init_pfn_;
+	spinlock_irq deferred_init_lock_;
 };
 } // namespace stacsos::kernel::mem
@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+#include <stacsos/kernel/arch/core-manager.h>
+
+namespace stacsos::kernel::mem {
+struct numa_memory_range {
+	u64 base, length;
+	int node;
+};
+
+/**
+ * @brief Describes the NUMA topology of the machine, as reported by the ACPI SRAT and SLIT.
+ * ACPI proximity domains are mapped onto dense node numbers, in the order they are discovered.
+ * If no topology is reported, everything is considered to be on node zero.
+ */
+class numa_topology {
+	DEFINE_SINGLETON(numa_topology)
+
+public:
+	static const int max_nodes = 8;
+	static const int max_memory_ranges = 32;
+	static const int max_apic_ids = 256;
+
+	static const u8 local_distance = 10;
+	static const u8 remote_distance = 20;
+
+	numa_topology();
+
+	void add_memory_range(u32 domain, u64 base, u64 length);
+	void add_processor(u32 domain, u32 apic_id);
+	void set_distance(u32 from_domain, u32 to_domain, u8 distance);
+	void register_core(int core_id, u32 apic_id);
+
+	/**
+	 * @brief Computes the allocation fallback order for each node, and prints out the topology.
+	 * Must be called once all ACPI tables have been parsed.
+	 */
+	void finalise();
+
+	int nr_nodes() const { return nr_nodes_ == 0 ? 1 : nr_nodes_; }
+	bool is_numa() const { return nr_nodes_ > 1; }
+
+	int node_of_core(int core_id) const;
+	int node_of_address(u64 address) const;
+
+	/**
+	 * @brief Determines the node that an address belongs to, and the end of the contiguous run of
+	 * addresses from that address that belong to the same node.
+	 */
+	int node_extent_of_address(u64 address, u64 &extent_end) const;
+
+	u8 distance(int from, int to) const { return distances_[from][to]; }
+	u64 node_size(int node) const;
+
+	/**
+	 * @brief Returns the nodes in the order they should be tried for an allocation requested on
+	 * the given node, i.e. the node itself first, followed by the others in order of distance.
+	 */
+	const int *fallback_order(int node) const { return fallback_[node]; }
+
+private:
+	int node_for_domain(u32 domain);
+
+	int nr_nodes_;
+	u32 node_domains_[max_nodes];
+
+	int nr_memory_ranges_;
+	numa_memory_range memory_ranges_[max_memory_ranges];
+
+	s8 apic_nodes_[max_apic_ids];
+	s16 core_apics_[arch::core_manager::max_cores];
+
+	u8 distances_[max_nodes][max_nodes];
+	int fallback_[max_nodes][max_nodes];
+};
+} // namespace stacsos::kernel::mem
@@ -22,6 +22,8 @@ public:
 	void *realloc(void *obj, size_t size);
 	void free(void *obj);
 
+	void collect_stats(meminfo &info);
+
 private:
 	spinlock_irq object_allocator_lock_;
 
@@ -17,6 +17,7 @@ public:
 	{
 		for (int i = 0; i <= LastOrder; i++) {
 			free_list_[i] = nullptr;
+			free_blocks_[i] = 0;
 		}
 	}
 
@@ -26,11 +27,13 @@ public:
 	virtual void free_pages(page &base, int order) override;
 
 	virtual void dump() const override;
+	virtual void collect_stats(meminfo &info) const override;
 
 private:
 	static const int LastOrder = 16;
 
 	page *free_list_[LastOrder + 1];
+	u64 free_blocks_[LastOrder + 1];
 	u64 total_free_ = 0; // set to 0 to initialise process correctly
 
 	constexpr u64 pages_per_block(int order) const { return 1ULL << order; }
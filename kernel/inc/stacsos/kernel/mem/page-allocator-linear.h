@@ -16,7 +16,11 @@ public:
 	page_allocator_linear(memory_manager &mm)
 		: page_allocator(mm)
 		, free_list_(nullptr)
+		, total_free_(0)
 	{
+		for (int i = 0; i < meminfo::max_orders; i++) {
+			free_blocks_[i] = 0;
+		}
 	}
 
 	virtual void insert_free_pages(page &range_start, u64 page_count) override;
@@ -25,8 +29,15 @@ public:
 	virtual void free_pages(page &base, int order) override;
 
 	virtual void dump() const override;
+	virtual void collect_stats(meminfo &info) const override;
 
 private:
 	page *free_list_;
+
+	// Statistics, maintained as free blocks change size, so that collecting them is O(orders).
+	u64 total_free_;
+	u64 free_blocks_[meminfo::max_orders];
+
+	void account_block(page *free_block, bool add);
 };
 } // namespace stacsos::kernel::mem
@@ -0,0 +1,45 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+#include <stacsos/kernel/mem/numa.h>
+#include <stacsos/kernel/mem/page-allocator.h>
+
+namespace stacsos::kernel::mem {
+/**
+ * @brief A page allocator that splits physical memory into per-node zones, each managed by its
+ * own underlying page allocator.  Allocations are satisfied from the requesting core's node
+ * first, and then from the other nodes in order of distance.
+ */
+class page_allocator_numa : public page_allocator {
+public:
+	page_allocator_numa(memory_manager &mm, numa_topology &topology, page_allocator **zones, int nr_zones);
+
+	virtual void insert_free_pages(page &range_start, u64 page_count) override;
+
+	virtual page *allocate_pages(int order, page_allocation_flags flags = page_allocation_flags::none) override;
+	virtual void free_pages(page &base, int order) override;
+
+	/**
+	 * @brief Allocates pages, preferring the given node.
+	 */
+	page *allocate_pages_on_node(int node, int order, page_allocation_flags flags = page_allocation_flags::none);
+
+	virtual void dump() const override;
+	virtual void collect_stats(meminfo &info) const override;
+
+private:
+	numa_topology &topology_;
+
+	page_allocator *zones_[numa_topology::max_nodes];
+	int nr_zones_;
+
+	u64 allocations_[numa_topology::max_nodes];
+	u64 remote_allocations_[numa_topology::max_nodes];
+};
+} // namespace stacsos::kernel::mem
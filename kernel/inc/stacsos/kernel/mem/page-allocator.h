@@ -8,6 +8,7 @@
 #pragma once
 
 #include <stacsos/kernel/mem/page-alloc-ref.h>
+#include <stacsos/meminfo.h>
 
 namespace stacsos::kernel::mem {
 
@@ -37,6 +38,12 @@ public:
 
 	virtual void dump() const = 0;
 
+	/**
+	 * @brief Fills in the free memory statistics (free memory, and free blocks per order) of a
+	 * memory information snapshot.  This must be cheap, as it can be called frequently.
+	 */
+	virtual void collect_stats(meminfo &info) const = 0;
+
 	void perform_selftest();
 
 private:
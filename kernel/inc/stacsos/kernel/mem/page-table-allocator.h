@@ -14,7 +14,17 @@ namespace stacsos::kernel::mem {
 
 class page_table_allocator {
 public:
+	page_table_allocator()
+		: allocated_pages_(0)
+	{
+	}
+
 	page *allocate();
 	void free(page *pg);
+
+	u64 allocated_pages() const { return allocated_pages_; }
+
+private:
+	u64 allocated_pages_;
 };
 } // namespace stacsos::kernel::mem
@@ -8,6 +8,7 @@
 #pragma once
 
 #include <stacsos/bitset.h>
+#include <stacsos/meminfo.h>
 
 namespace stacsos::kernel::mem {
 enum class slab_state { empty, partial, full };
@@ -86,6 +87,8 @@ private:
 public:
 	slab_cache()
 		: slabs_(nullptr)
+		, nr_slabs_(0)
+		, objects_in_use_(0)
 	{
 	}
 
@@ -107,9 +110,11 @@ public:
 			s = new (slab_base) slab();
 			s->next_ = slabs_;
 			slabs_ = s;
+			nr_slabs_++;
 		}
 
 		void *ptr = s->allocate();
+		objects_in_use_++;
 		// dprintf("malloc: cache-size=%u, slab=%p, ptr=%p\n", object_size, s, ptr);
 		return ptr;
 	}
@@ -131,6 +136,7 @@ public:
 		}
 
 		s->free(ptr);
+		objects_in_use_--;
 		// dprintf("free: ptr=%p\n", ptr);
 
 		// TODO: Free slabs?
@@ -145,8 +151,18 @@ public:
 		}
 	}
 
+	void collect_stats(meminfo_slab_cache &stats) const
+	{
+		stats.object_size = object_size;
+		stats.nr_slabs = nr_slabs_;
+		stats.objects_in_use = objects_in_use_;
+		stats.objects_capacity = nr_slabs_ * (slab_object_capacity - slab::reserved_objects);
+	}
+
 private:
 	slab *slabs_;
+	u64 nr_slabs_;
+	u64 objects_in_use_;
 
 	void *allocate_slab();
 };
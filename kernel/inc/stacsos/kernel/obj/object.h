@@ -34,6 +34,15 @@ public:
 	virtual operation_result write(const void *buffer, size_t length) { return operation_result::not_supported(); }
 	virtual operation_result pwrite(const void *buffer, size_t length, size_t offset) { return operation_result::not_supported(); }
 	virtual operation_result ioctl(u64 cmd, void *buffer, size_t length) { return operation_result::not_supported(); }
+
+	// Vectored variants of the above.  By default, these issue one operation per segment, stopping
+	// at the first segment that is not transferred completely.
+	virtual operation_result readv(const io_segment *segments, size_t count);
+	virtual operation_result preadv(const io_segment *segments, size_t count);
+	virtual operation_result writev(const io_segment *segments, size_t count);
+	virtual operation_result pwritev(const io_segment *segments, size_t count);
+
+	virtual operation_result fsync() { return operation_result::not_supported(); }
 	virtual operation_result wait_for_status_change() { return operation_result::not_supported(); }
 	virtual operation_result join() { return operation_result::not_supported(); }
 
@@ -61,6 +70,17 @@ public:
 	virtual operation_result pwrite(const void *buffer, size_t length, size_t offset) { return operation_result::ok(file_->pwrite(buffer, offset, length)); }
 	virtual operation_result ioctl(u64 cmd, void *buffer, size_t length) { return operation_result::ok(file_->ioctl(cmd, buffer, length)); }
 
+	virtual operation_result readv(const io_segment *segments, size_t count) override { return operation_result::ok(file_->readv(segments, count)); }
+	virtual operation_result preadv(const io_segment *segments, size_t count) override { return operation_result::ok(file_->preadv(segments, count)); }
+	virtual operation_result writev(const io_segment *segments, size_t count) override { return operation_result::ok(file_->writev(segments, count)); }
+	virtual operation_result pwritev(const io_segment *segments, size_t count) override { return operation_result::ok(file_->pwritev(segments, count)); }
+
+	virtual operation_result fsync()
+	{
+		file_->fsync();
+		return operation_result::ok(0);
+	}
+
 private:
 	shared_ptr<fs::file> file_;
 };
@@ -22,6 +22,11 @@ public:
 	void trigger();
 	void wait();
 
+	/**
+	 * @brief Returns a manual reset event to the untriggered state.
+	 */
+	void reset() { triggered_ = false; }
+
 private:
 	bool triggered_;
 	list<thread *> wait_list_;
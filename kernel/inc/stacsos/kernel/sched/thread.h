@@ -19,6 +19,10 @@ namespace stacsos::kernel::arch {
 class core;
 }
 
+namespace stacsos::kernel::dev::storage {
+class block_plug;
+}
+
 namespace stacsos::kernel::sched {
 using namespace stacsos::kernel::arch;
 
@@ -43,6 +47,12 @@ public:
 
 	process &owner() const { return owner_; }
 
+	/**
+	 * @brief The innermost block device plug held by this thread, if any.
+	 */
+	dev::storage::block_plug *current_plug() const { return current_plug_; }
+	void set_current_plug(dev::storage::block_plug *plug) { current_plug_ = plug; }
+
 	static thread &current();
 
 private:
@@ -58,5 +68,6 @@ private:
 	mem::page *kernel_stack_;
 	u64 user_stack_;
 	auto_reset_event state_changed_event_;
+	dev::storage::block_plug *current_plug_;
 };
 } // namespace stacsos::kernel::sched
@@ -7,6 +7,7 @@
  */
 #include <stacsos/kernel/arch/x86/boot/multiboot.h>
 #include <stacsos/kernel/arch/x86/cpuid.h>
+#include <stacsos/kernel/boot-modules.h>
 #include <stacsos/kernel/debug.h>
 #include <stacsos/kernel/mem/memory-manager.h>
 #include <stacsos/kernel/mem/page-table.h>
@@ -48,6 +49,74 @@ static void run_static_constructors()
 	}
 }
 
+/**
+ * Records the modules provided by the multiboot loader.  The module list (and the module command
+ * lines) may be overwritten when memory is initialised, so this must happen first.
+ */
+static void process_modules(const multiboot_info *mbi)
+{
+	if (!(mbi->flags & (1 << 3))) {
+		return;
+	}
+
+	const multiboot_module_entry *modules = (const multiboot_module_entry *)phys_to_virt(mbi->mods_addr);
+	for (u32 i = 0; i < mbi->mods_count; i++) {
+		boot_modules::get().add(modules[i].mod_start, modules[i].mod_end - modules[i].mod_start, modules[i].cmdline ? (const char *)phys_to_virt(modules[i].cmdline) : nullptr);
+	}
+}
+
+/**
+ * Moves any boot module that lies in the dynamic data area (which the loader is free to place
+ * modules in, as it follows the kernel image) to the memory just after it.
+ */
+static void relocate_modules(const multiboot_info *mbi, u64 dynamic_data_start, u64 dynamic_data_end)
+{
+	// Modules are moved to beyond the end of every module, so that moving one can never overwrite
+	// another that has yet to be moved.
+	u64 next_free = dynamic_data_end;
+	for (int i = 0; i < boot_modules::get().count(); i++) {
+		auto &mod = boot_modules::get().get(i);
+		next_free = max(next_free, mod.start + mod.length);
+	}
+
+	for (int i = 0; i < boot_modules::get().count(); i++) {
+		auto &mod = boot_modules::get().get(i);
+
+		if (mod.start + mod.length > dynamic_data_start && mod.start < dynamic_data_end) {
+			u64 target = PAGE_ALIGN_UP(next_free);
+
+			// The target must be in available memory that is reachable through the boot direct map.
+			bool target_available = false;
+			multiboot_mmap_entry *mmap = (multiboot_mmap_entry *)phys_to_virt(mbi->mmap_addr);
+			while ((uintptr_t)mmap < (uintptr_t)phys_to_virt(mbi->mmap_addr) + mbi->mmap_length) {
+				if (mmap->type == multiboot_mmap_entry_type::MMAP_ENTRY_TYPE_AVAILABLE && target >= mmap->addr
+					&& target + mod.length <= mmap->addr + mmap->len && target + mod.length <= GB(4)) {
+					target_available = true;
+					break;
+				}
+
+				mmap = (multiboot_mmap_entry *)((uintptr_t)mmap + mmap->size + sizeof(mmap->size));
+			}
+
+			if (!target_available) {
+				panic("unable to relocate boot module");
+			}
+
+			// The module only ever moves upwards, so copy backwards in case the ranges overlap.
+			const u8 *src = (const u8 *)phys_to_virt(mod.start);
+			u8 *dst = (u8 *)phys_to_virt(target);
+			for (u64 offset = mod.length; offset > 0; offset--) {
+				dst[offset - 1] = src[offset - 1];
+			}
+
+			mod.start = target;
+			next_free = target + mod.length;
+		}
+
+		memory_manager::reserve_boot_memory(mod.start, mod.length);
+	}
+}
+
 /**
  * Initialises memory, by scanning the memory blocks that were provided to us by the multiboot loader.
  */
@@ -56,8 +125,28 @@ static void initialise_memory(const multiboot_info *mbi)
 	void *mmap_start = phys_to_virt(mbi->mmap_addr);
 	void *mmap_end = (void *)((uintptr_t)mmap_start + mbi->mmap_length);
 
-	// Loop over each MMAP entry, and tell the memory manager of its existence.
+	// First, count the MMAP entries and find the end of physical memory, so that the memory
+	// manager can size its memory block table.
+	int nr_blocks = 0;
+	u64 end_address = 0;
+
 	multiboot_mmap_entry *mmap = (multiboot_mmap_entry *)mmap_start;
+	while ((uintptr_t)mmap < (uintptr_t)mmap_end) {
+		if (mmap->addr < 0xfd00000000) {
+			nr_blocks++;
+			end_address = max(end_address, mmap->addr + mmap->len);
+		}
+
+		mmap = (multiboot_mmap_entry *)((uintptr_t)mmap + mmap->size + sizeof(mmap->size));
+	}
+
+	u64 dynamic_data_end = memory_manager::reserve_memory_blocks(nr_blocks, end_address);
+
+	// Move boot modules out of the way, before the memory block table is written.
+	relocate_modules(mbi, (u64)&_DYNAMIC_DATA_START - 0xffff'ffff'8000'0000, dynamic_data_end);
+
+	// Loop over each MMAP entry, and tell the memory manager of its existence.
+	mmap = (multiboot_mmap_entry *)mmap_start;
 	while ((uintptr_t)mmap < (uintptr_t)mmap_end) {
 		if (mmap->addr < 0xfd00000000) {
 			memory_manager::add_memory_block(mmap->addr, mmap->len, mmap->type == multiboot_mmap_entry_type::MMAP_ENTRY_TYPE_AVAILABLE);
@@ -140,7 +229,8 @@ extern "C" __noreturn void x86_start(const multiboot_info *multiboot_info)
 	process_command_line(multiboot_info);
 	dprintf("command-line: %s\n", __boot_command_line);
 
-	// Initialise memory.
+	// Record any boot modules, and initialise memory.
+	process_modules(multiboot_info);
 	initialise_memory(multiboot_info);
 
 	// Call the main kernel.
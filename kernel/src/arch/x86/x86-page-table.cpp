@@ -123,6 +123,43 @@ void x86_page_table::map(page_table_allocator &pta, u64 virtual_address, u64 phy
 	l1.us(user);
 }
 
+void x86_page_table::unmap(page_table_allocator &pta, u64 virtual_address)
+{
+	pml4e &l4 = pml4_[pml4_index(virtual_address)];
+	if (!l4.present()) {
+		return;
+	}
+
+	pdpe &l3 = (*(pdp *)page::get_from_base_address(l4.base_address()).base_address_ptr())[pdp_index(virtual_address)];
+	if (!l3.present()) {
+		return;
+	}
+
+	if (l3.size()) {
+		l3.reset();
+	} else {
+		pde &l2 = (*(pd *)page::get_from_base_address(l3.base_address()).base_address_ptr())[pd_index(virtual_address)];
+		if (!l2.present()) {
+			return;
+		}
+
+		if (l2.size()) {
+			l2.reset();
+		} else {
+			pte &l1 = (*(pt *)page::get_from_base_address(l2.base_address()).base_address_ptr())[pt_index(virtual_address)];
+			if (!l1.present()) {
+				return;
+			}
+
+			l1.reset();
+		}
+	}
+
+	// Intermediate tables are left in place, as they are likely to be reused by the next mapping
+	// in the same area.
+	asm volatile("invlpg (%0)" ::"r"(virtual_address) : "memory");
+}
+
 mapping x86_page_table::get_mapping(u64 virtual_address)
 {
 	pml4e &l4 = pml4_[pml4_index(virtual_address)];
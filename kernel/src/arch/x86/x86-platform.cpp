@@ -10,6 +10,7 @@
 #include <stacsos/kernel/dev/acpi/acpi.h>
 #include <stacsos/kernel/dev/device-manager.h>
 #include <stacsos/kernel/dev/input/keyboard.h>
+#include <stacsos/kernel/mem/memory-manager.h>
 
 using namespace stacsos::kernel::arch::x86;
 using namespace stacsos::kernel::dev::acpi;
@@ -23,4 +24,7 @@ void x86_platform::probe()
 	acpi->probe();
 
 	delete acpi;
+
+	// Now that the SRAT (if any) has been parsed, split physical memory into per-node zones.
+	mem::memory_manager::get().init_numa();
 }
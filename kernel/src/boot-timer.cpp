@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/arch/x86/tsc.h>
+#include <stacsos/kernel/arch/x86/x86-core.h>
+#include <stacsos/kernel/boot-timer.h>
+#include <stacsos/kernel/debug.h>
+
+using namespace stacsos::kernel;
+using namespace stacsos::kernel::arch::x86;
+
+void boot_timer::begin(const char *name)
+{
+	end();
+
+	if (nr_phases_ == max_phases) {
+		return;
+	}
+
+	current_phase_ = nr_phases_++;
+	phases_[current_phase_].name = name;
+	phases_[current_phase_].start = __builtin_ia32_rdtsc();
+	phases_[current_phase_].end = 0;
+}
+
+void boot_timer::end()
+{
+	if (current_phase_ < 0) {
+		return;
+	}
+
+	phases_[current_phase_].end = __builtin_ia32_rdtsc();
+	current_phase_ = -1;
+}
+
+void boot_timer::report() const
+{
+	// The TSC frequency is in Hz, so scale it to get the number of ticks per microsecond.
+	u64 ticks_per_us = x86_core::this_core().local_tsc().frequency() / 1000000;
+	if (ticks_per_us == 0) {
+		ticks_per_us = 1;
+	}
+
+	u64 total = 0;
+
+	dprintf("boot: phase timings:\n");
+	for (int i = 0; i < nr_phases_; i++) {
+		const boot_phase &phase = phases_[i];
+		if (phase.end == 0) {
+			continue;
+		}
+
+		u64 us = (phase.end - phase.start) / ticks_per_us;
+		total += us;
+
+		dprintf("  %24s %8lu.%03lu ms\n", phase.name, us / 1000, us % 1000);
+	}
+
+	dprintf("  %24s %8lu.%03lu ms\n", "total", total / 1000, total % 1000);
+}
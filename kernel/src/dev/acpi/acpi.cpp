@@ -14,6 +14,7 @@
 #include <stacsos/kernel/dev/acpi/descriptors.h>
 #include <stacsos/kernel/dev/device-manager.h>
 #include <stacsos/kernel/dev/pci/pci-express-bus.h>
+#include <stacsos/kernel/mem/numa.h>
 
 #define SIG32(__d, __c, __b, __a) ((u32)(__d) | ((u32)__c << 8) | ((u32)__b << 16) | ((u32)__a << 24))
 #define RSDP_SIGNATURE 0x2052545020445352
@@ -23,6 +24,8 @@
 #define DSDT_SIGNATURE SIG32('D', 'S', 'D', 'T')
 #define HPET_SIGNATURE SIG32('H', 'P', 'E', 'T')
 #define MCFG_SIGNATURE SIG32('M', 'C', 'F', 'G')
+#define SRAT_SIGNATURE SIG32('S', 'R', 'A', 'T')
+#define SLIT_SIGNATURE SIG32('S', 'L', 'I', 'T')
 
 using namespace stacsos;
 using namespace stacsos::kernel;
@@ -31,6 +34,7 @@ using namespace stacsos::kernel::dev::acpi;
 using namespace stacsos::kernel::dev::pci;
 using namespace stacsos::kernel::arch;
 using namespace stacsos::kernel::arch::x86;
+using namespace stacsos::kernel::mem;
 
 /**
  * Scans memory for the RSDP by looking for the RSDP signature.  Returns a
@@ -94,6 +98,7 @@ bool ACPI::parse_madt_lapic(const madt_record_lapic *lapic_record)
 
 	// bool bootstrap = lapic_record->apic_id == 0;
 	core_manager::get().register_core(*new x86_core(lapic_record->acpi_processor_id));
+	numa_topology::get().register_core(lapic_record->acpi_processor_id, lapic_record->apic_id);
 
 	return true;
 }
@@ -150,6 +155,80 @@ bool ACPI::parse_mcfg(const mcfg *mcfg)
 	return true;
 }
 
+/**
+ * Parses the SRAT, which describes which proximity domain (NUMA node) each processor and
+ * memory range belongs to.
+ */
+bool ACPI::parse_srat(const srat *srat)
+{
+	dprintf("acpi: found srat\n");
+
+	const srat_record_header *rhs = &srat->records;
+	const srat_record_header *rhe = (const srat_record_header *)((uintptr_t)srat + srat->header.length);
+
+	while (rhs < rhe) {
+		if (rhs->length == 0) {
+			return false;
+		}
+
+		switch (rhs->type) {
+		case 0: {
+			auto lapic = (const srat_record_lapic_affinity *)rhs;
+			if (lapic->flags & 1) {
+				u32 domain = lapic->proximity_domain_low | ((u32)lapic->proximity_domain_high[0] << 8) | ((u32)lapic->proximity_domain_high[1] << 16)
+					| ((u32)lapic->proximity_domain_high[2] << 24);
+
+				dprintf("srat: lapic: apic-id=%u, domain=%u\n", lapic->apic_id, domain);
+				numa_topology::get().add_processor(domain, lapic->apic_id);
+			}
+			break;
+		}
+
+		case 1: {
+			auto mem = (const srat_record_memory_affinity *)rhs;
+			if (mem->flags & 1) {
+				dprintf("srat: memory: base=%p, length=%lx, domain=%u\n", mem->base_address, mem->length, mem->proximity_domain);
+				numa_topology::get().add_memory_range(mem->proximity_domain, mem->base_address, mem->length);
+			}
+			break;
+		}
+
+		case 2: {
+			auto x2apic = (const srat_record_x2apic_affinity *)rhs;
+			if (x2apic->flags & 1) {
+				dprintf("srat: x2apic: apic-id=%u, domain=%u\n", x2apic->x2apic_id, x2apic->proximity_domain);
+				numa_topology::get().add_processor(x2apic->proximity_domain, x2apic->x2apic_id);
+			}
+			break;
+		}
+
+		default:
+			dprintf("acpi: srat: unsupported record type=%u, length=%u\n", rhs->type, rhs->length);
+			break;
+		}
+
+		rhs = (const srat_record_header *)((uintptr_t)rhs + rhs->length);
+	}
+
+	return true;
+}
+
+/**
+ * Parses the SLIT, which gives the relative distance between each pair of proximity domains.
+ */
+bool ACPI::parse_slit(const slit *slit)
+{
+	dprintf("acpi: found slit: localities=%lu\n", slit->nr_localities);
+
+	for (u64 from = 0; from < slit->nr_localities; from++) {
+		for (u64 to = 0; to < slit->nr_localities; to++) {
+			numa_topology::get().set_distance(from, to, slit->entries[(from * slit->nr_localities) + to]);
+		}
+	}
+
+	return true;
+}
+
 /**
  * Parses the DSDT
  */
@@ -298,6 +377,20 @@ bool ACPI::probe()
 
 			break;
 
+		case SRAT_SIGNATURE:
+			if (!parse_srat((const srat *)hdr)) {
+				return false;
+			}
+
+			break;
+
+		case SLIT_SIGNATURE:
+			if (!parse_slit((const slit *)hdr)) {
+				return false;
+			}
+
+			break;
+
 		default:
 			dprintf("acpi: unsupported table: %08x\n", hdr->signature);
 			break;
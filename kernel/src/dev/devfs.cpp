@@ -24,12 +24,20 @@ fs_node *devfs_node::resolve_child(const string &name)
 		return nullptr;
 	}
 
-	dprintf("devfs: resolve %s\n", name.c_str());
+	// Nodes are created on first lookup, and then reused.
+	for (auto *child : children_) {
+		if (child->name() == name) {
+			return child;
+		}
+	}
 
 	device *dp;
 	if (!device_manager::get().try_get_device_by_name(name, dp)) {
 		return nullptr;
 	}
 
-	return new devfs_node(fs(), this, fs_node_kind::file, name, dp);
+	auto *node = new devfs_node(fs(), this, fs_node_kind::file, name, dp);
+	children_.append(node);
+
+	return node;
 }
@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/dev/misc/allocinfo-device.h>
+#include <stacsos/kernel/fs/file.h>
+#include <stacsos/kernel/mem/alloc-tracker.h>
+#include <stacsos/memops.h>
+
+using namespace stacsos;
+using namespace stacsos::kernel::fs;
+using namespace stacsos::kernel::mem;
+using namespace stacsos::kernel::dev;
+using namespace stacsos::kernel::dev::misc;
+
+device_class allocinfo_device::allocinfo_device_class(device_class::root, "allocinfo");
+
+static const size_t max_report_size = 4096;
+
+/**
+ * A snapshot of the allocation tracker report, taken when the file is opened.
+ */
+class allocinfo_file : public file {
+public:
+	allocinfo_file(char *report, size_t length)
+		: file(length)
+		, report_(report)
+		, length_(length)
+	{
+	}
+
+	virtual ~allocinfo_file() { delete[] report_; }
+
+	virtual size_t pread(void *buffer, size_t offset, size_t length) override
+	{
+		if (offset >= length_) {
+			return 0;
+		}
+
+		length = min(length, length_ - offset);
+		memops::memcpy(buffer, report_ + offset, length);
+
+		return length;
+	}
+
+	// No writing allowed!
+	virtual size_t pwrite(const void *buffer, size_t offset, size_t length) override { return 0; }
+
+private:
+	char *report_;
+	size_t length_;
+};
+
+shared_ptr<file> allocinfo_device::open_as_file()
+{
+	char *report = new char[max_report_size];
+	size_t length = alloc_tracker::get().report(report, max_report_size);
+
+	return shared_ptr<file>(new allocinfo_file(report, length));
+}
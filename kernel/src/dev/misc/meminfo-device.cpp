@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/dev/misc/meminfo-device.h>
+#include <stacsos/kernel/fs/file.h>
+#include <stacsos/kernel/mem/memory-manager.h>
+#include <stacsos/meminfo.h>
+
+using namespace stacsos;
+using namespace stacsos::kernel::fs;
+using namespace stacsos::kernel::mem;
+using namespace stacsos::kernel::dev;
+using namespace stacsos::kernel::dev::misc;
+
+device_class meminfo_device::meminfo_device_class(device_class::root, "meminfo");
+
+/*
+ * Implements file operations for the memory statistics device.  Each read takes a fresh
+ * snapshot, so a monitoring process can simply re-read the device to poll it.
+ */
+class meminfo_file : public file {
+public:
+	meminfo_file()
+		: file(sizeof(meminfo))
+	{
+	}
+
+	virtual size_t pread(void *buffer, size_t offset, size_t length) override
+	{
+		// We must be asked to read the whole snapshot, from the start.
+		if (offset != 0 || length < sizeof(meminfo)) {
+			return 0;
+		}
+
+		memory_manager::get().collect_stats(*(meminfo *)buffer);
+		return sizeof(meminfo);
+	}
+
+	// No writing allowed!
+	virtual size_t pwrite(const void *buffer, size_t offset, size_t length) override { return 0; }
+};
+
+shared_ptr<file> meminfo_device::open_as_file() { return shared_ptr<file>(new meminfo_file()); }
@@ -11,11 +11,15 @@
 #include <stacsos/kernel/dev/gfx/qemu-stdvga.h>
 #include <stacsos/kernel/dev/pci/pci-device.h>
 #include <stacsos/kernel/dev/storage/ahci-controller.h>
+#include <stacsos/kernel/dev/storage/nvme-device.h>
+#include <stacsos/kernel/dev/storage/virtio-block-device.h>
+#include <stacsos/kernel/dev/virtio/virtio-pci-transport.h>
 
 using namespace stacsos::kernel::dev;
 using namespace stacsos::kernel::dev::storage;
 using namespace stacsos::kernel::dev::gfx;
 using namespace stacsos::kernel::dev::pci;
+using namespace stacsos::kernel::dev::virtio;
 using namespace stacsos::kernel::arch::x86;
 using namespace stacsos::kernel::arch::x86::irq;
 
@@ -33,6 +37,13 @@ void pci_device::configure()
 {
 	dprintf("pci: vendor=%x, device=%x\n", config().vendor_id(), config().device_id());
 
+	// NVMe controllers are identified by their class, rather than their vendor.
+	if (config().class_code() == pci_native_device_class::MASS_STORAGE && config().subclass() == 0x08 && config().prog_if() == 0x02) {
+		auto *dev = new nvme_device(parent_bus(), *this);
+		device_manager::get().register_device(*dev);
+		return;
+	}
+
 	switch (config().vendor_id()) {
 	case 0x1234:
 		switch (config().device_id()) {
@@ -49,23 +60,25 @@ void pci_device::configure()
 		break;
 
 	case 0x1af4:
-		/*switch (config().device_id()) {
-		case 0x1000: {
-			auto *tpt = new virtio_pci_transport(*this);
-			auto *dev = new virtio_network_device(manager(), parent_bus(), *tpt);
-			dev->activate();
-			break;
-		}
-		case 0x1001: {
+		switch (config().device_id()) {
+		case 0x1001: // transitional
+		case 0x1042: { // modern
 			auto *tpt = new virtio_pci_transport(*this);
-			auto *dev = new virtio_block_device(manager(), parent_bus(), *tpt);
-			dev->activate();
+			if (!tpt->probe()) {
+				dprintf("pci: virtio device has no modern interface\n");
+				delete tpt;
+				break;
+			}
+
+			auto *dev = new virtio_block_device(parent_bus(), *tpt);
+			device_manager::get().register_device(*dev);
 			break;
 		}
+
 		default:
 			dprintf("pci: unknown device\n");
 			break;
-		}*/
+		}
 
 		break;
 
@@ -121,3 +134,76 @@ void pci_device::register_msi(irq_handler_fn handler, void *arg)
 		}
 	}
 }
+
+u64 pci_device::bar_address(int index)
+{
+	u32 bar = config_.bar_by_index(index);
+
+	// I/O space BARs have no memory address.
+	if (bar & 1) {
+		return 0;
+	}
+
+	u64 address = bar & ~0xfull;
+
+	// Type 2 is a 64-bit BAR, which takes up the following BAR for the upper half of the address.
+	if (((bar >> 1) & 3) == 2) {
+		address |= (u64)config_.bar_by_index(index + 1) << 32;
+	}
+
+	return address;
+}
+
+void pci_device::enable_bus_mastering()
+{
+	// Memory space enable (bit 1) and bus master enable (bit 2).
+	config_.write_config_value<u16>(4, config_.command() | 0x6);
+}
+
+int pci_device::nr_msix_vectors()
+{
+	for (auto cap : capabilities()) {
+		if (cap.vendor == 0x11) {
+			return (config_.read_config_value<u16>(cap.offset + 2) & 0x7ff) + 1;
+		}
+	}
+
+	return 0;
+}
+
+bool pci_device::register_msix(int entry, irq_handler_fn handler, void *arg)
+{
+	for (auto cap : capabilities()) {
+		if (cap.vendor != 0x11) {
+			continue;
+		}
+
+		u16 msix_ctrl = config_.read_config_value<u16>(cap.offset + 2);
+		if (entry >= (msix_ctrl & 0x7ff) + 1) {
+			return false;
+		}
+
+		// The table lives in one of the device's BARs, given by the low three bits of the offset.
+		u32 table_info = config_.read_config_value<u32>(cap.offset + 4);
+		u64 table_base = bar_address(table_info & 7) + (table_info & ~7u);
+
+		volatile u32 *table_entry = (volatile u32 *)phys_to_virt(table_base + (entry * 16));
+
+		u8 irqnr = x86_core::this_core().irqmgr().allocate_irq(handler, arg);
+
+		// Same message as for MSI: delivered to the boot core's local APIC.
+		u64 msi_address = 0xFEE00000;
+		table_entry[0] = (u32)msi_address;
+		table_entry[1] = (u32)(msi_address >> 32);
+		table_entry[2] = 0x4000 | irqnr;
+		table_entry[3] = 0; // unmask
+
+		// Enable MSI-X (bit 15), and clear the function mask (bit 14).
+		msix_ctrl = (msix_ctrl | 0x8000) & ~0x4000;
+		config_.write_config_value<u16>(cap.offset + 2, msix_ctrl);
+
+		return true;
+	}
+
+	return false;
+}
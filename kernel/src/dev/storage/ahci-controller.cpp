@@ -5,6 +5,7 @@
  * Copyright (c) University of St Andrews 2024
  * Tom Spink <tcs6@st-andrews.ac.uk>
  */
+#include <stacsos/kernel/arch/x86/x86-core.h>
 #include <stacsos/kernel/debug.h>
 #include <stacsos/kernel/dev/device-manager.h>
 #include <stacsos/kernel/dev/storage/ahci-controller.h>
@@ -12,6 +13,7 @@
 #include <stacsos/kernel/mem/memory-manager.h>
 #include <stacsos/list.h>
 
+using namespace stacsos::kernel::arch::x86;
 using namespace stacsos::kernel::dev;
 using namespace stacsos::kernel::dev::storage;
 using namespace stacsos::kernel::dev::pci;
@@ -27,45 +29,80 @@ void ahci_controller::probe()
 		return;
 	}
 
-	list<volatile hba_port *> usable_ports;
+	abar_ = abar;
+
+	list<int> usable_ports;
 
 	u32 available_ports = abar->generic_host_cntrol.ports_implemented;
 	for (int port_index = 0; port_index < 32; port_index++) {
 		if (available_ports & (1 << port_index)) {
 			if (detect_port(&abar->ports[port_index]) == ahci_port_type::sata) {
-				usable_ports.append(&abar->ports[port_index]);
+				usable_ports.append(port_index);
 			}
 		}
 	}
 
+	if (usable_ports.empty()) {
+		return;
+	}
+
 	// Allocate storage for command list, command table, and FIS.
 	u64 cl_size = 0x400 * usable_ports.count();
-	u64 ctbl_size = 0x100 * 32 * usable_ports.count();
+	u64 ctbl_size = ahci_cmd_table_size * 32 * usable_ports.count();
 	u64 fis_size = 0x100 * usable_ports.count();
 
-	u64 clb = memory_manager::get().pgalloc().allocate_pages(0, page_allocation_flags::zero)->base_address();
-	u64 ctbl = memory_manager::get().pgalloc().allocate_pages(0, page_allocation_flags::zero)->base_address();
-	u64 fis = memory_manager::get().pgalloc().allocate_pages(0, page_allocation_flags::zero)->base_address();
+	auto &pgalloc = memory_manager::get().pgalloc();
+	u64 clb = pgalloc.allocate_pages(log2_ceil(PAGE_ALIGN_UP(cl_size) >> PAGE_BITS), page_allocation_flags::zero)->base_address();
+	u64 ctbl = pgalloc.allocate_pages(log2_ceil(PAGE_ALIGN_UP(ctbl_size) >> PAGE_BITS), page_allocation_flags::zero)->base_address();
+	u64 fis = pgalloc.allocate_pages(log2_ceil(PAGE_ALIGN_UP(fis_size) >> PAGE_BITS), page_allocation_flags::zero)->base_address();
+
+	// Completions are delivered by MSI, so the handler must be in place (and the HBA allowed to
+	// raise interrupts) before any port is activated, as activation performs the first reads.
+	pcidev_.register_msi(ahci_irq_handler, this);
+	abar->generic_host_cntrol.interrupt_status = abar->generic_host_cntrol.interrupt_status;
 
-	int port_index = 0;
-	for (volatile hba_port *port : usable_ports) {
-		u64 clb_offset = clb + (0x400 * port_index);
-		u64 ctbl_offset = ctbl + (0x100 * 32 * port_index);
-		u64 fis_offset = fis + (0x100 * port_index);
+	u32 ghc = abar->generic_host_cntrol.global_host_control;
+	abar->generic_host_cntrol.global_host_control = ghc | HBA_GHC_IE;
+
+	int slot = 0;
+	for (int port_index : usable_ports) {
+		u64 clb_offset = clb + (0x400 * slot);
+		u64 ctbl_offset = ctbl + (ahci_cmd_table_size * 32 * slot);
+		u64 fis_offset = fis + (0x100 * slot);
 
 		// Initialise command headers in the CLB for this port.
 		for (int cmd_idx = 0; cmd_idx < 32; cmd_idx++) {
-			u64 ctbl_cmd_offset = ctbl_offset + (0x100 * cmd_idx);
+			u64 ctbl_cmd_offset = ctbl_offset + (ahci_cmd_table_size * cmd_idx);
 
 			volatile hba_cmd_header *hdr = &((hba_cmd_header *)phys_to_virt(clb_offset))[cmd_idx];
-			hdr->prdtl = 8;
+			hdr->prdtl = 0;
 			hdr->ctba = (u32)ctbl_cmd_offset;
 			hdr->ctbau = (u32)(ctbl_cmd_offset >> 32);
 		}
 
-		activate_port(port, clb_offset, fis_offset);
-		port_index++;
+		activate_port(port_index, &abar->ports[port_index], clb_offset, fis_offset);
+		slot++;
+	}
+}
+
+void ahci_controller::ahci_irq_handler(u8 irq, void *ctx, void *arg)
+{
+	((ahci_controller *)arg)->handle_interrupt();
+	x86_core::this_core().lapic().eoi();
+}
+
+void ahci_controller::handle_interrupt()
+{
+	u32 pending = abar_->generic_host_cntrol.interrupt_status;
+
+	for (int port_index = 0; port_index < 32; port_index++) {
+		if ((pending & (1u << port_index)) && port_devices_[port_index]) {
+			port_devices_[port_index]->handle_interrupt();
+		}
 	}
+
+	// The per-port status has been cleared by the port devices, so the HBA-level bits can go now.
+	abar_->generic_host_cntrol.interrupt_status = pending;
 }
 
 ahci_port_type ahci_controller::detect_port(volatile hba_port *port)
@@ -90,7 +127,7 @@ ahci_port_type ahci_controller::detect_port(volatile hba_port *port)
 	}
 }
 
-void ahci_controller::activate_port(volatile hba_port *port, u64 clb, u64 fis)
+void ahci_controller::activate_port(int port_index, volatile hba_port *port, u64 clb, u64 fis)
 {
 	dprintf("ahci: activating port clb=%p, fis=%p\n", clb, fis);
 
@@ -106,6 +143,8 @@ void ahci_controller::activate_port(volatile hba_port *port, u64 clb, u64 fis)
 	port->fis_base_addr = (u32)fis;
 	port->fis_base_addr_hi = (u32)(fis >> 32);
 
-	auto *dev = new ahci_storage_device(*this, port);
+	auto *dev = new ahci_storage_device(*this, port, abar_->generic_host_cntrol.host_capabilities);
+	port_devices_[port_index] = dev;
+
 	device_manager::get().register_device(*dev);
 }
@@ -19,6 +19,11 @@ using namespace stacsos::kernel::mem;
 
 device_class ahci_storage_device::ahci_storage_device_class(block_device::block_device_class, "ahci");
 
+// The largest request one command can carry is bounded by the 16-bit sector count, and by the PRDT
+// entries needed if no two pages of the buffer are physically contiguous.
+static const u64 max_prdt_blocks = ((ahci_max_prdt_entries - 1) * PAGE_SIZE) / 512;
+static const u64 max_blocks = max_prdt_blocks < 0xffff ? max_prdt_blocks : 0xffff;
+
 void ahci_storage_device::configure()
 {
 	dprintf("ahci: start port\n");
@@ -32,6 +37,18 @@ void ahci_storage_device::configure()
 	port_->cmd |= HBA_PxCMD_ST;
 
 	identify();
+
+	// From here on, commands complete asynchronously: the port raises an interrupt when a
+	// non-queued command finishes (D2H register FIS), when queued commands finish (set device
+	// bits FIS), or on a task file error.
+	port_->interrupt_status = port_->interrupt_status;
+	port_->interrupt_enable = HBA_PxIS_DHRS | HBA_PxIS_SDBS | HBA_PxIS_TFES;
+
+	dprintf("ahci: %lu blocks, ncq=%s, %u command slot(s)\n", nr_blocks_, ncq_ ? "yes" : "no", nr_slots_);
+
+	// Let the block layer queue and merge requests, keeping one in flight per command slot.
+	enable_queueing(nr_slots_, max_blocks);
+
 	detect_partitions();
 }
 
@@ -43,24 +60,15 @@ void ahci_storage_device::identify()
 		panic("no free cmd slots");
 	}
 
-	cmd->cfl = sizeof(fis_reg_host2device) / sizeof(u32);
-	cmd->w = 0;
-	cmd->prdtl = 1;
-	cmd->p = 1;
-
-	if (cmd->prdtl > 8) {
-		panic("too many prdtls");
-	}
+	u8 *buffer = new u8[512];
 
 	volatile hba_cmd_table *cmdtbl = (hba_cmd_table *)phys_to_virt((u64)cmd->ctba);
-	memops::bzero((void *)cmdtbl, sizeof(hba_cmd_table) + sizeof(hba_prdt_entry) * cmd->prdtl);
-
-	u8 *buffer = new u8[512];
+	memops::bzero((void *)cmdtbl, sizeof(hba_cmd_table));
 
-	// TODO: FIXME: This memory address truncating is unsafe.
-	cmdtbl->prdt_entry[0].dba = (u32)(u64)buffer;
-	cmdtbl->prdt_entry[0].dbc = 512;
-	cmdtbl->prdt_entry[0].i = 1;
+	cmd->cfl = sizeof(fis_reg_host2device) / sizeof(u32);
+	cmd->w = 0;
+	cmd->prdtl = build_prdt(cmdtbl, *page_table::current(), buffer, 512);
+	cmd->p = 1;
 
 	// Prepare command
 	volatile fis_reg_host2device *cmdfis = (fis_reg_host2device *)(&cmdtbl->cfis);
@@ -93,6 +101,21 @@ void ahci_storage_device::identify()
 	}
 
 	nr_blocks_ = *(u32 *)(buffer + 120);
+
+	// NCQ needs support from both the HBA (CAP.SNCQ) and the device (word 76, bit 8), and the
+	// number of commands in flight is bounded by the HBA's slots and the device's queue depth.
+	const u16 *identify_words = (const u16 *)buffer;
+	ncq_ = (host_capabilities_ & HBA_CAP_SNCQ) && (identify_words[76] & (1 << 8));
+
+	if (ncq_) {
+		u32 hba_slots = ((host_capabilities_ >> 8) & 0x1f) + 1;
+		u32 queue_depth = (identify_words[75] & 0x1f) + 1;
+
+		nr_slots_ = min(hba_slots, queue_depth);
+	} else {
+		nr_slots_ = 1;
+	}
+
 	delete[] buffer;
 }
 
@@ -104,57 +127,132 @@ void ahci_storage_device::detect_partitions()
 
 void ahci_storage_device::submit_real_io_request(block_io_request &request)
 {
-	if (request.direction == block_io_request_direction::read) {
-		do_read_block_sync(request.buffer, request.start_block, request.block_count);
-		request.callback(&request, request.cb_state);
-	} else {
-		panic("UNIMPLEMENTED BLOCK IO WRITE REQUEST");
+	if (request.block_count > max_blocks) {
+		split_request(request, max_blocks);
+		return;
+	}
+
+	page_table &pgt = request.pgt ? *request.pgt : *page_table::current();
+
+	unique_irq_lock l(lock_);
+
+	u32 free_slots = ~outstanding_ & (u32)(pow2((u64)nr_slots_) - 1);
+	if (!free_slots) {
+		// Every slot is busy -- the request is issued from the interrupt handler when one retires.
+		pending_requests_.append({ &request, &pgt });
+		return;
 	}
+
+	issue_request(__builtin_ctz(free_slots), request, pgt);
 }
 
-void ahci_storage_device::do_read_block_sync(void *buffer, u64 start, u64 count)
+void ahci_storage_device::handle_interrupt()
 {
-	// dprintf("ahci: read into %p %lu %lu\n", buffer, start, count);
+	u32 status = port_->interrupt_status;
+	port_->interrupt_status = status;
 
-	int slot_index;
-	volatile hba_cmd_header *cmd = get_free_cmd_slot(slot_index);
-	if (cmd == nullptr) {
-		panic("no free cmd slots");
+	if (status & HBA_PxIS_TFES) {
+		panic("ahci: task file error tfd=%x serr=%x", port_->task_file_data, port_->sata_error);
 	}
 
-	cmd->cfl = sizeof(fis_reg_host2device) / sizeof(u32);
-	cmd->w = 0;
-	cmd->prdtl = (u16)((count - 1) >> 4) + 1;
-	cmd->p = 0;
+	block_io_request *completed[32];
+	int nr_completed = 0;
 
-	if (cmd->prdtl > 8) {
-		panic("too many prdtls");
-	}
+	{
+		unique_irq_lock l(lock_);
 
-	// Prepare buffers
-	volatile hba_cmd_table *cmdtbl = (hba_cmd_table *)phys_to_virt((u64)cmd->ctba);
-	memops::bzero((void *)cmdtbl, sizeof(hba_cmd_table) + sizeof(hba_prdt_entry) * cmd->prdtl);
+		// A slot has retired once the HBA has cleared it from CI and (for queued commands) the
+		// device has cleared it from SACT.
+		u32 done = outstanding_ & ~(port_->command_issue | port_->sata_active);
+		while (done) {
+			int slot_index = __builtin_ctz(done);
+			done &= done - 1;
+
+			completed[nr_completed++] = slot_requests_[slot_index];
+			slot_requests_[slot_index] = nullptr;
+			outstanding_ &= ~(1u << slot_index);
+		}
+
+		while (!pending_requests_.empty()) {
+			u32 free_slots = ~outstanding_ & (u32)(pow2((u64)nr_slots_) - 1);
+			if (!free_slots) {
+				break;
+			}
 
-	auto buffer_mapping = page_table::current()->get_mapping((u64)buffer);
-	if (buffer_mapping.result == mapping_result::unmapped) {
-		panic("destination buffer not mapped");
+			pending_request pending = pending_requests_.dequeue();
+			issue_request(__builtin_ctz(free_slots), *pending.request, *pending.pgt);
+		}
+	}
+
+	// Callbacks run outside the lock, as they are free to submit further requests.
+	for (int i = 0; i < nr_completed; i++) {
+		completed[i]->callback(completed[i], completed[i]->cb_state);
 	}
+}
+
+/**
+ * Fills in the PRDT of a command table to describe the given buffer, following on from the first
+ * nr_entries entries, with one entry per physically contiguous run of pages.  Returns the total
+ * number of entries used.
+ */
+u16 ahci_storage_device::build_prdt(volatile hba_cmd_table *cmdtbl, page_table &pgt, void *buffer, u64 length, u16 nr_entries)
+{
+	u64 virt = (u64)buffer;
 
-	u64 buffer_chunk = buffer_mapping.address;
-	for (int prdt_idx = 0; prdt_idx < cmd->prdtl - 1; prdt_idx++) {
-		cmdtbl->prdt_entry[prdt_idx].dba = (u32)buffer_chunk;
-		cmdtbl->prdt_entry[prdt_idx].dbau = (u32)((u64)buffer_chunk >> 32);
-		cmdtbl->prdt_entry[prdt_idx].dbc = (8 * 1024) - 1;
-		cmdtbl->prdt_entry[prdt_idx].i = 1;
+	while (length > 0) {
+		auto buffer_mapping = pgt.get_mapping(virt);
+		if (buffer_mapping.result == mapping_result::unmapped) {
+			panic("request buffer not mapped");
+		}
+
+		u64 phys = buffer_mapping.address;
+		u64 chunk = min(length, PAGE_SIZE - (virt & (PAGE_SIZE - 1)));
+
+		volatile hba_prdt_entry *prev = nr_entries > 0 ? &cmdtbl->prdt_entry[nr_entries - 1] : nullptr;
+		u64 prev_end = prev ? (((u64)prev->dbau << 32) | prev->dba) + prev->dbc + 1 : 0;
+
+		if (prev && prev_end == phys && (prev->dbc + 1 + chunk) <= ahci_max_prdt_entry_size) {
+			// This page follows on physically from the previous entry, so just extend it.
+			prev->dbc = prev->dbc + chunk;
+		} else {
+			if (nr_entries == ahci_max_prdt_entries) {
+				panic("too many prdt entries");
+			}
+
+			volatile hba_prdt_entry *entry = &cmdtbl->prdt_entry[nr_entries++];
+			entry->dba = (u32)phys;
+			entry->dbau = (u32)(phys >> 32);
+			entry->rsv0 = 0;
+			entry->dbc = chunk - 1;
+			entry->i = 0;
+		}
 
-		buffer_chunk += 8 * 1024;
-		count -= 16;
+		virt += chunk;
+		length -= chunk;
 	}
 
-	cmdtbl->prdt_entry[cmd->prdtl - 1].dba = (u32)buffer_chunk;
-	cmdtbl->prdt_entry[cmd->prdtl - 1].dbau = (u32)((u64)buffer_chunk >> 32);
-	cmdtbl->prdt_entry[cmd->prdtl - 1].dbc = (count << 9) - 1;
-	cmdtbl->prdt_entry[cmd->prdtl - 1].i = 1;
+	return nr_entries;
+}
+
+void ahci_storage_device::issue_request(int slot_index, block_io_request &request, page_table &pgt)
+{
+	bool write = request.direction == block_io_request_direction::write;
+	u64 start = request.start_block;
+	u64 count = request.block_count;
+
+	volatile hba_cmd_header *cmd = cmd_slot(slot_index);
+	volatile hba_cmd_table *cmdtbl = (hba_cmd_table *)phys_to_virt((u64)cmd->ctba);
+	memops::bzero((void *)cmdtbl, sizeof(hba_cmd_table));
+
+	cmd->cfl = sizeof(fis_reg_host2device) / sizeof(u32);
+	cmd->w = write ? 1 : 0;
+
+	// A merged request scatters its data across the buffers of the requests it stands for.
+	u16 nr_entries = 0;
+	for_each_request_buffer(request, [&](void *buffer, u64 length) { nr_entries = build_prdt(cmdtbl, pgt, buffer, length, nr_entries); });
+
+	cmd->prdtl = nr_entries;
+	cmd->p = 0;
 
 	// Prepare command
 	volatile fis_reg_host2device *cmdfis = (fis_reg_host2device *)(&cmdtbl->cfis);
@@ -162,7 +260,6 @@ void ahci_storage_device::do_read_block_sync(void *buffer, u64 start, u64 count)
 
 	cmdfis->type = fis_type::FIS_TYPE_REG_H2D;
 	cmdfis->c = 1;
-	cmdfis->command = ATA_CMD_READ_DMA_EX;
 
 	cmdfis->lba0 = (u8)start;
 	cmdfis->lba1 = (u8)(start >> 8);
@@ -172,39 +269,47 @@ void ahci_storage_device::do_read_block_sync(void *buffer, u64 start, u64 count)
 	cmdfis->lba5 = (u8)(start >> 40);
 	cmdfis->device = 1 << 6;
 
-	cmdfis->countl = (u8)count;
-	cmdfis->counth = (u8)(count >> 8);
+	if (ncq_) {
+		// FPDMA QUEUED: the sector count moves to the feature registers, and the count register
+		// carries the tag, which is the command slot.
+		cmdfis->command = write ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_READ_FPDMA_QUEUED;
+		cmdfis->featurel = (u8)count;
+		cmdfis->featureh = (u8)(count >> 8);
+		cmdfis->countl = (u8)(slot_index << 3);
+	} else {
+		cmdfis->command = write ? ATA_CMD_WRITE_DMA_EX : ATA_CMD_READ_DMA_EX;
+		cmdfis->countl = (u8)count;
+		cmdfis->counth = (u8)(count >> 8);
 
-	// Wait for port
-	while ((port_->task_file_data & (ATA_DEV_BUSY | ATA_DEV_DRQ))) {
-		__relax();
+		// Wait for port
+		while ((port_->task_file_data & (ATA_DEV_BUSY | ATA_DEV_DRQ))) {
+			__relax();
+		}
 	}
 
-	port_->command_issue = 1 << slot_index; // Issue command
+	slot_requests_[slot_index] = &request;
+	outstanding_ |= 1u << slot_index;
 
-	while (true) {
-		if (!(port_->command_issue & (1 << slot_index))) {
-			break;
-		}
-
-		if (port_->interrupt_status & HBA_PxIS_TFES) // Task file error
-		{
-			panic("read error");
-		}
+	if (ncq_) {
+		port_->sata_active = 1u << slot_index;
 	}
 
-	if (port_->interrupt_status & HBA_PxIS_TFES) {
-		panic("read error");
-	}
+	port_->command_issue = 1u << slot_index; // Issue command
 }
 
 volatile hba_cmd_header *ahci_storage_device::get_free_cmd_slot(int &slot_index)
 {
-	u32 candidate_slots = port_->sata_ctl | port_->command_issue;
+	u32 candidate_slots = port_->sata_active | port_->command_issue;
 	if (~candidate_slots == 0) {
 		return nullptr;
 	}
 
 	slot_index = __builtin_ctz(~candidate_slots);
-	return &((hba_cmd_header *)phys_to_virt(port_->command_list_base_addr))[slot_index];
+	return cmd_slot(slot_index);
+}
+
+volatile hba_cmd_header *ahci_storage_device::cmd_slot(int slot_index) const
+{
+	u64 clb = (u64)port_->command_list_base_addr | ((u64)port_->command_list_base_addr_hi << 32);
+	return &((hba_cmd_header *)phys_to_virt(clb))[slot_index];
 }
@@ -0,0 +1,606 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2025
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/config.h>
+#include <stacsos/kernel/debug.h>
+#include <stacsos/kernel/dev/storage/block-cache.h>
+#include <stacsos/kernel/dev/storage/block-device.h>
+#include <stacsos/kernel/mem/memory-manager.h>
+#include <stacsos/kernel/mem/page.h>
+#include <stacsos/kernel/sched/process-manager.h>
+#include <stacsos/kernel/sched/process.h>
+#include <stacsos/kernel/sched/sleeper.h>
+#include <stacsos/kernel/sched/thread.h>
+#include <stacsos/memops.h>
+#include <stacsos/meminfo.h>
+
+using namespace stacsos;
+using namespace stacsos::kernel;
+using namespace stacsos::kernel::mem;
+using namespace stacsos::kernel::dev::storage;
+using namespace stacsos::kernel::sched;
+
+// Statistics, aggregated over every block cache.
+static u64 total_buffers, total_hits, total_misses, total_evictions, total_writebacks, total_prefetches;
+
+// The index used to mark buffers that have been invalidated while still referenced.
+static const u64 orphaned_index = ~0ull;
+
+// The default period of the writeback thread, in milliseconds.
+static const u64 default_writeback_interval = 5000;
+
+static block_cache *all_caches;
+static spinlock_irq all_caches_lock;
+
+void block_buffer_ref::release()
+{
+	if (buffer_) {
+		cache_->put(buffer_);
+		buffer_ = nullptr;
+	}
+}
+
+block_cache::block_cache(block_device &bdev, u64 capacity)
+	: bdev_(bdev)
+	, capacity_(max(capacity, 1ull))
+	, nr_buffers_(0)
+	, lru_head_(nullptr)
+	, lru_tail_(nullptr)
+	, dirty_head_(nullptr)
+	, nr_dirty_(0)
+{
+	nr_buckets_ = 16;
+	while (nr_buckets_ < capacity_) {
+		nr_buckets_ <<= 1;
+	}
+
+	buckets_ = new block_buffer *[nr_buckets_];
+	memops::bzero(buckets_, sizeof(block_buffer *) * nr_buckets_);
+
+	unique_irq_lock l(all_caches_lock);
+	next_cache_ = all_caches;
+	all_caches = this;
+}
+
+block_cache::~block_cache()
+{
+	flush();
+
+	{
+		unique_irq_lock l(all_caches_lock);
+
+		block_cache **slot = &all_caches;
+		while (*slot && *slot != this) {
+			slot = &(*slot)->next_cache_;
+		}
+
+		if (*slot) {
+			*slot = next_cache_;
+		}
+	}
+
+	for (u64 i = 0; i < nr_buckets_; i++) {
+		block_buffer *buffer = buckets_[i];
+		while (buffer) {
+			block_buffer *next = buffer->hash_next;
+
+			memory_manager::get().pgalloc().free_pages(*buffer->storage, 0);
+			delete buffer;
+
+			buffer = next;
+		}
+	}
+
+	total_buffers -= nr_buffers_;
+	delete[] buckets_;
+}
+
+block_buffer *block_cache::lookup(u64 index)
+{
+	u64 bucket = (index * 0x9e3779b97f4a7c15ull) >> 32 & (nr_buckets_ - 1);
+
+	for (block_buffer *buffer = buckets_[bucket]; buffer; buffer = buffer->hash_next) {
+		if (buffer->index == index) {
+			return buffer;
+		}
+	}
+
+	return nullptr;
+}
+
+void block_cache::hash_insert(block_buffer *buffer)
+{
+	u64 bucket = (buffer->index * 0x9e3779b97f4a7c15ull) >> 32 & (nr_buckets_ - 1);
+
+	buffer->hash_next = buckets_[bucket];
+	buckets_[bucket] = buffer;
+}
+
+void block_cache::hash_remove(block_buffer *buffer)
+{
+	u64 bucket = (buffer->index * 0x9e3779b97f4a7c15ull) >> 32 & (nr_buckets_ - 1);
+
+	block_buffer **slot = &buckets_[bucket];
+	while (*slot && *slot != buffer) {
+		slot = &(*slot)->hash_next;
+	}
+
+	if (*slot) {
+		*slot = buffer->hash_next;
+	}
+
+	buffer->hash_next = nullptr;
+}
+
+void block_cache::lru_insert(block_buffer *buffer)
+{
+	buffer->lru_prev = nullptr;
+	buffer->lru_next = lru_head_;
+
+	if (lru_head_) {
+		lru_head_->lru_prev = buffer;
+	} else {
+		lru_tail_ = buffer;
+	}
+
+	lru_head_ = buffer;
+}
+
+void block_cache::lru_remove(block_buffer *buffer)
+{
+	if (buffer->lru_prev) {
+		buffer->lru_prev->lru_next = buffer->lru_next;
+	} else {
+		lru_head_ = buffer->lru_next;
+	}
+
+	if (buffer->lru_next) {
+		buffer->lru_next->lru_prev = buffer->lru_prev;
+	} else {
+		lru_tail_ = buffer->lru_prev;
+	}
+
+	buffer->lru_prev = buffer->lru_next = nullptr;
+}
+
+/**
+ * Returns a referenced buffer for the given index.  If the buffer is new, needs_fill is set, and
+ * the caller must read it in from the device.
+ */
+block_buffer *block_cache::acquire(u64 index, bool &needs_fill)
+{
+	needs_fill = false;
+
+	unique_irq_lock l(lock_);
+
+	block_buffer *buffer = lookup(index);
+	if (buffer) {
+		if (buffer->refcount++ == 0 && !buffer->dirty) {
+			lru_remove(buffer);
+		}
+
+		total_hits++;
+		return buffer;
+	}
+
+	total_misses++;
+
+	if (nr_buffers_ < capacity_) {
+		page *pg = memory_manager::get().pgalloc().allocate_pages(0);
+		if (pg) {
+			buffer = new block_buffer();
+			buffer->dirty_next = nullptr;
+			buffer->storage = pg;
+			buffer->data = (u8 *)pg->base_address_ptr();
+
+			nr_buffers_++;
+			total_buffers++;
+		}
+	}
+
+	if (!buffer) {
+		// Recycle the least recently used buffer, if there is one that is not in use.
+		buffer = lru_tail_;
+		if (!buffer) {
+			return nullptr;
+		}
+
+		lru_remove(buffer);
+		hash_remove(buffer);
+		total_evictions++;
+	}
+
+	buffer->index = index;
+	buffer->valid_blocks = 0;
+	buffer->refcount = 1;
+	buffer->ready.reset();
+	buffer->dirty = false;
+	hash_insert(buffer);
+
+	needs_fill = true;
+	return buffer;
+}
+
+void block_cache::put(block_buffer *buffer)
+{
+	unique_irq_lock l(lock_);
+
+	if (--buffer->refcount > 0) {
+		return;
+	}
+
+	if (buffer->index == orphaned_index) {
+		// This buffer was invalidated while it was in use, so it can now go.
+		memory_manager::get().pgalloc().free_pages(*buffer->storage, 0);
+		delete buffer;
+
+		nr_buffers_--;
+		total_buffers--;
+		return;
+	}
+
+	// Dirty buffers stay off the LRU list, so that they cannot be recycled before they have been
+	// written back.
+	if (!buffer->dirty) {
+		lru_insert(buffer);
+	}
+}
+
+void block_cache::mark_dirty(block_buffer *buffer)
+{
+	unique_irq_lock l(lock_);
+
+	if (buffer->dirty) {
+		return;
+	}
+
+	buffer->dirty = true;
+	buffer->dirty_next = dirty_head_;
+	dirty_head_ = buffer;
+	nr_dirty_++;
+}
+
+void block_cache::fill(block_buffer *buffer)
+{
+	u64 first_block = buffer->index * blocks_per_buffer;
+	u64 nr_blocks = min(blocks_per_buffer, bdev_.nr_blocks() - first_block);
+
+	bdev_.read_blocks_sync(buffer->data, first_block, nr_blocks);
+
+	buffer->valid_blocks = nr_blocks;
+	buffer->ready.trigger();
+}
+
+struct prefetch_state {
+	block_io_request request;
+	block_cache *cache;
+	block_buffer *buffer;
+};
+
+void block_cache::prefetch(u64 start_block, u64 count)
+{
+	u64 end_block = min(start_block + count, bdev_.nr_blocks());
+
+	// Hold the reads back until they have all been submitted, so that they can be merged.
+	block_plug plug(bdev_);
+
+	for (u64 index = start_block / blocks_per_buffer; index * blocks_per_buffer < end_block; index++) {
+		bool needs_fill;
+		block_buffer *buffer = acquire(index, needs_fill);
+		if (!buffer) {
+			// Every buffer is in use, so there is nowhere to read ahead into.
+			break;
+		}
+
+		if (!needs_fill) {
+			put(buffer);
+			continue;
+		}
+
+		// The reference taken by acquire() is dropped when the read completes.
+		u64 first_block = index * blocks_per_buffer;
+
+		prefetch_state *state = new prefetch_state();
+		state->cache = this;
+		state->buffer = buffer;
+		state->request.direction = block_io_request_direction::read;
+		state->request.start_block = first_block;
+		state->request.block_count = min(blocks_per_buffer, bdev_.nr_blocks() - first_block);
+		state->request.buffer = buffer->data;
+		state->request.callback = prefetch_complete;
+		state->request.cb_state = state;
+
+		total_prefetches++;
+		bdev_.submit_io_request(state->request);
+	}
+}
+
+void block_cache::prefetch_complete(block_io_request *request, void *state)
+{
+	prefetch_state *pf = (prefetch_state *)state;
+
+	pf->buffer->valid_blocks = request->block_count;
+	pf->buffer->ready.trigger();
+	pf->cache->put(pf->buffer);
+
+	delete pf;
+}
+
+block_buffer_ref block_cache::get(u64 block, u64 &offset_in_buffer)
+{
+	if (block >= bdev_.nr_blocks()) {
+		return block_buffer_ref();
+	}
+
+	bool needs_fill;
+	block_buffer *buffer = acquire(block / blocks_per_buffer, needs_fill);
+	if (!buffer) {
+		return block_buffer_ref();
+	}
+
+	// Whoever created the buffer is responsible for reading it in -- anyone else sleeps until
+	// that has finished.
+	if (needs_fill) {
+		fill(buffer);
+	} else {
+		buffer->ready.wait();
+	}
+
+	offset_in_buffer = (block % blocks_per_buffer) * block_size;
+	return block_buffer_ref(this, buffer);
+}
+
+size_t block_cache::read(void *buffer, u64 offset, size_t length)
+{
+	u8 *output = (u8 *)buffer;
+	size_t remaining = length;
+
+	while (remaining > 0) {
+		u64 block = offset / block_size;
+		if (block >= bdev_.nr_blocks()) {
+			break;
+		}
+
+		u64 offset_in_buffer;
+		auto ref = get(block, offset_in_buffer);
+
+		u64 offset_in_block = offset % block_size;
+		size_t amount;
+
+		if (ref.valid()) {
+			u64 buffer_end = ((buffer_size - offset_in_buffer) / block_size) * block_size;
+			amount = min(remaining, (size_t)(buffer_end - offset_in_block));
+
+			memops::memcpy(output, ref.data() + offset_in_buffer + offset_in_block, amount);
+		} else {
+			// The cache is full of buffers that are in use, so go straight to the device.
+			u8 block_data[block_size];
+			bdev_.read_blocks_sync(block_data, block, 1);
+
+			amount = min(remaining, (size_t)(block_size - offset_in_block));
+			memops::memcpy(output, block_data + offset_in_block, amount);
+		}
+
+		output += amount;
+		offset += amount;
+		remaining -= amount;
+	}
+
+	return length - remaining;
+}
+
+size_t block_cache::write(const void *buffer, u64 offset, size_t length)
+{
+	const u8 *input = (const u8 *)buffer;
+	size_t remaining = length;
+	bool flushed = false;
+
+	while (remaining > 0) {
+		u64 block = offset / block_size;
+		if (block >= bdev_.nr_blocks()) {
+			break;
+		}
+
+		u64 offset_in_buffer;
+		auto ref = get(block, offset_in_buffer);
+
+		u64 offset_in_block = offset % block_size;
+		size_t amount;
+
+		if (ref.valid()) {
+			u64 buffer_end = ((buffer_size - offset_in_buffer) / block_size) * block_size;
+			amount = min(remaining, (size_t)(buffer_end - offset_in_block));
+
+			memops::memcpy(ref.buffer()->data + offset_in_buffer + offset_in_block, input, amount);
+			mark_dirty(ref.buffer());
+		} else if (!flushed) {
+			// The cache may be full of dirty buffers -- write them back, so they can be recycled.
+			flush();
+			flushed = true;
+			continue;
+		} else {
+			// The cache is full of buffers that are in use, so go straight to the device.
+			u8 block_data[block_size];
+			amount = min(remaining, (size_t)(block_size - offset_in_block));
+
+			if (amount < block_size) {
+				bdev_.read_blocks_sync(block_data, block, 1);
+			}
+
+			memops::memcpy(block_data + offset_in_block, input, amount);
+			bdev_.submit_sync_request(block_io_request_direction::write, block_data, block, 1);
+		}
+
+		input += amount;
+		offset += amount;
+		remaining -= amount;
+	}
+
+	return length - remaining;
+}
+
+struct writeback_batch {
+	manual_reset_event done;
+	u64 remaining;
+};
+
+struct writeback_state {
+	block_io_request request;
+	block_cache *cache;
+	block_buffer *buffer;
+	writeback_batch *batch;
+};
+
+void block_cache::flush()
+{
+	u64 nr_to_flush;
+	{
+		unique_irq_lock l(lock_);
+		nr_to_flush = nr_dirty_;
+	}
+
+	// The writes are all submitted under a plug, so that those for neighbouring buffers can be
+	// merged, and then waited for together.  The batch holds one count of its own until every
+	// write has been submitted.
+	writeback_batch batch;
+	batch.remaining = 1;
+
+	{
+		block_plug plug(bdev_);
+
+		// Buffers that are dirtied again while the flush is in progress go back on the dirty
+		// list, so only the buffers that were dirty at the start are considered.
+		while (nr_to_flush-- > 0) {
+			block_buffer *buffer;
+
+			{
+				unique_irq_lock l(lock_);
+
+				buffer = dirty_head_;
+				if (!buffer) {
+					break;
+				}
+
+				dirty_head_ = buffer->dirty_next;
+				buffer->dirty_next = nullptr;
+				buffer->dirty = false;
+				buffer->refcount++;
+				nr_dirty_--;
+			}
+
+			if (buffer->index == orphaned_index) {
+				put(buffer);
+				continue;
+			}
+
+			// The reference taken above is dropped when the write completes.
+			writeback_state *state = new writeback_state();
+			state->cache = this;
+			state->buffer = buffer;
+			state->batch = &batch;
+			state->request.direction = block_io_request_direction::write;
+			state->request.start_block = buffer->index * blocks_per_buffer;
+			state->request.block_count = buffer->valid_blocks;
+			state->request.buffer = buffer->data;
+			state->request.callback = writeback_complete;
+			state->request.cb_state = state;
+
+			__atomic_add_fetch(&batch.remaining, 1, __ATOMIC_RELAXED);
+			total_writebacks++;
+
+			bdev_.submit_io_request(state->request);
+		}
+	}
+
+	if (__atomic_sub_fetch(&batch.remaining, 1, __ATOMIC_ACQ_REL) == 0) {
+		batch.done.trigger();
+	}
+
+	batch.done.wait();
+}
+
+void block_cache::writeback_complete(block_io_request *request, void *state)
+{
+	writeback_state *wb = (writeback_state *)state;
+	writeback_batch *batch = wb->batch;
+
+	wb->cache->put(wb->buffer);
+	delete wb;
+
+	if (__atomic_sub_fetch(&batch->remaining, 1, __ATOMIC_ACQ_REL) == 0) {
+		batch->done.trigger();
+	}
+}
+
+void block_cache::invalidate(u64 start_block, u64 count)
+{
+	unique_irq_lock l(lock_);
+
+	u64 first_index = start_block / blocks_per_buffer;
+	u64 last_index = (start_block + count + blocks_per_buffer - 1) / blocks_per_buffer;
+
+	for (u64 index = first_index; index < last_index; index++) {
+		block_buffer *buffer = lookup(index);
+		if (!buffer) {
+			continue;
+		}
+
+		hash_remove(buffer);
+
+		if (buffer->refcount > 0 || buffer->dirty) {
+			// It will be released when the last reference goes away, or once the writeback
+			// code has taken it off the dirty list.
+			buffer->index = orphaned_index;
+			continue;
+		}
+
+		lru_remove(buffer);
+		memory_manager::get().pgalloc().free_pages(*buffer->storage, 0);
+		delete buffer;
+
+		nr_buffers_--;
+		total_buffers--;
+	}
+}
+
+void block_cache::collect_stats(meminfo &info)
+{
+	info.bcache_memory = total_buffers * buffer_size;
+	info.bcache_hits = total_hits;
+	info.bcache_misses = total_misses;
+	info.bcache_evictions = total_evictions;
+	info.bcache_writebacks = total_writebacks;
+	info.bcache_prefetches = total_prefetches;
+}
+
+void block_cache::flush_all()
+{
+	// Caches are only removed when their device goes away, so the list can be walked without
+	// holding the lock across the (sleeping) flushes.
+	block_cache *cache;
+	{
+		unique_irq_lock l(all_caches_lock);
+		cache = all_caches;
+	}
+
+	while (cache) {
+		cache->flush();
+		cache = cache->next_cache_;
+	}
+}
+
+static void writeback_thread_main()
+{
+	u64 interval = config::get().get_option_u64_or_default("writeback-interval", default_writeback_interval);
+
+	while (true) {
+		sleeper::get().sleep_ms(interval);
+		block_cache::flush_all();
+	}
+}
+
+void block_cache::start_writeback() { process_manager::get().kernel_process()->create_thread((u64)writeback_thread_main)->start(); }
@@ -5,24 +5,415 @@
  * Copyright (c) University of St Andrews 2024
  * Tom Spink <tcs6@st-andrews.ac.uk>
  */
+#include <stacsos/kernel/arch/core-manager.h>
+#include <stacsos/kernel/arch/core.h>
+#include <stacsos/kernel/config.h>
 #include <stacsos/kernel/debug.h>
 #include <stacsos/kernel/dev/storage/block-device.h>
+#include <stacsos/kernel/mem/address-space.h>
+#include <stacsos/kernel/mem/page-table.h>
 #include <stacsos/kernel/sched/event.h>
+#include <stacsos/kernel/sched/thread.h>
 
 using namespace stacsos::kernel;
+using namespace stacsos::kernel::arch;
 using namespace stacsos::kernel::dev;
 using namespace stacsos::kernel::dev::storage;
 using namespace stacsos::kernel::sched;
+using namespace stacsos::kernel::mem;
 
 device_class block_device::block_device_class(device_class::root, "blk");
 
-void block_device::submit_io_request(block_io_request &request) { submit_real_io_request(request); }
+// The default number of buffers in each block device's cache (4 MB).
+static const u64 default_cache_capacity = 1024;
+
+// A plug releases the requests it holds anyway once it holds this many.
+static const u64 max_plugged_requests = 64;
+
+/**
+ * Returns the thread running on this core, or nullptr if there is none (e.g. during boot, or on
+ * the idle thread), or if this is interrupt context, where plugs do not apply.
+ */
+static thread *plugging_thread()
+{
+	if (!irqs_enabled()) {
+		return nullptr;
+	}
+
+	tcb *current = core::this_core().get_current_tcb();
+	return current ? (thread *)current->entity : nullptr;
+}
+
+block_plug::block_plug(block_device &bdev)
+	: bdev_(bdev.queueing_device())
+	, active_(false)
+	, outer_(nullptr)
+	, held_head_(nullptr)
+	, held_tail_(&held_head_)
+	, nr_held_(0)
+{
+	thread *t = plugging_thread();
+	if (!t || !bdev_.staging_queues_ || find(bdev_)) {
+		return;
+	}
+
+	outer_ = t->current_plug();
+	t->set_current_plug(this);
+	active_ = true;
+}
+
+block_plug::~block_plug()
+{
+	if (!active_) {
+		return;
+	}
+
+	thread::current().set_current_plug(outer_);
+	bdev_.release_plugged(*this);
+}
+
+/**
+ * Returns the plug that the current thread holds on a device, if any.
+ */
+block_plug *block_plug::find(block_device &bdev)
+{
+	thread *t = plugging_thread();
+	if (!t) {
+		return nullptr;
+	}
+
+	for (block_plug *plug = t->current_plug(); plug; plug = plug->outer_) {
+		if (&plug->bdev_ == &bdev) {
+			return plug;
+		}
+	}
+
+	return nullptr;
+}
+
+void block_device::submit_io_request(block_io_request &request)
+{
+	if (!staging_queues_) {
+		submit_real_io_request(request);
+		return;
+	}
+
+	// The request may be dispatched from another context, e.g. a completion interrupt.
+	request.pgt = page_table::current();
+
+	// The plug belongs to this thread, so its list needs no lock.
+	block_plug *plug = block_plug::find(*this);
+	if (plug) {
+		request.next = nullptr;
+		*plug->held_tail_ = &request;
+		plug->held_tail_ = &request.next;
+
+		if (++plug->nr_held_ >= max_plugged_requests) {
+			release_plugged(*plug);
+		}
+
+		return;
+	}
+
+	staging_queue &q = staging_queues_[core::this_core_id()];
+
+	{
+		unique_irq_lock l(q.lock);
+		stage_request(q, request);
+	}
+
+	dispatch_staged();
+}
+
+/**
+ * Moves the requests held by a plug onto this core's staging queue, where they can be merged, and
+ * dispatches them.
+ */
+void block_device::release_plugged(block_plug &plug)
+{
+	block_io_request *request = plug.held_head_;
+	if (!request) {
+		return;
+	}
+
+	plug.held_head_ = nullptr;
+	plug.held_tail_ = &plug.held_head_;
+	plug.nr_held_ = 0;
+
+	staging_queue &q = staging_queues_[core::this_core_id()];
+
+	{
+		unique_irq_lock l(q.lock);
+
+		while (request) {
+			block_io_request *next = request->next;
+			stage_request(q, *request);
+			request = next;
+		}
+	}
+
+	dispatch_staged();
+}
+
+void block_device::enable_queueing(u32 queue_depth, u64 max_request_blocks)
+{
+	queue_depth_ = (u32)config::get().get_option_u64_or_default("blk-queue-depth", queue_depth);
+	if (queue_depth_ == 0) {
+		queue_depth_ = 1;
+	}
+
+	max_request_blocks_ = max_request_blocks;
+
+	dispatch_slot *slots = new dispatch_slot[queue_depth_];
+	for (u32 i = 0; i < queue_depth_; i++) {
+		slots[i].owner = this;
+		slots[i].next_free = free_slots_;
+		free_slots_ = &slots[i];
+	}
+
+	staging_queues_ = new staging_queue[core_manager::max_cores];
+
+	dprintf("blk: queue depth %u, max request %lu blocks\n", queue_depth_, max_request_blocks_);
+}
+
+void block_device::stage_request(staging_queue &q, block_io_request &request)
+{
+	u64 end = request.start_block + request.block_count;
+
+	// Insert the request at the earliest point from which every staged request lies wholly after
+	// it.  Going no further forward than that keeps overlapping requests in submission order.
+	block_io_request **slot = &q.head, **insert_at = nullptr;
+	while (*slot) {
+		if ((*slot)->start_block >= end) {
+			if (!insert_at) {
+				insert_at = slot;
+			}
+		} else {
+			insert_at = nullptr;
+		}
+
+		slot = &(*slot)->next;
+	}
+
+	if (!insert_at) {
+		insert_at = slot;
+	}
+
+	request.next = *insert_at;
+	*insert_at = &request;
+
+	q.nr_staged++;
+}
+
+/**
+ * Returns true if next can be merged onto the end of a request that finishes with prev, and that
+ * has total blocks so far.
+ */
+static bool can_merge(const block_io_request &prev, const block_io_request &next, u64 total, u64 max_blocks)
+{
+	if (next.direction != prev.direction || next.pgt != prev.pgt) {
+		return false;
+	}
+
+	if (next.start_block != prev.start_block + prev.block_count || total + next.block_count > max_blocks) {
+		return false;
+	}
+
+	// The data must either be contiguous, or break on a page boundary, so that it can still be
+	// described as a list of pages.
+	u64 prev_end = (u64)prev.buffer + prev.block_count * 512;
+	return (u64)next.buffer == prev_end || ((prev_end & (PAGE_SIZE - 1)) == 0 && ((u64)next.buffer & (PAGE_SIZE - 1)) == 0);
+}
+
+void block_device::dispatch_staged()
+{
+	// Start with this core's queue, then pick up anything left on the others.
+	int this_core = core::this_core_id();
+
+	for (int i = 0; i < core_manager::max_cores; i++) {
+		staging_queue &q = staging_queues_[(this_core + i) % core_manager::max_cores];
+
+		while (dispatch_one(q)) { }
+
+		if (!free_slots_) {
+			return;
+		}
+	}
+}
+
+bool block_device::dispatch_one(staging_queue &q)
+{
+	dispatch_slot *slot;
+	{
+		unique_irq_lock l(dispatch_lock_);
+
+		slot = free_slots_;
+		if (!slot) {
+			return false;
+		}
+
+		free_slots_ = slot->next_free;
+	}
+
+	block_io_request *first = nullptr;
+	{
+		unique_irq_lock l(q.lock);
+
+		if (q.head) {
+			first = q.head;
+
+			block_io_request *last = first;
+			u64 total = first->block_count, nr_merged = 1;
+
+			while (last->next && can_merge(*last, *last->next, total, max_request_blocks_)) {
+				last = last->next;
+				total += last->block_count;
+				nr_merged++;
+			}
+
+			q.head = last->next;
+			q.nr_staged -= nr_merged;
+			last->next = nullptr;
+
+			block_io_request &hw = slot->request;
+			hw.direction = first->direction;
+			hw.start_block = first->start_block;
+			hw.block_count = total;
+			hw.buffer = first->buffer;
+			hw.callback = dispatch_complete;
+			hw.cb_state = slot;
+			hw.segments = first;
+			hw.next = nullptr;
+			hw.pgt = first->pgt;
+		}
+	}
+
+	if (!first) {
+		unique_irq_lock l(dispatch_lock_);
+
+		slot->next_free = free_slots_;
+		free_slots_ = slot;
+
+		return false;
+	}
+
+	submit_real_io_request(slot->request);
+	return true;
+}
+
+void block_device::dispatch_complete(block_io_request *request, void *state)
+{
+	dispatch_slot *slot = (dispatch_slot *)state;
+	block_device *bdev = slot->owner;
+	block_io_request *segment = request->segments;
+
+	{
+		unique_irq_lock l(bdev->dispatch_lock_);
+
+		slot->next_free = bdev->free_slots_;
+		bdev->free_slots_ = slot;
+	}
+
+	// Keep the device busy before completing the original requests.
+	bdev->dispatch_staged();
+
+	while (segment) {
+		// The callback may release the request, so move past it first.
+		block_io_request *next = segment->next;
+		segment->next = nullptr;
+
+		segment->callback(segment, segment->cb_state);
+		segment = next;
+	}
+}
+
+struct split_state {
+	block_io_request *original;
+	u64 remaining;
+};
+
+void block_device::split_request(block_io_request &request, u64 max_blocks)
+{
+	// The block layer never merges beyond the device's maximum, so such a request is always a
+	// single buffer.
+	if (request.segments) {
+		panic("blk: cannot split a merged request");
+	}
+
+	split_state *state = new split_state();
+	state->original = &request;
+	state->remaining = (request.block_count + (max_blocks - 1)) / max_blocks;
+
+	for (u64 offset = 0; offset < request.block_count; offset += max_blocks) {
+		block_io_request *chunk = new block_io_request();
+		chunk->direction = request.direction;
+		chunk->start_block = request.start_block + offset;
+		chunk->block_count = min(max_blocks, request.block_count - offset);
+		chunk->buffer = (u8 *)request.buffer + (offset * 512);
+		chunk->callback = split_request_cb;
+		chunk->cb_state = state;
+		chunk->pgt = request.pgt;
+
+		submit_real_io_request(*chunk);
+	}
+}
+
+void block_device::split_request_cb(block_io_request *request, void *state)
+{
+	split_state *split = (split_state *)state;
+	delete request;
+
+	if (__atomic_sub_fetch(&split->remaining, 1, __ATOMIC_ACQ_REL) == 0) {
+		split->original->callback(split->original, split->original->cb_state);
+		delete split;
+	}
+}
 
 void block_device::read_blocks_sync(void *buffer, u64 start, u64 count) { submit_sync_request(block_io_request_direction::read, buffer, start, count); }
 
 void block_device::write_blocks_sync(const void *buffer, u64 start, u64 count)
 {
+	// Cached writes must reach the device first, so that they don't later overwrite this data.
+	if (cache_) {
+		cache_->flush();
+	}
+
 	submit_sync_request(block_io_request_direction::write, (void *)buffer, start, count);
+
+	if (cache_) {
+		cache_->invalidate(start, count);
+	}
+}
+
+bool block_device::read_blocks_direct(address_space &as, void *buffer, u64 start, u64 count)
+{
+	if (!is_dma_aligned(buffer)) {
+		return false;
+	}
+
+	address_space_region *rgn = as.pin_range((u64)buffer, count * 512, region_flags::writable);
+	if (!rgn) {
+		return false;
+	}
+
+	// The device may be behind the cache, so modified data must be written back first.
+	if (cache_) {
+		cache_->flush();
+	}
+
+	submit_sync_request(block_io_request_direction::read, buffer, start, count);
+
+	as.unpin(rgn);
+	return true;
+}
+
+block_cache &block_device::cache()
+{
+	if (!cache_) {
+		cache_ = new block_cache(*this, config::get().get_option_u64_or_default("bcache-capacity", default_cache_capacity));
+	}
+
+	return *cache_;
 }
 
 struct sync_state {
@@ -46,5 +437,12 @@ void block_device::submit_sync_request(block_io_request_direction direction, voi
 
 	submit_io_request(io_req);
 
+	// The request must not be left waiting behind this thread's own plug.
+	block_device &queue = queueing_device();
+	block_plug *plug = block_plug::find(queue);
+	if (plug) {
+		queue.release_plugged(*plug);
+	}
+
 	state.e.wait();
 }
@@ -0,0 +1,466 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2025
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/arch/x86/x86-core.h>
+#include <stacsos/kernel/debug.h>
+#include <stacsos/kernel/dev/storage/mbr.h>
+#include <stacsos/kernel/dev/storage/nvme-device.h>
+#include <stacsos/kernel/mem/memory-manager.h>
+#include <stacsos/memops.h>
+
+using namespace stacsos;
+using namespace stacsos::kernel;
+using namespace stacsos::kernel::arch;
+using namespace stacsos::kernel::arch::x86;
+using namespace stacsos::kernel::dev;
+using namespace stacsos::kernel::dev::storage;
+using namespace stacsos::kernel::mem;
+
+device_class nvme_device::nvme_device_class(block_device::block_device_class, "nvme");
+
+static const u16 admin_queue_size = 16;
+
+// Deeper queues are not needed to keep the controller busy, and each command identifier has a
+// page of PRP list reserved for it.
+static const u16 max_io_queue_size = 64;
+
+// One page of PRP list describes this many pages of a transfer, beyond the first.
+static const u64 prp_list_entries = PAGE_SIZE / sizeof(u64);
+
+static u64 alloc_queue_memory(u64 size)
+{
+	page *pages = memory_manager::get().pgalloc().allocate_pages(log2_ceil(PAGE_ALIGN_UP(size) >> PAGE_BITS), page_allocation_flags::zero);
+	if (!pages) {
+		panic("nvme: unable to allocate queue memory");
+	}
+
+	return pages->base_address();
+}
+
+static u64 translate(page_table &pgt, u64 virt)
+{
+	auto buffer_mapping = pgt.get_mapping(virt);
+	if (buffer_mapping.result == mapping_result::unmapped) {
+		panic("request buffer not mapped");
+	}
+
+	return buffer_mapping.address;
+}
+
+void nvme_device::configure()
+{
+	regs_ = (volatile u8 *)phys_to_virt(pcidev_.bar_address(0));
+	pcidev_.enable_bus_mastering();
+
+	u64 cap = read64(NVME_REG_CAP);
+	doorbell_stride_ = 4u << ((cap >> 32) & 0xf);
+
+	// Queues and PRPs are laid out in 4 KB pages, which must be the controller's minimum page size.
+	if (((cap >> 48) & 0xf) != 0) {
+		dprintf("nvme: controller does not support 4k pages\n");
+		return;
+	}
+
+	if (!reset_controller()) {
+		return;
+	}
+
+	u64 identify_phys = alloc_queue_memory(PAGE_SIZE);
+	if (!identify(identify_phys)) {
+		return;
+	}
+
+	create_io_queues();
+
+	u32 vs = read32(NVME_REG_VS);
+	dprintf("nvme: version %u.%u, nsid=%u, %lu blocks, %d queue pair(s), max %lu blocks per command\n", vs >> 16, (vs >> 8) & 0xff, nsid_, nr_blocks_,
+		nr_queues_, max_blocks_);
+
+	detect_partitions();
+}
+
+/**
+ * Disables the controller, sets up the admin queue pair, and enables it again.
+ */
+bool nvme_device::reset_controller()
+{
+	if (read32(NVME_REG_CC) & NVME_CC_EN) {
+		write32(NVME_REG_CC, read32(NVME_REG_CC) & ~NVME_CC_EN);
+	}
+
+	while (read32(NVME_REG_CSTS) & NVME_CSTS_RDY) {
+		__relax();
+	}
+
+	admin_ = create_queue_pair(0, admin_queue_size);
+
+	write32(NVME_REG_AQA, ((u32)(admin_queue_size - 1) << 16) | (admin_queue_size - 1));
+	write64(NVME_REG_ASQ, admin_->sq_phys);
+	write64(NVME_REG_ACQ, admin_->cq_phys);
+
+	// NVM command set, 4 KB pages, round-robin arbitration.
+	write32(NVME_REG_CC, NVME_CC_EN | NVME_CC_IOSQES | NVME_CC_IOCQES);
+
+	while (!(read32(NVME_REG_CSTS) & NVME_CSTS_RDY)) {
+		if (read32(NVME_REG_CSTS) & NVME_CSTS_CFS) {
+			dprintf("nvme: controller fatal status during reset\n");
+			return false;
+		}
+
+		__relax();
+	}
+
+	return true;
+}
+
+/**
+ * Identifies the controller and its first active namespace, using the given page as the buffer.
+ */
+bool nvme_device::identify(u64 identify_phys)
+{
+	const u8 *data = (const u8 *)phys_to_virt(identify_phys);
+
+	nvme_command cmd;
+	memops::bzero(&cmd, sizeof(cmd));
+	cmd.opcode = NVME_ADMIN_IDENTIFY;
+	cmd.prp1 = identify_phys;
+	cmd.cdw10 = NVME_IDENTIFY_CONTROLLER;
+
+	if (admin_command(cmd)) {
+		dprintf("nvme: identify controller failed\n");
+		return false;
+	}
+
+	// The largest transfer is bounded by what one page of PRP list can describe, by the 16-bit
+	// block count, and by the controller's limit (MDTS), which is in units of the minimum page size.
+	u8 mdts = data[77];
+
+	max_blocks_ = min((prp_list_entries * PAGE_SIZE) / 512, 0x10000ull);
+	if (mdts) {
+		max_blocks_ = min(max_blocks_, (pow2((u64)mdts) * PAGE_SIZE) / 512);
+	}
+
+	memops::bzero(&cmd, sizeof(cmd));
+	cmd.opcode = NVME_ADMIN_IDENTIFY;
+	cmd.prp1 = identify_phys;
+	cmd.cdw10 = NVME_IDENTIFY_ACTIVE_NAMESPACES;
+
+	if (admin_command(cmd)) {
+		dprintf("nvme: identify active namespaces failed\n");
+		return false;
+	}
+
+	nsid_ = *(const u32 *)data;
+	if (nsid_ == 0) {
+		dprintf("nvme: no active namespaces\n");
+		return false;
+	}
+
+	memops::bzero(&cmd, sizeof(cmd));
+	cmd.opcode = NVME_ADMIN_IDENTIFY;
+	cmd.nsid = nsid_;
+	cmd.prp1 = identify_phys;
+	cmd.cdw10 = NVME_IDENTIFY_NAMESPACE;
+
+	if (admin_command(cmd)) {
+		dprintf("nvme: identify namespace failed\n");
+		return false;
+	}
+
+	// The block layer works in 512-byte blocks, so the namespace must be formatted with them.
+	u8 lba_format = data[26] & 0xf;
+	u32 lba_format_desc = *(const u32 *)&data[128 + (lba_format * 4)];
+	u8 lba_shift = (lba_format_desc >> 16) & 0xff;
+
+	if (lba_shift != 9) {
+		dprintf("nvme: unsupported block size %u\n", 1u << lba_shift);
+		return false;
+	}
+
+	nr_blocks_ = *(const u64 *)&data[0];
+	return true;
+}
+
+/**
+ * Creates one I/O queue pair per core, as far as the controller and its MSI-X table allow.  I/O
+ * queue n completes through MSI-X vector n, leaving vector 0 to the (polled) admin queue.
+ */
+void nvme_device::create_io_queues()
+{
+	int wanted = min(core_manager::get().nr_cores(), min(pcidev_.nr_msix_vectors() - 1, (int)core_manager::max_cores));
+	if (wanted < 1) {
+		panic("nvme: no msi-x vectors available for i/o queues");
+	}
+
+	nvme_command cmd;
+	memops::bzero(&cmd, sizeof(cmd));
+	cmd.opcode = NVME_ADMIN_SET_FEATURES;
+	cmd.cdw10 = NVME_FEATURE_NUMBER_OF_QUEUES;
+	cmd.cdw11 = (u32)(wanted - 1) | ((u32)(wanted - 1) << 16);
+
+	// The controller replies with the number of queues it has allocated, which may be fewer.
+	u32 allocated;
+	if (admin_command(cmd, &allocated)) {
+		panic("nvme: unable to set number of queues");
+	}
+
+	nr_queues_ = min(wanted, (int)min(allocated & 0xffff, allocated >> 16) + 1);
+
+	u16 queue_size = (u16)min((read64(NVME_REG_CAP) & 0xffff) + 1, (u64)max_io_queue_size);
+
+	for (int i = 0; i < nr_queues_; i++) {
+		u16 qid = i + 1;
+		queue_pair *qp = create_queue_pair(qid, queue_size);
+
+		if (!pcidev_.register_msix(qid, queue_irq_handler, qp)) {
+			panic("nvme: unable to register msi-x vector %u", qid);
+		}
+
+		memops::bzero(&cmd, sizeof(cmd));
+		cmd.opcode = NVME_ADMIN_CREATE_CQ;
+		cmd.prp1 = qp->cq_phys;
+		cmd.cdw10 = ((u32)(queue_size - 1) << 16) | qid;
+		cmd.cdw11 = ((u32)qid << 16) | 3; // interrupts enabled, physically contiguous
+
+		if (admin_command(cmd)) {
+			panic("nvme: unable to create completion queue %u", qid);
+		}
+
+		memops::bzero(&cmd, sizeof(cmd));
+		cmd.opcode = NVME_ADMIN_CREATE_SQ;
+		cmd.prp1 = qp->sq_phys;
+		cmd.cdw10 = ((u32)(queue_size - 1) << 16) | qid;
+		cmd.cdw11 = ((u32)qid << 16) | 1; // completes on the queue with the same id, physically contiguous
+
+		if (admin_command(cmd)) {
+			panic("nvme: unable to create submission queue %u", qid);
+		}
+
+		queues_[i] = qp;
+	}
+}
+
+nvme_device::queue_pair *nvme_device::create_queue_pair(u16 id, u16 size)
+{
+	queue_pair *qp = new queue_pair;
+	qp->owner = this;
+	qp->id = id;
+	qp->size = size;
+
+	qp->sq_phys = alloc_queue_memory(sizeof(nvme_command) * size);
+	qp->cq_phys = alloc_queue_memory(sizeof(nvme_completion) * size);
+	qp->sq = (volatile nvme_command *)phys_to_virt(qp->sq_phys);
+	qp->cq = (volatile nvme_completion *)phys_to_virt(qp->cq_phys);
+
+	qp->sq_doorbell = (volatile u32 *)(regs_ + NVME_REG_DOORBELL_BASE + ((2 * id) * doorbell_stride_));
+	qp->cq_doorbell = (volatile u32 *)(regs_ + NVME_REG_DOORBELL_BASE + (((2 * id) + 1) * doorbell_stride_));
+
+	qp->sq_tail = 0;
+	qp->cq_head = 0;
+	qp->cq_phase = 1;
+
+	// A full submission queue holds one entry fewer than its size.
+	qp->requests = new block_io_request *[size];
+	qp->free_cids = new u16[size];
+	qp->nr_free_cids = size - 1;
+
+	for (u16 cid = 0; cid < size - 1; cid++) {
+		qp->free_cids[cid] = cid;
+	}
+
+	// Admin commands never need PRP lists.
+	qp->prp_lists_phys = id == 0 ? 0 : alloc_queue_memory(PAGE_SIZE * (size - 1));
+
+	return qp;
+}
+
+void nvme_device::submit_command(queue_pair &qp, nvme_command &cmd)
+{
+	memops::memcpy((void *)&qp.sq[qp.sq_tail], &cmd, sizeof(cmd));
+
+	qp.sq_tail = (qp.sq_tail + 1) % qp.size;
+
+	// The entry must be visible to the controller before the doorbell is rung.
+	__sync_synchronize();
+	*qp.sq_doorbell = qp.sq_tail;
+}
+
+/**
+ * Takes the next entry from a completion queue, if the controller has posted one.  The caller
+ * must ring the completion queue doorbell once it has taken the entries it wants.
+ */
+bool nvme_device::next_completion(queue_pair &qp, nvme_completion &completion)
+{
+	volatile nvme_completion *entry = &qp.cq[qp.cq_head];
+	if ((entry->status & 1) != qp.cq_phase) {
+		return false;
+	}
+
+	// Read the phase tag before the rest of the entry.
+	__sync_synchronize();
+	memops::memcpy(&completion, (const void *)entry, sizeof(completion));
+
+	// The phase tag the controller writes flips each time it wraps around the queue.
+	qp.cq_head++;
+	if (qp.cq_head == qp.size) {
+		qp.cq_head = 0;
+		qp.cq_phase ^= 1;
+	}
+
+	return true;
+}
+
+/**
+ * Issues an admin command and waits for it to complete.  Returns the status code, which is zero
+ * on success.
+ */
+u16 nvme_device::admin_command(nvme_command &cmd, u32 *result)
+{
+	// Admin commands are issued one at a time, so the submission slot is a unique identifier.
+	cmd.cid = admin_->sq_tail;
+	submit_command(*admin_, cmd);
+
+	nvme_completion completion;
+	while (!next_completion(*admin_, completion)) {
+		__relax();
+	}
+
+	*admin_->cq_doorbell = admin_->cq_head;
+
+	if (result) {
+		*result = completion.result;
+	}
+
+	return completion.status >> 1;
+}
+
+void nvme_device::detect_partitions()
+{
+	mbr m(*this);
+	m.scan();
+}
+
+void nvme_device::submit_real_io_request(block_io_request &request)
+{
+	if (request.block_count > max_blocks_) {
+		split_request(request, max_blocks_);
+		return;
+	}
+
+	page_table &pgt = request.pgt ? *request.pgt : *page_table::current();
+	queue_pair &qp = *queues_[core::this_core_id() % nr_queues_];
+
+	unique_irq_lock l(qp.lock);
+
+	if (!qp.pending.empty() || !issue_request(qp, request, pgt)) {
+		// Every command identifier is in use, or earlier requests are still waiting for one -- the
+		// request is issued, after them, from the interrupt handler when a command completes.
+		qp.pending.append({ &request, &pgt });
+	}
+}
+
+/**
+ * Builds and submits a read or write command for a request.  The first PRP entry points at the
+ * start of the buffer.  If the buffer runs onto exactly one more page, the second entry points at
+ * it; if it runs onto more, the second entry points at a PRP list of the remaining pages.  Returns
+ * false if no command identifier is free.  Must be called with the queue lock held.
+ */
+bool nvme_device::issue_request(queue_pair &qp, block_io_request &request, page_table &pgt)
+{
+	if (qp.nr_free_cids == 0) {
+		return false;
+	}
+
+	u16 cid = qp.free_cids[--qp.nr_free_cids];
+
+	u64 virt = (u64)request.buffer;
+	u64 length = request.block_count * 512;
+
+	nvme_command cmd;
+	memops::bzero(&cmd, sizeof(cmd));
+	cmd.opcode = request.direction == block_io_request_direction::write ? NVME_CMD_WRITE : NVME_CMD_READ;
+	cmd.cid = cid;
+	cmd.nsid = nsid_;
+	cmd.prp1 = translate(pgt, virt);
+
+	u64 first_chunk = PAGE_SIZE - (virt & (PAGE_SIZE - 1));
+	if (length > first_chunk) {
+		u64 next_page = (virt & ~(PAGE_SIZE - 1)) + PAGE_SIZE;
+		u64 remaining = length - first_chunk;
+
+		if (remaining <= PAGE_SIZE) {
+			cmd.prp2 = translate(pgt, next_page);
+		} else {
+			u64 list_phys = qp.prp_lists_phys + (cid * PAGE_SIZE);
+			u64 *list = (u64 *)phys_to_virt(list_phys);
+
+			for (int i = 0; remaining > 0; i++) {
+				list[i] = translate(pgt, next_page);
+
+				next_page += PAGE_SIZE;
+				remaining -= min(remaining, (u64)PAGE_SIZE);
+			}
+
+			cmd.prp2 = list_phys;
+		}
+	}
+
+	cmd.cdw10 = (u32)request.start_block;
+	cmd.cdw11 = (u32)(request.start_block >> 32);
+	cmd.cdw12 = (u32)(request.block_count - 1);
+
+	qp.requests[cid] = &request;
+	submit_command(qp, cmd);
+
+	return true;
+}
+
+void nvme_device::queue_irq_handler(u8 irq, void *ctx, void *arg)
+{
+	queue_pair *qp = (queue_pair *)arg;
+	qp->owner->handle_queue_interrupt(*qp);
+
+	x86_core::this_core().lapic().eoi();
+}
+
+void nvme_device::handle_queue_interrupt(queue_pair &qp)
+{
+	block_io_request *completed[max_io_queue_size];
+	int nr_completed = 0;
+
+	{
+		unique_irq_lock l(qp.lock);
+
+		nvme_completion completion;
+		while (next_completion(qp, completion)) {
+			if (completion.status >> 1) {
+				panic("nvme: command failed on queue %u, status=%x", qp.id, completion.status >> 1);
+			}
+
+			completed[nr_completed++] = qp.requests[completion.cid];
+			qp.requests[completion.cid] = nullptr;
+			qp.free_cids[qp.nr_free_cids++] = completion.cid;
+		}
+
+		if (nr_completed) {
+			*qp.cq_doorbell = qp.cq_head;
+		}
+
+		while (!qp.pending.empty()) {
+			const pending_request &pending = qp.pending.first();
+			if (!issue_request(qp, *pending.request, *pending.pgt)) {
+				break;
+			}
+
+			qp.pending.dequeue();
+		}
+	}
+
+	for (int i = 0; i < nr_completed; i++) {
+		completed[i]->callback(completed[i], completed[i]->cb_state);
+	}
+}
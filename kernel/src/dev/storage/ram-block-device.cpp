@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2025
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/dev/storage/ram-block-device.h>
+#include <stacsos/memops.h>
+
+using namespace stacsos;
+using namespace stacsos::kernel::dev;
+using namespace stacsos::kernel::dev::storage;
+
+device_class ram_block_device::ram_block_device_class(block_device::block_device_class, "ram");
+
+void ram_block_device::submit_real_io_request(block_io_request &request)
+{
+	u8 *image = data_ + (request.start_block * 512);
+	u64 length = request.block_count * 512;
+
+	if (request.start_block + request.block_count > nr_blocks_) {
+		panic("ram block device: request out of range");
+	}
+
+	if (request.direction == block_io_request_direction::read) {
+		memops::memcpy(request.buffer, image, length);
+	} else {
+		memops::memcpy(image, request.buffer, length);
+	}
+
+	if (request.callback) {
+		request.callback(&request, request.cb_state);
+	}
+}
@@ -0,0 +1,251 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2025
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/arch/x86/x86-core.h>
+#include <stacsos/kernel/debug.h>
+#include <stacsos/kernel/dev/storage/mbr.h>
+#include <stacsos/kernel/dev/storage/virtio-block-device.h>
+#include <stacsos/kernel/dev/virtio/virtio-pci-transport.h>
+#include <stacsos/kernel/dev/virtio/virtqueue.h>
+#include <stacsos/kernel/mem/memory-manager.h>
+
+using namespace stacsos;
+using namespace stacsos::kernel;
+using namespace stacsos::kernel::arch;
+using namespace stacsos::kernel::arch::x86;
+using namespace stacsos::kernel::dev;
+using namespace stacsos::kernel::dev::storage;
+using namespace stacsos::kernel::dev::virtio;
+using namespace stacsos::kernel::mem;
+
+device_class virtio_block_device::virtio_block_device_class(block_device::block_device_class, "virtio-blk");
+
+// Block device feature bits.
+static const u64 virtio_blk_f_seg_max = 1ull << 2;
+static const u64 virtio_blk_f_mq = 1ull << 12;
+
+// Offsets into the block device configuration structure.
+static const u32 virtio_blk_cfg_capacity = 0;
+static const u32 virtio_blk_cfg_seg_max = 12;
+static const u32 virtio_blk_cfg_num_queues = 34;
+
+static const u32 virtio_blk_t_in = 0;
+static const u32 virtio_blk_t_out = 1;
+
+static const u8 virtio_blk_s_ok = 0;
+
+// Larger queues are not needed to keep the device busy, and this bounds the per-queue state.
+static const u16 max_queue_size = 256;
+
+// The most data segments placed in a single request.
+static const u32 max_request_segments = 128;
+
+void virtio_block_device::configure()
+{
+	u64 features = transport_.initialise(virtio_blk_f_seg_max | virtio_blk_f_mq);
+	if (!features) {
+		dprintf("virtio-blk: feature negotiation failed\n");
+		return;
+	}
+
+	nr_blocks_ = transport_.read_device_config<u64>(virtio_blk_cfg_capacity);
+
+	// Without SEG_MAX, the device has not said how many segments it accepts, so be conservative.
+	max_segments_ = (features & virtio_blk_f_seg_max) ? transport_.read_device_config<u32>(virtio_blk_cfg_seg_max) : 2;
+	max_segments_ = max(2u, min(max_segments_, max_request_segments));
+
+	// One queue per core, as far as the device, the MSI-X table, and our own limit allow.
+	int device_queues = (features & virtio_blk_f_mq) ? transport_.read_device_config<u16>(virtio_blk_cfg_num_queues) : 1;
+	device_queues = min(device_queues, (int)transport_.nr_queues());
+
+	nr_queues_ = min(min(device_queues, core_manager::get().nr_cores()), min(transport_.pcidev().nr_msix_vectors(), (int)core_manager::max_cores));
+	if (nr_queues_ < 1) {
+		dprintf("virtio-blk: device has no usable queues or msi-x vectors\n");
+		transport_.fail();
+		return;
+	}
+
+	for (int i = 0; i < nr_queues_; i++) {
+		create_queue(i, (u16)i);
+	}
+
+	transport_.ready();
+
+	dprintf("virtio-blk: %lu blocks, %d queue(s), %u segment(s) per request\n", nr_blocks_, nr_queues_, max_segments_);
+
+	detect_partitions();
+}
+
+void virtio_block_device::create_queue(int index, u16 msix_vector)
+{
+	u16 size = min(transport_.max_queue_size(index), max_queue_size);
+	if (size < 4) {
+		panic("virtio-blk: queue %d is too small", index);
+	}
+
+	request_queue *q = new request_queue;
+	q->owner = this;
+	q->vq = new virtqueue(index, size);
+	q->requests = new block_io_request *[size];
+
+	// Each request needs its header and status descriptors, as well as its data segments.
+	max_segments_ = min(max_segments_, (u32)size - 2);
+
+	// Request headers, followed by the status bytes.
+	u64 state_size = (sizeof(virtio_blk_req_header) + 1) * size;
+	page *pages = memory_manager::get().pgalloc().allocate_pages(log2_ceil(PAGE_ALIGN_UP(state_size) >> PAGE_BITS), page_allocation_flags::zero);
+	if (!pages) {
+		panic("virtio-blk: unable to allocate request state");
+	}
+
+	q->headers_phys = pages->base_address();
+	q->statuses_phys = q->headers_phys + (sizeof(virtio_blk_req_header) * size);
+	q->headers = (volatile virtio_blk_req_header *)phys_to_virt(q->headers_phys);
+	q->statuses = (volatile u8 *)phys_to_virt(q->statuses_phys);
+
+	queues_[index] = q;
+
+	if (!transport_.pcidev().register_msix(msix_vector, queue_irq_handler, q)) {
+		panic("virtio-blk: unable to register msi-x vector %u", msix_vector);
+	}
+
+	if (!transport_.setup_queue(*q->vq, msix_vector)) {
+		panic("virtio-blk: unable to set up queue %d", index);
+	}
+}
+
+void virtio_block_device::detect_partitions()
+{
+	mbr m(*this);
+	m.scan();
+}
+
+void virtio_block_device::submit_real_io_request(block_io_request &request)
+{
+	// The largest request is bounded by the data segments needed if no two pages of the buffer
+	// are physically contiguous.
+	const u64 max_blocks = ((max_segments_ - 1) * PAGE_SIZE) / 512;
+	if (request.block_count > max_blocks) {
+		split_request(request, max_blocks);
+		return;
+	}
+
+	page_table &pgt = request.pgt ? *request.pgt : *page_table::current();
+	request_queue &q = *queues_[core::this_core_id() % nr_queues_];
+
+	unique_irq_lock l(q.lock);
+
+	if (!q.pending.empty() || !issue_request(q, request, pgt)) {
+		// Either the queue is full, or earlier requests are still waiting for it -- the request is
+		// issued, after them, from the interrupt handler when space frees up.
+		q.pending.append({ &request, &pgt });
+	}
+}
+
+/**
+ * Places a request in a queue, as a chain of the request header, one descriptor per physically
+ * contiguous run of the buffer, and the status byte.  Returns false if the queue does not have
+ * enough free descriptors.  Must be called with the queue lock held.
+ */
+bool virtio_block_device::issue_request(request_queue &q, block_io_request &request, page_table &pgt)
+{
+	bool write = request.direction == block_io_request_direction::write;
+
+	virtq_buffer buffers[max_request_segments + 2];
+	int nr_buffers = 1;
+
+	u64 virt = (u64)request.buffer;
+	u64 length = request.block_count * 512;
+
+	while (length > 0) {
+		auto buffer_mapping = pgt.get_mapping(virt);
+		if (buffer_mapping.result == mapping_result::unmapped) {
+			panic("request buffer not mapped");
+		}
+
+		u64 phys = buffer_mapping.address;
+		u64 chunk = min(length, PAGE_SIZE - (virt & (PAGE_SIZE - 1)));
+
+		virtq_buffer *prev = &buffers[nr_buffers - 1];
+		if (nr_buffers > 1 && prev->address + prev->length == phys) {
+			// This page follows on physically from the previous segment, so just extend it.
+			prev->length += chunk;
+		} else {
+			buffers[nr_buffers++] = virtq_buffer { phys, (u32)chunk, !write };
+		}
+
+		virt += chunk;
+		length -= chunk;
+	}
+
+	if (q.vq->nr_free() < nr_buffers + 1) {
+		return false;
+	}
+
+	u16 head = q.vq->next_head();
+
+	volatile virtio_blk_req_header *hdr = &q.headers[head];
+	hdr->type = write ? virtio_blk_t_out : virtio_blk_t_in;
+	hdr->reserved = 0;
+	hdr->sector = request.start_block;
+
+	q.statuses[head] = 0xff;
+
+	buffers[0] = virtq_buffer { q.headers_phys + (head * sizeof(virtio_blk_req_header)), sizeof(virtio_blk_req_header), false };
+	buffers[nr_buffers++] = virtq_buffer { q.statuses_phys + head, 1, true };
+
+	q.requests[head] = &request;
+	q.vq->add_chain(buffers, nr_buffers);
+
+	if (q.vq->needs_notification()) {
+		transport_.notify(*q.vq);
+	}
+
+	return true;
+}
+
+void virtio_block_device::queue_irq_handler(u8 irq, void *ctx, void *arg)
+{
+	request_queue *q = (request_queue *)arg;
+	q->owner->handle_queue_interrupt(*q);
+
+	x86_core::this_core().lapic().eoi();
+}
+
+void virtio_block_device::handle_queue_interrupt(request_queue &q)
+{
+	block_io_request *completed[max_queue_size];
+	int nr_completed = 0;
+
+	{
+		unique_irq_lock l(q.lock);
+
+		u16 head;
+		u32 length;
+		while (q.vq->next_used(head, length)) {
+			if (q.statuses[head] != virtio_blk_s_ok) {
+				panic("virtio-blk: request failed, status=%u", q.statuses[head]);
+			}
+
+			completed[nr_completed++] = q.requests[head];
+			q.requests[head] = nullptr;
+		}
+
+		while (!q.pending.empty()) {
+			const pending_request &pending = q.pending.first();
+			if (!issue_request(q, *pending.request, *pending.pgt)) {
+				break;
+			}
+
+			q.pending.dequeue();
+		}
+	}
+
+	for (int i = 0; i < nr_completed; i++) {
+		completed[i]->callback(completed[i], completed[i]->cb_state);
+	}
+}
@@ -0,0 +1,148 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2025
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/debug.h>
+#include <stacsos/kernel/dev/virtio/virtio-pci-transport.h>
+#include <stacsos/kernel/dev/virtio/virtqueue.h>
+
+using namespace stacsos;
+using namespace stacsos::kernel::dev::pci;
+using namespace stacsos::kernel::dev::virtio;
+
+// The cfg_type field of a virtio PCI capability.
+enum virtio_pci_cap_type : u8 { common_cfg = 1, notify_cfg = 2, isr_cfg = 3, device_cfg = 4, pci_cfg = 5 };
+
+bool virtio_pci_transport::probe()
+{
+	auto &config = pcidev_.config();
+
+	for (auto cap : pcidev_.capabilities()) {
+		// Virtio structures are described by vendor-specific capabilities.
+		if (cap.vendor != 0x09) {
+			continue;
+		}
+
+		u8 type = config.read_config_value<u8>(cap.offset + 3);
+		u8 bar = config.read_config_value<u8>(cap.offset + 4);
+		u32 offset = config.read_config_value<u32>(cap.offset + 8);
+
+		if (bar > 5) {
+			continue;
+		}
+
+		uintptr_t address = (uintptr_t)phys_to_virt(pcidev_.bar_address(bar) + offset);
+
+		switch (type) {
+		case virtio_pci_cap_type::common_cfg:
+			if (!common_) {
+				common_ = (volatile virtio_pci_common_cfg *)address;
+			}
+			break;
+
+		case virtio_pci_cap_type::notify_cfg:
+			if (!notify_base_) {
+				notify_base_ = address;
+				notify_multiplier_ = config.read_config_value<u32>(cap.offset + 16);
+			}
+			break;
+
+		case virtio_pci_cap_type::device_cfg:
+			if (!device_cfg_) {
+				device_cfg_ = (volatile void *)address;
+			}
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	if (!common_ || !notify_base_ || !device_cfg_) {
+		return false;
+	}
+
+	pcidev_.enable_bus_mastering();
+	return true;
+}
+
+u64 virtio_pci_transport::initialise(u64 wanted)
+{
+	// Reset the device, and wait for it to acknowledge the reset.
+	common_->device_status = 0;
+	while (common_->device_status != 0) {
+		__relax();
+	}
+
+	common_->device_status = virtio_status::acknowledge;
+	common_->device_status = virtio_status::acknowledge | virtio_status::driver;
+
+	common_->device_feature_select = 0;
+	u64 offered = common_->device_feature;
+	common_->device_feature_select = 1;
+	offered |= (u64)common_->device_feature << 32;
+
+	u64 accepted = offered & (wanted | virtio_f_version_1);
+	if (!(accepted & virtio_f_version_1)) {
+		fail();
+		return 0;
+	}
+
+	common_->driver_feature_select = 0;
+	common_->driver_feature = (u32)accepted;
+	common_->driver_feature_select = 1;
+	common_->driver_feature = (u32)(accepted >> 32);
+
+	common_->device_status = common_->device_status | virtio_status::features_ok;
+	if (!(common_->device_status & virtio_status::features_ok)) {
+		fail();
+		return 0;
+	}
+
+	// No interrupts are wanted for configuration changes.
+	common_->config_msix_vector = no_vector;
+
+	return accepted;
+}
+
+u16 virtio_pci_transport::max_queue_size(u16 index)
+{
+	if (index >= common_->num_queues) {
+		return 0;
+	}
+
+	common_->queue_select = index;
+	return common_->queue_size;
+}
+
+bool virtio_pci_transport::setup_queue(virtqueue &vq, u16 msix_vector)
+{
+	if (vq.index() >= ARRAY_SIZE(notify_offsets_)) {
+		return false;
+	}
+
+	common_->queue_select = vq.index();
+	common_->queue_size = vq.size();
+
+	common_->queue_msix_vector = msix_vector;
+	if (common_->queue_msix_vector != msix_vector) {
+		return false;
+	}
+
+	common_->queue_desc = vq.desc_address();
+	common_->queue_driver = vq.avail_address();
+	common_->queue_device = vq.used_address();
+
+	notify_offsets_[vq.index()] = common_->queue_notify_off;
+
+	common_->queue_enable = 1;
+	return true;
+}
+
+void virtio_pci_transport::notify(const virtqueue &vq)
+{
+	*(volatile u16 *)(notify_base_ + (notify_offsets_[vq.index()] * notify_multiplier_)) = vq.index();
+}
@@ -0,0 +1,109 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2025
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/debug.h>
+#include <stacsos/kernel/dev/virtio/virtqueue.h>
+#include <stacsos/kernel/mem/memory-manager.h>
+
+using namespace stacsos;
+using namespace stacsos::kernel::dev::virtio;
+using namespace stacsos::kernel::mem;
+
+virtqueue::virtqueue(u16 index, u16 size)
+	: index_(index)
+	, size_(size)
+	, free_head_(0)
+	, nr_free_(size)
+	, last_used_(0)
+{
+	// The descriptor table is 16-byte aligned, the available ring 2-byte aligned, and the used
+	// ring 4-byte aligned.  Each ring ends with an event index field.
+	avail_offset_ = sizeof(virtq_desc) * size;
+	used_offset_ = (avail_offset_ + sizeof(virtq_avail) + (sizeof(u16) * (size + 1)) + 3) & ~3ull;
+
+	u64 total_size = used_offset_ + sizeof(virtq_used) + (sizeof(virtq_used_elem) * size) + sizeof(u16);
+
+	page *pages = memory_manager::get().pgalloc().allocate_pages(log2_ceil(PAGE_ALIGN_UP(total_size) >> PAGE_BITS), page_allocation_flags::zero);
+	if (!pages) {
+		panic("virtio: unable to allocate virtqueue");
+	}
+
+	base_ = pages->base_address();
+
+	desc_ = (volatile virtq_desc *)phys_to_virt(desc_address());
+	avail_ = (volatile virtq_avail *)phys_to_virt(avail_address());
+	used_ = (volatile virtq_used *)phys_to_virt(used_address());
+
+	// Thread every descriptor onto the free list.
+	for (u16 i = 0; i < size; i++) {
+		desc_[i].next = i + 1;
+	}
+}
+
+int virtqueue::add_chain(const virtq_buffer *buffers, int count)
+{
+	if (count == 0 || count > nr_free_) {
+		return -1;
+	}
+
+	u16 head = free_head_;
+	u16 cur = head;
+
+	for (int i = 0; i < count; i++) {
+		volatile virtq_desc *d = &desc_[cur];
+
+		d->addr = buffers[i].address;
+		d->len = buffers[i].length;
+		d->flags = (buffers[i].device_writable ? desc_f_write : 0) | (i + 1 < count ? desc_f_next : 0);
+
+		if (i + 1 < count) {
+			cur = d->next;
+		} else {
+			free_head_ = d->next;
+		}
+	}
+
+	nr_free_ -= count;
+
+	avail_->ring[avail_->idx % size_] = head;
+
+	// The ring entry must be visible to the device before the index that publishes it.
+	__sync_synchronize();
+	avail_->idx = avail_->idx + 1;
+	__sync_synchronize();
+
+	return head;
+}
+
+bool virtqueue::next_used(u16 &head, u32 &length)
+{
+	if (last_used_ == used_->idx) {
+		return false;
+	}
+
+	// Read the index before the ring entry it covers.
+	__sync_synchronize();
+
+	volatile virtq_used_elem *elem = &used_->ring[last_used_ % size_];
+	head = (u16)elem->id;
+	length = elem->len;
+	last_used_++;
+
+	// Return the chain to the free list.
+	u16 tail = head;
+	nr_free_++;
+
+	while (desc_[tail].flags & desc_f_next) {
+		tail = desc_[tail].next;
+		nr_free_++;
+	}
+
+	desc_[tail].next = free_head_;
+	free_head_ = head;
+
+	return true;
+}
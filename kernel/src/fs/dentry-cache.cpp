@@ -0,0 +1,184 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2025
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/fs/dentry-cache.h>
+#include <stacsos/kernel/fs/fs-node.h>
+#include <stacsos/memops.h>
+
+using namespace stacsos;
+using namespace stacsos::kernel::fs;
+
+/**
+ * Hashes a name together with its parent node.  Returns false if the name is too long to be
+ * cached.
+ */
+static bool hash_name(const fs_node *parent, const char *name, u32 &hash)
+{
+	if (memops::strlen(name) > dentry_cache::max_name_length) {
+		return false;
+	}
+
+	u64 h = hash_child_name(parent, name);
+	hash = (u32)(h ^ (h >> 32));
+	return true;
+}
+
+dentry_cache::dentry_cache()
+	: nr_used_(0)
+	, lru_head_(nullptr)
+	, lru_tail_(nullptr)
+	, hits_(0)
+	, misses_(0)
+{
+	memops::bzero(buckets_, sizeof(buckets_));
+}
+
+dentry_cache::entry *dentry_cache::find(const fs_node *parent, const char *name, u32 hash)
+{
+	for (entry *e = buckets_[hash & (nr_buckets - 1)]; e; e = e->hash_next) {
+		if (e->hash == hash && e->parent == parent && memops::strcmp(e->name, name) == 0) {
+			return e;
+		}
+	}
+
+	return nullptr;
+}
+
+void dentry_cache::remove(entry *e)
+{
+	entry **slot = &buckets_[e->hash & (nr_buckets - 1)];
+	while (*slot && *slot != e) {
+		slot = &(*slot)->hash_next;
+	}
+
+	if (*slot) {
+		*slot = e->hash_next;
+	}
+
+	lru_remove(e);
+
+	e->parent = nullptr;
+	e->hash_next = nullptr;
+}
+
+void dentry_cache::lru_insert(entry *e)
+{
+	e->lru_prev = nullptr;
+	e->lru_next = lru_head_;
+
+	if (lru_head_) {
+		lru_head_->lru_prev = e;
+	} else {
+		lru_tail_ = e;
+	}
+
+	lru_head_ = e;
+}
+
+void dentry_cache::lru_remove(entry *e)
+{
+	if (e->lru_prev) {
+		e->lru_prev->lru_next = e->lru_next;
+	} else {
+		lru_head_ = e->lru_next;
+	}
+
+	if (e->lru_next) {
+		e->lru_next->lru_prev = e->lru_prev;
+	} else {
+		lru_tail_ = e->lru_prev;
+	}
+
+	e->lru_prev = e->lru_next = nullptr;
+}
+
+bool dentry_cache::lookup(const fs_node *parent, const char *name, fs_node *&child)
+{
+	u32 hash;
+	if (!hash_name(parent, name, hash)) {
+		return false;
+	}
+
+	unique_irq_lock l(lock_);
+
+	entry *e = find(parent, name, hash);
+	if (!e) {
+		misses_++;
+		return false;
+	}
+
+	// Move the entry to the head of the LRU list.
+	if (e != lru_head_) {
+		lru_remove(e);
+		lru_insert(e);
+	}
+
+	hits_++;
+	child = e->child;
+	return true;
+}
+
+void dentry_cache::insert(const fs_node *parent, const char *name, fs_node *child)
+{
+	u32 hash;
+	if (!hash_name(parent, name, hash)) {
+		return;
+	}
+
+	unique_irq_lock l(lock_);
+
+	entry *e = find(parent, name, hash);
+	if (e) {
+		e->child = child;
+		return;
+	}
+
+	// Take an unused entry, or recycle the least recently used one.
+	if (nr_used_ < max_entries) {
+		e = &entries_[nr_used_++];
+	} else {
+		e = lru_tail_;
+		remove(e);
+	}
+
+	e->parent = parent;
+	e->child = child;
+	e->hash = hash;
+	memops::memcpy(e->name, name, memops::strlen(name) + 1);
+
+	e->hash_next = buckets_[hash & (nr_buckets - 1)];
+	buckets_[hash & (nr_buckets - 1)] = e;
+
+	lru_insert(e);
+}
+
+void dentry_cache::invalidate(const fs_node *parent, const char *name)
+{
+	u32 hash;
+	if (!hash_name(parent, name, hash)) {
+		return;
+	}
+
+	unique_irq_lock l(lock_);
+
+	entry *e = find(parent, name, hash);
+	if (e) {
+		// Leave the entry unreachable at the tail of the LRU list, so it is recycled first.
+		remove(e);
+
+		e->lru_prev = lru_tail_;
+		e->lru_next = nullptr;
+
+		if (lru_tail_) {
+			lru_tail_->lru_next = e;
+		} else {
+			lru_head_ = e;
+		}
+
+		lru_tail_ = e;
+	}
+}
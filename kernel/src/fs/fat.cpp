@@ -7,12 +7,20 @@
  */
 #include <stacsos/kernel/debug.h>
 #include <stacsos/kernel/dev/storage/block-device.h>
+#include <stacsos/kernel/fs/dentry-cache.h>
 #include <stacsos/kernel/fs/fat.h>
+#include <stacsos/kernel/sched/process.h>
+#include <stacsos/kernel/sched/thread.h>
 #include <stacsos/memops.h>
+#include <stacsos/syscalls.h>
 
 using namespace stacsos;
 using namespace stacsos::kernel::fs;
 
+// The default read-ahead window limits, in bytes.
+static const u64 default_readahead_min = 16 * 1024;
+static const u64 default_readahead_max = 256 * 1024;
+
 struct bios_parameter_block {
 	u8 code[3];
 	u8 oam_id[8];
@@ -75,13 +83,16 @@ void fat_filesystem::init()
 	}
 
 	const bios_parameter_block *bpb = (const bios_parameter_block *)&buffer[0];
+	const fat32_ebr *ebr32 = (const fat32_ebr *)&buffer[0x24];
 
-	// FAT metric computation
+	// FAT metric computation.  On FAT32 volumes, the FAT size is in the extended boot record, and
+	// there is no fixed root directory region.
 	total_sectors = bpb->total_sectors == 0 ? bpb->nr_large_sectors : bpb->total_sectors;
-	fat_size = bpb->sectors_per_fat;
+	nr_fats = bpb->nr_fats;
+	fat_size = bpb->sectors_per_fat == 0 ? ebr32->sectors_per_fat : bpb->sectors_per_fat;
 	root_dir_sectors = ((bpb->nr_root_dentries * 32) + (bpb->bytes_per_sector - 1)) / bpb->bytes_per_sector;
 	first_fat_sector = bpb->nr_reserved_sectors;
-	first_data_sector = first_fat_sector + (bpb->nr_fats * fat_size) + root_dir_sectors;
+	first_data_sector = first_fat_sector + (nr_fats * fat_size) + root_dir_sectors;
 	data_sectors = total_sectors - first_data_sector;
 	sectors_per_cluster = bpb->sectors_per_cluster;
 	total_clusters = data_sectors / sectors_per_cluster;
@@ -100,58 +111,274 @@ void fat_filesystem::init()
 		panic("FAT12 not supported");
 	} else if (total_clusters < 65525) {
 		dprintf("fat: fat16\n");
+		fat_type_ = 16;
 	} else {
-		panic("FAT32 not supported");
+		dprintf("fat: fat32\n");
+		fat_type_ = 32;
 	}
 
-	const fat12_ebr *ebr = (const fat12_ebr *)&buffer[0x24];
+	u8 signature;
+	const u8 *raw_volume_label;
+
+	if (fat_type_ == 32) {
+		signature = ebr32->signature;
+		raw_volume_label = ebr32->volume_label;
+	} else {
+		const fat12_ebr *ebr = (const fat12_ebr *)&buffer[0x24];
+
+		signature = ebr->signature;
+		raw_volume_label = ebr->volume_label;
+	}
 
-	if (ebr->signature != 0x29) {
+	// Both signature values are in use, the older one lacking the volume ID and label.
+	if (signature != 0x29 && signature != 0x28) {
 		panic("fat: invalid FAT signature");
 	}
 
-	dprintf("fat: signature=%2x\n", ebr->signature);
+	dprintf("fat: signature=%2x\n", signature);
+
+	char volume_label[12] = { 0 };
+	if (signature == 0x29) {
+		stacsos::memops::memcpy(volume_label, raw_volume_label, 11);
+	}
 
-	char volume_label[sizeof(ebr->volume_label) + 1] = { 0 };
-	stacsos::memops::memcpy(volume_label, ebr->volume_label, sizeof(ebr->volume_label));
 	dprintf("fat: volume-label=%s\n", volume_label);
 
-	root_.sector_ = first_data_sector - root_dir_sectors;
+	if (fat_type_ == 32) {
+		// The root directory is an ordinary cluster chain.
+		root_.cluster_ = ebr32->cluster_of_root_dir;
+		root_.sector_ = compute_sector_for_cluster(root_.cluster_);
+
+		if (ebr32->fs_info_sector != 0 && ebr32->fs_info_sector != 0xffff) {
+			fsinfo_offset_ = ebr32->fs_info_sector * 512;
+		}
+
+		dprintf("fat: root-cluster=%lu\n", root_.cluster_);
+	} else {
+		root_.sector_ = first_data_sector - root_dir_sectors;
+	}
+
+	load_fat();
 }
 
-shared_ptr<u8> fat_filesystem::read_cluster_from_sector(u64 sector)
+// FAT32 FSInfo sector layout.
+static const u32 fsinfo_lead_signature = 0x41615252;
+static const u32 fsinfo_struct_signature = 0x61417272;
+static const u64 fsinfo_struct_signature_offset = 484;
+static const u64 fsinfo_free_count_offset = 488;
+static const u64 fsinfo_next_free_offset = 492;
+
+void fat_filesystem::load_fat()
 {
-	shared_ptr<u8> buffer = shared_ptr<u8>(new u8[512 * sectors_per_cluster]);
+	// Only the first copy of the FAT is used.  FAT16 entries are widened to 32 bits, with the
+	// reserved and end-of-chain values mapped onto their FAT32 equivalents.  The top four bits of
+	// FAT32 entries are reserved, and are masked off.
+	u64 entry_size = fat_type_ == 32 ? sizeof(u32) : sizeof(u16);
 
-	bdev_.read_blocks_sync(buffer.get(), sector, sectors_per_cluster);
-	return buffer;
+	nr_fat_entries_ = min((fat_size * 512) / entry_size, total_clusters + 2);
+	fat_table_ = new u32[nr_fat_entries_];
+
+	if (fat_type_ == 32) {
+		bdev_.cache().read(fat_table_, first_fat_sector * 512, nr_fat_entries_ * sizeof(u32));
+
+		for (u64 cluster = 0; cluster < nr_fat_entries_; cluster++) {
+			fat_table_[cluster] &= 0x0fffffff;
+		}
+	} else {
+		u16 *fat16_table = new u16[nr_fat_entries_];
+		bdev_.cache().read(fat16_table, first_fat_sector * 512, nr_fat_entries_ * sizeof(u16));
+
+		for (u64 cluster = 0; cluster < nr_fat_entries_; cluster++) {
+			u32 entry = fat16_table[cluster];
+			fat_table_[cluster] = entry >= 0xfff7 ? (entry | 0x0fff0000) : entry;
+		}
+
+		delete[] fat16_table;
+	}
+
+	// Build the free-cluster bitmap.  The two reserved entries, and any bits past the end of the
+	// FAT, are marked as in use so that they are never allocated.
+	nr_bitmap_words_ = (nr_fat_entries_ + 63) / 64;
+	cluster_bitmap_ = new u64[nr_bitmap_words_];
+	memops::bzero(cluster_bitmap_, sizeof(u64) * nr_bitmap_words_);
+
+	u64 nr_free = 0;
+	for (u64 cluster = 0; cluster < nr_bitmap_words_ * 64; cluster++) {
+		if (cluster < 2 || cluster >= nr_fat_entries_ || fat_table_[cluster] != 0) {
+			cluster_bitmap_[cluster / 64] |= 1ull << (cluster % 64);
+		} else {
+			nr_free++;
+		}
+	}
+
+	nr_free_clusters_ = nr_free;
+	dprintf("fat: loaded %lu fat entries, %lu free clusters\n", nr_fat_entries_, nr_free);
+
+	// The FSInfo sector records where the last cluster was allocated, which is a good place to
+	// start looking for free clusters.  Its free count is only a hint, so the bitmap is trusted.
+	if (fsinfo_offset_) {
+		u32 signatures[2], next_free;
+		bdev_.cache().read(&signatures[0], fsinfo_offset_, sizeof(u32));
+		bdev_.cache().read(&signatures[1], fsinfo_offset_ + fsinfo_struct_signature_offset, sizeof(u32));
+		bdev_.cache().read(&next_free, fsinfo_offset_ + fsinfo_next_free_offset, sizeof(u32));
+
+		if (signatures[0] != fsinfo_lead_signature || signatures[1] != fsinfo_struct_signature) {
+			dprintf("fat: invalid fsinfo sector\n");
+			fsinfo_offset_ = 0;
+		} else if (next_free >= 2 && next_free < nr_fat_entries_) {
+			next_free_hint_ = next_free / 64;
+			last_allocated_cluster_ = next_free;
+		}
+	}
+}
+
+/**
+ * Writes the free cluster count and the allocation hint back to the FSInfo sector, if there is one.
+ */
+void fat_filesystem::update_fsinfo()
+{
+	if (!fsinfo_offset_) {
+		return;
+	}
+
+	// The hint must be a valid cluster number, or 0xffffffff if there is none.
+	u32 free_count = (u32)nr_free_clusters_;
+	u32 next_free = last_allocated_cluster_ >= 2 ? (u32)last_allocated_cluster_ : 0xffffffff;
+
+	bdev_.cache().write(&free_count, fsinfo_offset_ + fsinfo_free_count_offset, sizeof(u32));
+	bdev_.cache().write(&next_free, fsinfo_offset_ + fsinfo_next_free_offset, sizeof(u32));
 }
 
-u64 fat_filesystem::next_cluster(u64 this_cluster)
+/**
+ * Allocates a free cluster, and marks it as the end of a chain.  Returns zero if the volume is full.
+ */
+u64 fat_filesystem::allocate_cluster()
 {
-	u32 fat_offset = this_cluster * 2;
-	u32 fat_sector = first_fat_sector + (fat_offset / 512);
-	u32 entry_offset = fat_offset % 512;
+	for (u64 i = 0; i < nr_bitmap_words_; i++) {
+		u64 word_index = (next_free_hint_ + i) % nr_bitmap_words_;
+		u64 word = cluster_bitmap_[word_index];
+
+		if (word != ~0ull) {
+			u64 cluster = (word_index * 64) + __builtin_ctzll(~word);
+
+			next_free_hint_ = word_index;
+			last_allocated_cluster_ = cluster;
+			set_fat_entry(cluster, 0x0fffffff);
+
+			return cluster;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Updates an entry in the in-memory FAT and the free-cluster bitmap, and writes it to every copy
+ * of the FAT on the volume.
+ */
+void fat_filesystem::set_fat_entry(u64 cluster, u32 value)
+{
+	bool was_free = fat_table_[cluster] == 0;
+	fat_table_[cluster] = value;
+
+	if (value != 0) {
+		cluster_bitmap_[cluster / 64] |= 1ull << (cluster % 64);
+	} else {
+		cluster_bitmap_[cluster / 64] &= ~(1ull << (cluster % 64));
+	}
+
+	if (fat_type_ == 32) {
+		for (u64 fat = 0; fat < nr_fats; fat++) {
+			u64 entry_offset = ((first_fat_sector + (fat * fat_size)) * 512) + (cluster * sizeof(u32));
+
+			// The top four bits of the on-disk entry are reserved, and must be preserved.
+			u32 entry;
+			bdev_.cache().read(&entry, entry_offset, sizeof(u32));
+			entry = (entry & 0xf0000000) | (value & 0x0fffffff);
 
-	auto fat_table = read_cluster_from_sector(fat_sector);
-	u16 value = *(u16 *)&fat_table.get()[entry_offset];
+			bdev_.cache().write(&entry, entry_offset, sizeof(u32));
+		}
+	} else {
+		u16 entry = (u16)value;
+
+		for (u64 fat = 0; fat < nr_fats; fat++) {
+			bdev_.cache().write(&entry, ((first_fat_sector + (fat * fat_size)) * 512) + (cluster * sizeof(u16)), sizeof(u16));
+		}
+	}
+
+	if (was_free != (value == 0)) {
+		nr_free_clusters_ += value == 0 ? 1 : -1;
+		update_fsinfo();
+	}
+}
+
+/**
+ * Writes the first cluster and size of a node back to its directory entry.
+ */
+void fat_filesystem::update_dentry(const fat_node &node)
+{
+	if (!node.dentry_offset_) {
+		return;
+	}
+
+	u16 cluster_lo = (u16)node.cluster_;
+	u16 cluster_hi = (u16)(node.cluster_ >> 16);
+	u32 size = (u32)node.data_size_;
+
+	bdev_.cache().write(&cluster_hi, node.dentry_offset_ + 20, sizeof(cluster_hi));
+	bdev_.cache().write(&cluster_lo, node.dentry_offset_ + 26, sizeof(cluster_lo));
+	bdev_.cache().write(&size, node.dentry_offset_ + 28, sizeof(size));
+}
+
+shared_ptr<u8> fat_filesystem::read_cluster_from_sector(u64 sector)
+{
+	shared_ptr<u8> buffer = shared_ptr<u8>(new u8[512 * sectors_per_cluster]);
 
-	return value;
+	bdev_.cache().read(buffer.get(), sector * 512, 512 * sectors_per_cluster);
+	return buffer;
 }
 
 fs_node *fat_node::mkdir(const char *name)
 {
 	auto new_dir = new fat_node(fs(), this, fs_node_kind::directory, string(name), 0, 0, 0);
-	children_.append(new_dir);
+	add_child(new_dir);
+
+	dentry_cache::get().invalidate(this, name);
 
 	return new_dir;
 }
 
 fs_node *fat_node::resolve_child(const string &name)
 {
-	load();
+	// Search the entries parsed so far, and only parse more of the directory if the name has not
+	// been seen yet.
+	while (true) {
+		fat_node *child = find_child(name);
+		if (child || loaded_) {
+			return child;
+		}
 
-	for (auto child : children_) {
+		load_next_chunk();
+	}
+}
+
+fs_node *fat_node::child_at(u64 index)
+{
+	// As with lookups, the directory is only parsed as far as the requested child.
+	while (index >= nr_children_ && !loaded_) {
+		load_next_chunk();
+	}
+
+	return index < nr_children_ ? children_[index] : nullptr;
+}
+
+fat_node *fat_node::find_child(const string &name) const
+{
+	if (!index_size_) {
+		return nullptr;
+	}
+
+	for (fat_node *child = index_[name.get_hash() & (index_size_ - 1)]; child; child = child->index_next_) {
 		if (child->name() == name) {
 			return child;
 		}
@@ -160,73 +387,152 @@ fs_node *fat_node::resolve_child(const string &name)
 	return nullptr;
 }
 
-void fat_node::load()
+void fat_node::add_child(fat_node *child)
 {
-	if (loaded_) {
-		return;
+	if (nr_children_ == children_capacity_) {
+		children_capacity_ = children_capacity_ ? children_capacity_ * 2 : 16;
+
+		fat_node **new_children = new fat_node *[children_capacity_];
+		memops::memcpy(new_children, children_, sizeof(fat_node *) * nr_children_);
+
+		delete[] children_;
+		children_ = new_children;
 	}
 
-	fat_filesystem &fatfs = ((fat_filesystem &)fs());
+	// Keep the index at least as large as the number of children, rehashing as it grows.
+	if (nr_children_ >= index_size_) {
+		u64 new_size = index_size_ ? index_size_ * 2 : 16;
 
-	u64 this_cluster = cluster_;
+		fat_node **new_index = new fat_node *[new_size];
+		memops::bzero(new_index, sizeof(fat_node *) * new_size);
 
-	do {
-		// Read in the current cluster data.
-		auto cluster_data = fatfs.read_cluster(this_cluster);
+		for (u64 i = 0; i < nr_children_; i++) {
+			u64 bucket = children_[i]->name().get_hash() & (new_size - 1);
+			children_[i]->index_next_ = new_index[bucket];
+			new_index[bucket] = children_[i];
+		}
 
-		// Parse dentries from this cluster
-		bool has_long_filename = false;
-		string long_filename;
+		delete[] index_;
+		index_ = new_index;
+		index_size_ = new_size;
+	}
 
-		for (const u8 *dentry = &(cluster_data.get())[0]; dentry < &(cluster_data.get())[512 * fatfs.sectors_per_cluster]; dentry += 32) {
-			if (dentry[0] == 0) {
-				// No more files in this directory.
-				break;
-			} else if (dentry[0] == 0xe5) {
-				// Entry is unused -- ignore.
-				continue;
-			}
+	u64 bucket = child->name().get_hash() & (index_size_ - 1);
+	child->index_next_ = index_[bucket];
+	index_[bucket] = child;
 
-			if (dentry[11] == 0x0f) {
-				has_long_filename = true;
+	children_[nr_children_++] = child;
+}
 
-				string lfn_chunk;
+/**
+ * The state of a partially parsed directory.  A long filename may be split across clusters, so it
+ * is assembled here rather than on the stack.
+ */
+struct fat_node::load_state {
+	u64 next; // the next cluster to parse or, for the root directory, the next sector
+	char lfn[256];
+	int lfn_length; // the length of the pending long filename, or -1 if there isn't one
+};
 
-				bool stop = false;
-				for (int i = 1; i < 11; i += 2) {
-					if (dentry[i] == 0) {
-						stop = true;
-						break;
-					}
+fat_node::~fat_node()
+{
+	delete load_;
+	delete[] children_;
+	delete[] index_;
+	delete[] extents_;
+}
 
-					lfn_chunk += dentry[i];
-				}
+// The offsets of the 13 (UCS-2) characters held in a long filename entry.
+static const u8 lfn_char_offsets[] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
 
-				if (!stop) {
-					for (int i = 14; i < 26; i += 2) {
-						if (dentry[i] == 0) {
-							stop = true;
-							break;
-						}
-						lfn_chunk += dentry[i];
-					}
-				}
+/**
+ * Copies the characters of a long filename entry into place in the pending long filename.
+ */
+void fat_node::parse_lfn_entry(const u8 *dentry)
+{
+	int sequence = dentry[0] & 0x1f;
 
-				if (!stop) {
-					for (int i = 28; i < 32; i += 2) {
-						if (dentry[i] == 0) {
-							stop = true;
-							break;
-						}
-						lfn_chunk += dentry[i];
-					}
-				}
+	// The entry holding the end of the name comes first, and determines the name's length.
+	if (dentry[0] & 0x40) {
+		load_->lfn_length = min(sequence * 13, (int)sizeof(load_->lfn) - 1);
+	}
 
-				long_filename = lfn_chunk + long_filename;
-				continue;
-			}
+	if (load_->lfn_length < 0 || sequence == 0) {
+		return;
+	}
+
+	int base = (sequence - 1) * 13;
+	for (int i = 0; i < 13 && base + i < load_->lfn_length; i++) {
+		u8 ch = dentry[lfn_char_offsets[i]];
+		if (ch == 0) {
+			load_->lfn_length = base + i;
+			break;
+		}
+
+		load_->lfn[base + i] = ch;
+	}
+}
 
-			char short_filename[12] = { 0 };
+/**
+ * Parses the next cluster of directory entries (or, for the root directory, the next cluster-sized
+ * run of sectors), adding them to the children of this node.
+ */
+void fat_node::load_next_chunk()
+{
+	fat_filesystem &fatfs = ((fat_filesystem &)fs());
+	// The FAT16 root directory is a fixed region of sectors, rather than a cluster chain.
+	bool fixed_root = this == &fatfs.root_ && fatfs.fat_type_ != 32;
+
+	if (!load_) {
+		// A directory without any clusters (e.g. one created with mkdir) has no entries on disk.
+		if (!fixed_root && cluster_ < 2) {
+			loaded_ = true;
+			return;
+		}
+
+		load_ = new load_state;
+		load_->next = fixed_root ? sector_ : cluster_;
+		load_->lfn_length = -1;
+	}
+
+	u64 chunk_sector, nr_sectors;
+	if (fixed_root) {
+		chunk_sector = load_->next;
+		nr_sectors = min(fatfs.sectors_per_cluster, (sector_ + fatfs.root_dir_sectors) - chunk_sector);
+	} else {
+		chunk_sector = fatfs.compute_sector_for_cluster(load_->next);
+		nr_sectors = fatfs.sectors_per_cluster;
+	}
+
+	auto data = fatfs.read_cluster_from_sector(chunk_sector);
+	const u8 *start = data.get();
+
+	bool end = false;
+	for (const u8 *dentry = start; dentry < start + (nr_sectors * 512); dentry += 32) {
+		if (dentry[0] == 0) {
+			// No more files in this directory.
+			end = true;
+			break;
+		} else if (dentry[0] == 0xe5) {
+			// Entry is unused -- ignore, along with any long filename preceding it.
+			load_->lfn_length = -1;
+			continue;
+		}
+
+		if (dentry[11] == 0x0f) {
+			parse_lfn_entry(dentry);
+			continue;
+		}
+
+		char short_filename[12] = { 0 };
+		const char *filename = short_filename;
+
+		if (load_->lfn_length >= 0) {
+			load_->lfn[load_->lfn_length] = 0;
+			load_->lfn_length = -1;
+
+			filename = load_->lfn;
+		} else {
 			memops::memcpy(short_filename, dentry, 11);
 			for (int i = 0; i < 11; i++) {
 				if (short_filename[i] == 0x20) {
@@ -235,90 +541,438 @@ void fat_node::load()
 					short_filename[i] |= 0x20;
 				}
 			}
+		}
 
-			string filename;
-			if (has_long_filename) {
-				filename = long_filename;
-				has_long_filename = false;
-				long_filename = string();
-			} else {
-				filename = string(short_filename);
-			}
+		u32 cluster = ((u32) * ((u16 *)&dentry[26])) | (((u32) * ((u16 *)&dentry[20])) << 16);
+		u64 sector = ((cluster - 2) * fatfs.sectors_per_cluster) + fatfs.first_data_sector;
+		u64 size = *(u32 *)&dentry[28];
+		u64 dentry_offset = (chunk_sector * 512) + (dentry - start);
 
-			u32 cluster = ((u32) * ((u16 *)&dentry[26])) | (((u32) * ((u16 *)&dentry[20])) << 16);
-			u64 sector = ((cluster - 2) * fatfs.sectors_per_cluster) + fatfs.first_data_sector;
-			u64 size = *(u32 *)&dentry[28];
+		auto child = new fat_node(
+			fs(), this, (dentry[11] & 0x10) ? fs_node_kind::directory : fs_node_kind::file, string(filename), sector, cluster, size, dentry_offset);
 
-			children_.append(new fat_node(fs(), this, (dentry[11] & 0x10) ? fs_node_kind::directory : fs_node_kind::file, filename, sector, cluster, size));
-		}
+		add_child(child);
+	}
 
-		this_cluster = fatfs.next_cluster(this_cluster);
-		if (this_cluster >= 0xfff8) {
-			// No more clusters.
-			break;
+	if (!end) {
+		if (fixed_root) {
+			load_->next += nr_sectors;
+			end = load_->next >= sector_ + fatfs.root_dir_sectors;
+		} else {
+			load_->next = fatfs.next_cluster(load_->next);
+			end = fat_filesystem::is_end_of_chain(load_->next);
 		}
-	} while (true);
+	}
 
-	loaded_ = true;
+	if (end) {
+		delete load_;
+		load_ = nullptr;
+		loaded_ = true;
+	}
 }
 
-void fat_file::read_cluster_list(u64 first_cluster, u64 file_size)
+fat_file::fat_file(fat_filesystem &fs, fat_node &node)
+	: file(node.data_size_)
+	, fs_(fs)
+	, node_(node)
+	, ra_prev_end_(0)
+	, ra_start_(0)
+	, ra_end_(0)
+	, ra_hits_(0)
+	, ra_misses_(0)
+	, ra_batch_misses_(0)
+	, direct_io_(false)
 {
 	u64 cluster_size = (512 * fs_.sectors_per_cluster);
-	nr_clusters_ = (file_size + (cluster_size - 1)) / cluster_size;
 
-	clusters_ = new u64[nr_clusters_];
+	ra_min_window_ = max(default_readahead_min / cluster_size, 1ull);
+	ra_max_window_ = max(default_readahead_max / cluster_size, ra_min_window_);
+	ra_window_ = ra_min_window_;
+}
 
-	u64 this_cluster = first_cluster;
-	for (int i = 0; i < nr_clusters_; i++) {
-		if (this_cluster >= 0xFFF8) {
-			dprintf("fat: warning: not enough clusters for reported file size\n");
-			nr_clusters_ = i - 1;
-			break;
+/**
+ * Sets up an empty extent map on first use.  The cluster size is not known until the filesystem
+ * has been mounted, so this cannot be done when the node is created.
+ */
+void fat_node::init_extents()
+{
+	if (extents_ready_) {
+		return;
+	}
+
+	u64 cluster_size = (512 * ((fat_filesystem &)fs()).sectors_per_cluster);
+	nr_clusters_ = (data_size_ + (cluster_size - 1)) / cluster_size;
+	next_chain_cluster_ = cluster_;
+	extents_ready_ = true;
+}
+
+void fat_node::append_extent(u64 file_cluster, u64 first_cluster)
+{
+	// Extend the last extent, if this cluster follows on from it.
+	if (nr_extents_ > 0) {
+		fat_extent &last = extents_[nr_extents_ - 1];
+		if (last.first_cluster + last.length == first_cluster) {
+			last.length++;
+			return;
 		}
+	}
+
+	if (nr_extents_ == extents_capacity_) {
+		extents_capacity_ = extents_capacity_ ? extents_capacity_ * 2 : 4;
 
-		clusters_[i] = this_cluster;
-		this_cluster = fs_.next_cluster(this_cluster);
+		fat_extent *new_extents = new fat_extent[extents_capacity_];
+		memops::memcpy(new_extents, extents_, sizeof(fat_extent) * nr_extents_);
+
+		delete[] extents_;
+		extents_ = new_extents;
 	}
+
+	extents_[nr_extents_++] = { file_cluster, first_cluster, 1 };
+}
+
+/**
+ * Follows the cluster chain until the extent map covers the given file cluster.
+ */
+bool fat_node::map_extents_to(u64 file_cluster)
+{
+	init_extents();
+
+	while (mapped_clusters_ <= file_cluster) {
+		if (mapped_clusters_ >= nr_clusters_ || fat_filesystem::is_end_of_chain(next_chain_cluster_)) {
+			if (mapped_clusters_ < nr_clusters_) {
+				dprintf("fat: warning: not enough clusters for reported file size\n");
+				nr_clusters_ = mapped_clusters_;
+			}
+
+			return false;
+		}
+
+		append_extent(mapped_clusters_++, next_chain_cluster_);
+		next_chain_cluster_ = ((fat_filesystem &)fs()).next_cluster(next_chain_cluster_);
+	}
+
+	return true;
+}
+
+const fat_extent *fat_node::find_extent(u64 file_cluster)
+{
+	if (!map_extents_to(file_cluster)) {
+		return nullptr;
+	}
+
+	u64 lo = 0, hi = nr_extents_;
+	while (hi - lo > 1) {
+		u64 mid = (lo + hi) / 2;
+		if (extents_[mid].file_cluster <= file_cluster) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return &extents_[lo];
 }
 
 size_t fat_file::pread(void *buffer, size_t offset, size_t length)
 {
 	u64 cluster_size = (512 * fs_.sectors_per_cluster);
-	u64 target_cluster_index = offset / cluster_size;
-	u64 target_cluster_offset = offset % cluster_size;
+	u8 *buffer_pos = (u8 *)buffer;
 
-	u64 this_cluster = clusters_[target_cluster_index++];
+	if (length == 0) {
+		return 0;
+	}
 
-	u8 *buffer_pos = (u8 *)buffer;
+	// Map the whole range up front, so that contiguous runs can be read in as few requests as
+	// possible.
+	node_.map_extents_to((offset + length - 1) / cluster_size);
+
+	if (!direct_io_) {
+		readahead(offset, length);
+	}
 
 	u64 remaining_length = length;
 	while (remaining_length > 0) {
-		u64 read_length = ((target_cluster_offset + remaining_length) > cluster_size) ? (cluster_size - target_cluster_offset) : remaining_length;
+		u64 file_cluster = offset / cluster_size;
+
+		const fat_extent *extent = node_.find_extent(file_cluster);
+		if (!extent) {
+			// No further clusters -- we're past the end of the file data.
+			break;
+		}
 
-		auto cluster_data = fs_.read_cluster(this_cluster);
+		// Read as much as possible from this run of contiguous clusters in one go.
+		u64 extent_offset = offset - (extent->file_cluster * cluster_size);
+		u64 read_length = min(remaining_length, (extent->length * cluster_size) - extent_offset);
+
+		u64 device_offset = (fs_.compute_sector_for_cluster(extent->first_cluster) * 512) + extent_offset;
+
+		// In direct mode, the whole sectors go straight to the caller, and only a partial sector
+		// at the end (i.e. at the end of the file) goes through the cache.
+		u64 direct_length = direct_io_ && (device_offset % 512) == 0 ? read_length & ~511ull : 0;
+		if (direct_length && read_direct(buffer_pos, device_offset, direct_length)) {
+			buffer_pos += direct_length;
+			offset += direct_length;
+			remaining_length -= direct_length;
+			read_length -= direct_length;
+			device_offset += direct_length;
+		}
 
-		memops::memcpy(buffer_pos, cluster_data.get() + target_cluster_offset, read_length);
+		fs_.bdev_.cache().read(buffer_pos, device_offset, read_length);
 
 		buffer_pos += read_length;
+		offset += read_length;
 		remaining_length -= read_length;
+	}
+
+	return length - remaining_length;
+}
 
-		// Break early if we're done, so we don't unnecessarily traverse the FAT
-		if (remaining_length == 0) {
+/**
+ * Starts reading the given range of file clusters into the block cache in the background.
+ */
+void fat_file::prefetch_clusters(u64 first_cluster, u64 end_cluster)
+{
+	u64 blocks_per_cluster = fs_.sectors_per_cluster;
+
+	while (first_cluster < end_cluster) {
+		const fat_extent *extent = node_.find_extent(first_cluster);
+		if (!extent) {
 			break;
 		}
 
-		// Locate the next cluter in this chain
-		if (target_cluster_index >= nr_clusters_) {
-			// No further clusters -- we're past the end of the file data.
+		u64 extent_index = first_cluster - extent->file_cluster;
+		u64 nr_clusters = min(extent->length - extent_index, end_cluster - first_cluster);
+
+		fs_.bdev_.cache().prefetch(fs_.compute_sector_for_cluster(extent->first_cluster + extent_index), nr_clusters * blocks_per_cluster);
+		first_cluster += nr_clusters;
+	}
+}
+
+/**
+ * Detects sequential reads, and keeps a window of clusters ahead of the reader in flight.  The
+ * window doubles when the previous batch of read-ahead served every read since it was issued, and
+ * halves when reads still had to wait for the device (or the reader seeked elsewhere).
+ */
+void fat_file::readahead(u64 offset, u64 length)
+{
+	if (ra_max_window_ == 0 || length == 0) {
+		return;
+	}
+
+	u64 cluster_size = (512 * fs_.sectors_per_cluster);
+	u64 first = offset / cluster_size;
+	u64 last = (offset + length - 1) / cluster_size;
+
+	bool sequential = offset == ra_prev_end_;
+	ra_prev_end_ = offset + length;
+
+	if (first >= ra_start_ && last < ra_end_) {
+		ra_hits_++;
+	} else {
+		ra_misses_++;
+		ra_batch_misses_++;
+	}
+
+	if (!sequential) {
+		// Whatever was read ahead is probably wasted -- start again from here on the next read.
+		ra_window_ = max(ra_window_ / 2, ra_min_window_);
+		ra_start_ = ra_end_ = last + 1;
+		ra_batch_misses_ = 0;
+		return;
+	}
+
+	// Issue the next batch once the reader is within half a window of the end of the last one.
+	if (last + 1 + (ra_window_ / 2) < ra_end_) {
+		return;
+	}
+
+	if (ra_batch_misses_ == 0) {
+		ra_window_ = min(ra_window_ * 2, ra_max_window_);
+	} else {
+		ra_window_ = max(ra_window_ / 2, ra_min_window_);
+	}
+
+	ra_batch_misses_ = 0;
+
+	u64 from = max(ra_end_, first);
+	u64 to = min(last + 1 + ra_window_, node_.nr_clusters_);
+	if (from >= to) {
+		return;
+	}
+
+	if (ra_end_ < first) {
+		ra_start_ = first;
+	}
+
+	node_.map_extents_to(to - 1);
+	prefetch_clusters(from, to);
+
+	ra_end_ = to;
+}
+
+/**
+ * Reads whole sectors from the device straight into a user buffer.  Returns false if the buffer
+ * is unsuitable (e.g. it is in kernel memory), in which case the caller should use the cache.
+ */
+bool fat_file::read_direct(void *buffer, u64 device_offset, u64 length)
+{
+	auto &as = sched::thread::current().owner().addrspace();
+	return fs_.bdev_.read_blocks_direct(as, buffer, device_offset / 512, length / 512);
+}
+
+u64 fat_file::ioctl(u64 cmd, void *buffer, size_t length)
+{
+	u64 cluster_size = (512 * fs_.sectors_per_cluster);
+
+	switch ((file_ioctl_cmd)cmd) {
+	case file_ioctl_cmd::get_readahead: {
+		if (length < sizeof(readahead_params)) {
+			return 0;
+		}
+
+		readahead_params *params = (readahead_params *)buffer;
+		params->min_window = ra_min_window_ * cluster_size;
+		params->max_window = ra_max_window_ * cluster_size;
+		params->window = ra_window_ * cluster_size;
+		params->hits = ra_hits_;
+		params->misses = ra_misses_;
+
+		return sizeof(readahead_params);
+	}
+
+	case file_ioctl_cmd::set_readahead: {
+		if (length < sizeof(readahead_params)) {
+			return 0;
+		}
+
+		const readahead_params *params = (const readahead_params *)buffer;
+
+		ra_max_window_ = (params->max_window + (cluster_size - 1)) / cluster_size;
+		ra_min_window_ = min(max(params->min_window / cluster_size, 1ull), max(ra_max_window_, 1ull));
+		ra_window_ = ra_min_window_;
+
+		return 1;
+	}
+
+	case file_ioctl_cmd::enable_direct_io:
+		direct_io_ = true;
+		return 1;
+
+	case file_ioctl_cmd::disable_direct_io:
+		direct_io_ = false;
+		return 1;
+
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Extends the cluster chain until the file has at least the given number of clusters, first
+ * reusing any clusters left on the chain beyond the end of the file, and then allocating new ones.
+ * Returns the resulting number of clusters, which is smaller if the volume fills up.
+ */
+u64 fat_node::grow_to(u64 nr_clusters)
+{
+	fat_filesystem &fatfs = ((fat_filesystem &)fs());
+
+	init_extents();
+	if (nr_clusters_ > 0) {
+		map_extents_to(nr_clusters_ - 1);
+	}
+
+	while (nr_clusters_ < nr_clusters) {
+		u64 cluster = next_chain_cluster_;
+
+		if (fat_filesystem::is_end_of_chain(cluster)) {
+			cluster = fatfs.allocate_cluster();
+			if (!cluster) {
+				dprintf("fat: volume full\n");
+				break;
+			}
+
+			if (nr_extents_ == 0) {
+				cluster_ = cluster;
+			} else {
+				const fat_extent &last = extents_[nr_extents_ - 1];
+				fatfs.set_fat_entry(last.first_cluster + last.length - 1, cluster);
+			}
+		}
+
+		append_extent(nr_clusters_++, cluster);
+		mapped_clusters_++;
+
+		next_chain_cluster_ = fatfs.next_cluster(cluster);
+	}
+
+	return nr_clusters_;
+}
+
+void fat_file::write_data(const void *buffer, u64 offset, u64 length)
+{
+	u64 cluster_size = (512 * fs_.sectors_per_cluster);
+	const u8 *buffer_pos = (const u8 *)buffer;
+
+	while (length > 0) {
+		const fat_extent *extent = node_.find_extent(offset / cluster_size);
+		if (!extent) {
 			break;
 		}
 
-		this_cluster = clusters_[target_cluster_index++];
-		target_cluster_offset = 0; // Start at the beginning of the next cluster.
+		u64 extent_offset = offset - (extent->file_cluster * cluster_size);
+		u64 write_length = min(length, (extent->length * cluster_size) - extent_offset);
+
+		u64 device_offset = (fs_.compute_sector_for_cluster(extent->first_cluster) * 512) + extent_offset;
+		fs_.bdev_.cache().write(buffer_pos, device_offset, write_length);
+
+		buffer_pos += write_length;
+		offset += write_length;
+		length -= write_length;
 	}
+}
 
-	return length - remaining_length;
+size_t fat_file::pwrite(const void *buffer, size_t offset, size_t length)
+{
+	u64 cluster_size = (512 * fs_.sectors_per_cluster);
+
+	if (length == 0) {
+		return 0;
+	}
+
+	// The largest file FAT can describe is 4 GB - 1.
+	u64 end = min((u64)offset + length, 0xffffffffull);
+
+	u64 first_cluster = node_.cluster_;
+	u64 nr_clusters = node_.grow_to((end + (cluster_size - 1)) / cluster_size);
+
+	// If the volume filled up, write as much as fits.
+	end = min(end, nr_clusters * cluster_size);
+	if (end <= offset) {
+		return 0;
+	}
+
+	// Any gap between the old end of the file and the start of this write must read back as zero.
+	u64 size = node_.data_size_;
+	if (offset > size) {
+		u8 zeros[512];
+		memops::bzero(zeros, sizeof(zeros));
+
+		for (u64 gap = size; gap < offset; gap += sizeof(zeros)) {
+			write_data(zeros, gap, min((u64)sizeof(zeros), offset - gap));
+		}
+	}
+
+	write_data(buffer, offset, end - offset);
+
+	if (end > size || node_.cluster_ != first_cluster) {
+		node_.data_size_ = max(size, end);
+
+		fs_.update_dentry(node_);
+	}
+
+	return end - offset;
 }
 
-size_t fat_file::pwrite(const void *buffer, size_t offset, size_t length) { return 0; }
\ No newline at end of file
+u64 fat_file::size() const { return node_.data_size_; }
+
+void fat_file::fsync() { fs_.bdev_.cache().flush(); }
\ No newline at end of file
@@ -6,6 +6,7 @@
  * Tom Spink <tcs6@st-andrews.ac.uk>
  */
 #include <stacsos/kernel/debug.h>
+#include <stacsos/kernel/fs/dentry-cache.h>
 #include <stacsos/kernel/fs/filesystem.h>
 #include <stacsos/kernel/fs/fs-node.h>
 
@@ -38,7 +39,14 @@ fs_node *fs_node::lookup(const char *path)
 		}
 		child_name[index] = 0;
 
-		auto *child = resolve_child(child_name);
+		fs_node *child;
+		if (!dentry_cache::get().lookup(this, child_name, child)) {
+			child = resolve_child(child_name);
+			if (child || cache_missing_children()) {
+				dentry_cache::get().insert(this, child_name, child);
+			}
+		}
+
 		if (child) {
 			if (*path == '\0') {
 				return child;
@@ -7,30 +7,106 @@
  */
 #include <stacsos/kernel/debug.h>
 #include <stacsos/kernel/dev/storage/block-device.h>
+#include <stacsos/kernel/fs/dentry-cache.h>
 #include <stacsos/kernel/fs/tar-filesystem.h>
+#include <stacsos/kernel/mem/memory-manager.h>
+#include <stacsos/kernel/sched/process.h>
+#include <stacsos/kernel/sched/thread.h>
 #include <stacsos/memops.h>
 
 using namespace stacsos;
+using namespace stacsos::kernel;
 using namespace stacsos::kernel::fs;
+using namespace stacsos::kernel::dev::storage;
+
+// Headers are read from the device in batches of this many blocks at mount.
+static const u64 load_batch_blocks = 128;
 
 fs_node *tarfs_node::resolve_child(const string &name)
 {
 	// dprintf("tarfs: resolve child %s\n", name.c_str());
 
-	for (auto *child : children_) {
-		if (child->name() == name) {
-			return child;
+	return ((tar_filesystem &)fs()).find_node(this, name.c_str());
+}
+
+fs_node *tarfs_node::mkdir(const char *name)
+{
+	// dprintf("tarfs: mkdir %s\n", name);
+
+	dentry_cache::get().invalidate(this, name);
+	return add_child(name, fs_node_kind::directory, 0, 0);
+}
+
+tarfs_node *tarfs_node::add_child(const char *name, fs_node_kind kind, u64 data_start, u64 data_size)
+{
+	auto *node = new tarfs_node(fs(), this, kind, string(name), data_start, data_size);
+
+	if (nr_children_ == children_capacity_) {
+		children_capacity_ = children_capacity_ ? children_capacity_ * 2 : 16;
+
+		tarfs_node **new_children = new tarfs_node *[children_capacity_];
+		memops::memcpy(new_children, children_, sizeof(tarfs_node *) * nr_children_);
+
+		delete[] children_;
+		children_ = new_children;
+	}
+
+	children_[nr_children_++] = node;
+
+	node->index_hash_ = hash_child_name(this, name);
+	((tar_filesystem &)fs()).index_node(node);
+
+	return node;
+}
+
+tarfs_node *tar_filesystem::find_node(const tarfs_node *parent, const char *name) const
+{
+	if (!index_size_) {
+		return nullptr;
+	}
+
+	u64 hash = hash_child_name(parent, name);
+	for (tarfs_node *node = index_[hash & (index_size_ - 1)]; node; node = node->index_next_) {
+		if (node->index_hash_ == hash && node->parent() == parent && memops::strcmp(node->name().c_str(), name) == 0) {
+			return node;
 		}
 	}
 
 	return nullptr;
 }
 
-fs_node *tarfs_node::mkdir(const char *name)
+void tar_filesystem::index_node(tarfs_node *node)
 {
-	// dprintf("tarfs: mkdir %s\n", name);
+	// Keep the index at least as large as the number of nodes, rehashing as it grows.
+	if (nr_indexed_ >= index_size_) {
+		u64 new_size = index_size_ ? index_size_ * 2 : 64;
+
+		tarfs_node **new_index = new tarfs_node *[new_size];
+		memops::bzero(new_index, sizeof(tarfs_node *) * new_size);
+
+		for (u64 i = 0; i < index_size_; i++) {
+			tarfs_node *existing = index_[i];
+			while (existing) {
+				tarfs_node *next = existing->index_next_;
 
-	return add_child(string(name), fs_node_kind::directory, 0, 0);
+				u64 bucket = existing->index_hash_ & (new_size - 1);
+				existing->index_next_ = new_index[bucket];
+				new_index[bucket] = existing;
+
+				existing = next;
+			}
+		}
+
+		delete[] index_;
+		index_ = new_index;
+		index_size_ = new_size;
+	}
+
+	u64 bucket = node->index_hash_ & (index_size_ - 1);
+	node->index_next_ = index_[bucket];
+	index_[bucket] = node;
+
+	nr_indexed_++;
 }
 
 size_t parse_octal(const char *str, size_t maxlen)
@@ -46,14 +122,28 @@ size_t parse_octal(const char *str, size_t maxlen)
 
 void tar_filesystem::load_tree()
 {
-	char buffer[512];
+	u8 *batch = image_ ? nullptr : new u8[load_batch_blocks * 512];
+	u64 batch_start = 0, batch_count = 0;
 
 	u64 current_block = 0;
 	u64 last_block = bdev_.nr_blocks();
 	while (current_block < last_block) {
-		bdev_.read_blocks_sync(buffer, current_block, 1);
+		// Headers are read straight from the image if it is in memory.  Otherwise, the next batch of
+		// blocks is read from the device if this header isn't in the current one -- the data
+		// blocks of large files are skipped over without being read.
+		const tar_file_header *header;
+		if (image_) {
+			header = (const tar_file_header *)&image_[current_block * 512];
+		} else if (current_block >= batch_start + batch_count) {
+			batch_start = current_block;
+			batch_count = min(load_batch_blocks, last_block - current_block);
+
+			bdev_.read_blocks_sync(batch, batch_start, batch_count);
+			header = (const tar_file_header *)batch;
+		} else {
+			header = (const tar_file_header *)&batch[(current_block - batch_start) * 512];
+		}
 
-		const tar_file_header *header = (const tar_file_header *)buffer;
 		if (header->file_path[0] == 0) {
 			break;
 		}
@@ -67,75 +157,138 @@ void tar_filesystem::load_tree()
 		// Skip the file data blocks
 		current_block += (((size + 511) >> 9));
 	}
+
+	delete[] batch;
 }
 
 void tar_filesystem::register_file(const tar_file_header *header, u64 data_block_start, u64 data_size)
 {
-	const char *root_relative_name = &header->file_path[2];
-	if (*root_relative_name == 0) {
-		return;
-	}
+	// The path field is not necessarily null-terminated, so take a copy that is.  Components are
+	// then split off in place.
+	char path[sizeof(header->file_path) + 1];
+	memops::memcpy(path, header->file_path, sizeof(header->file_path));
+	path[sizeof(header->file_path)] = 0;
 
-	list<string> path_components = string(root_relative_name).split('/', false);
-
-	// dprintf("processing: %s\n", root_relative_name);
+	// dprintf("processing: %s\n", path);
 
+	char *component = &path[2];
 	tarfs_node *current_node = &root_;
-	while (!path_components.empty()) {
-		auto component = path_components.dequeue();
 
-		// dprintf("  component: %s\n", component.c_str());
+	while (true) {
+		while (*component == '/') {
+			component++;
+		}
+
+		if (*component == 0) {
+			break;
+		}
+
+		char *end = component;
+		while (*end && *end != '/') {
+			end++;
+		}
+
+		char *next = end;
+		while (*next == '/') {
+			next++;
+		}
+
+		bool last = *next == 0;
+		*end = 0;
+
+		// dprintf("  component: %s\n", component);
+
+		tarfs_node *existing_child = find_node(current_node, component);
+
+		if (last) {
+			// This is the last component, i.e. the final file (or directory).
+			bool is_directory = header->file_type == '5';
 
-		if (path_components.empty()) {
-			// This is the last component, i.e. the final file.
-			tarfs_node *existing_child = (tarfs_node *)current_node->resolve_child(component);
 			if (existing_child != nullptr) {
+				if (is_directory && existing_child->kind() == fs_node_kind::directory) {
+					break;
+				}
+
 				panic("file already exists");
 			}
 
-			current_node->add_child(component, fs_node_kind::file, data_block_start, data_size);
+			current_node->add_child(component, is_directory ? fs_node_kind::directory : fs_node_kind::file, data_block_start, data_size);
 			break;
 		} else {
 			// This is part of the path.
-			tarfs_node *existing_child = (tarfs_node *)current_node->resolve_child(component);
 			if (existing_child == nullptr) {
 				existing_child = current_node->add_child(component, fs_node_kind::directory, 0, 0);
 			}
 
 			current_node = existing_child;
+			component = next;
 		}
 	}
 }
 
+/**
+ * Reads whole blocks of file data straight into the caller's buffer.  Kernel memory is always
+ * mapped, but user memory must be pinned for the duration of the transfer.
+ */
+bool tarfs_file::read_blocks(void *buffer, u64 start, u64 count)
+{
+	if (!block_device::is_dma_aligned(buffer)) {
+		return false;
+	}
+
+	if (mem::memory_manager::is_kernel_address((u64)buffer)) {
+		fs_.bdev_.read_blocks_sync(buffer, start, count);
+		return true;
+	}
+
+	auto &as = sched::thread::current().owner().addrspace();
+	return fs_.bdev_.read_blocks_direct(as, buffer, start, count);
+}
+
 size_t tarfs_file::pread(void *buffer, size_t offset, size_t length)
 {
 	// dprintf("tarfs: pread: offset=%d len=%d\n", offset, length);
 
-	size_t orig_length = length;
-	u64 current_file_block = offset / 512;
-	u64 start_block_offset = offset % 512;
+	if (offset >= size_) {
+		return 0;
+	}
 
-	u8 *output_ptr = (u8 *)buffer;
-	while (length) {
-		// dprintf("tarfs: pread: block=%d len=%d\n", current_file_block, length);
-		//   Need to read into a buffer, in case length < buffer size
-		char block_buffer[512];
-		read_file_blocks(block_buffer, current_file_block, 1);
+	length = min(length, (size_t)(size_ - offset));
 
-		u64 amount_to_copy = min(length, (size_t)(sizeof(block_buffer) - start_block_offset));
-		// dprintf("tarfs: atc: %lu, sbo: %lu\n", amount_to_copy, start_block_offset);
+	if (fs_.image_) {
+		memops::memcpy(buffer, &fs_.image_[(data_start_ * 512) + offset], length);
+		return length;
+	}
+
+	u8 *output = (u8 *)buffer;
+	u64 device_offset = (data_start_ * 512) + offset;
+	size_t remaining = length;
+
+	// Large reads transfer their whole blocks from the device in a single request, straight into
+	// the caller's buffer.  Small reads, and partial blocks at either end, go through the cache.
+	u64 head = (512 - (device_offset % 512)) % 512;
+	if (remaining >= head + block_cache::buffer_size) {
+		if (head) {
+			fs_.bdev_.cache().read(output, device_offset, head);
+
+			output += head;
+			device_offset += head;
+			remaining -= head;
+		}
 
-		memops::memcpy(output_ptr, block_buffer + start_block_offset, amount_to_copy);
+		u64 nr_blocks = remaining / 512;
+		if (read_blocks(output, device_offset / 512, nr_blocks)) {
+			output += nr_blocks * 512;
+			device_offset += nr_blocks * 512;
+			remaining -= nr_blocks * 512;
+		}
+	}
 
-		length -= amount_to_copy;
-		output_ptr += amount_to_copy;
-		current_file_block++;
-		start_block_offset = 0;
+	if (remaining) {
+		remaining -= fs_.bdev_.cache().read(output, device_offset, remaining);
 	}
 
-	return orig_length;
+	return length - remaining;
 }
 
 size_t tarfs_file::pwrite(const void *buffer, size_t offset, size_t length) { return 0; }
-
-void tarfs_file::read_file_blocks(void *buffer, u64 offset, u64 count) { fs_.bdev_.read_blocks_sync(buffer, data_start_ + offset, count); }
@@ -7,6 +7,8 @@
  */
 #include <stacsos/kernel/arch/core-manager.h>
 #include <stacsos/kernel/arch/x86/x86-platform.h>
+#include <stacsos/kernel/boot-modules.h>
+#include <stacsos/kernel/boot-timer.h>
 #include <stacsos/kernel/config.h>
 #include <stacsos/kernel/debug.h>
 #include <stacsos/kernel/dev/console/physical-console.h>
@@ -15,13 +17,17 @@
 #include <stacsos/kernel/dev/device-manager.h>
 #include <stacsos/kernel/dev/gfx/qemu-stdvga.h>
 #include <stacsos/kernel/dev/input/keyboard.h>
+#include <stacsos/kernel/dev/misc/allocinfo-device.h>
 #include <stacsos/kernel/dev/misc/cmos-rtc.h>
+#include <stacsos/kernel/dev/misc/meminfo-device.h>
 #include <stacsos/kernel/dev/storage/ahci-storage-device.h>
 #include <stacsos/kernel/dev/storage/partitioned-device.h>
+#include <stacsos/kernel/dev/storage/ram-block-device.h>
 #include <stacsos/kernel/dev/tty/terminal.h>
 #include <stacsos/kernel/fs/filesystem.h>
 #include <stacsos/kernel/fs/vfs.h>
 #include <stacsos/kernel/log.h>
+#include <stacsos/kernel/mem/kbench.h>
 #include <stacsos/kernel/mem/memory-manager.h>
 #include <stacsos/kernel/sched/process-manager.h>
 #include <stacsos/memops.h>
@@ -46,6 +52,16 @@ static void init_console()
 	auto rtc = new cmos_rtc(dm.sysbus());
 	dm.register_device(*rtc);
 
+	auto meminfo = new meminfo_device(dm.sysbus());
+	dm.register_device(*meminfo);
+	dm.add_device_alias(*meminfo, "meminfo");
+
+#ifdef USE_ALLOC_TRACKER
+	auto allocinfo = new allocinfo_device(dm.sysbus());
+	dm.register_device(*allocinfo);
+	dm.add_device_alias(*allocinfo, "allocinfo");
+#endif
+
 	auto kbd = new keyboard(dm.sysbus());
 	dm.register_device(*kbd);
 
@@ -96,22 +112,71 @@ static void continue_main()
 {
 	main_logger.log(log_level::info, "now in kernel process");
 
+	// If allocator benchmarks have been requested, run them instead of starting the system.  This
+	// happens here, as the TSC has been calibrated by now.
+	const char *kbench_mode = config::get().get_option("kbench");
+	if (kbench_mode) {
+		stacsos::kernel::mem::kbench::run(kbench_mode);
+	}
+
+	boot_timer::get().begin("probe buses");
 	device_manager::get().probe_buses();
+
+	boot_timer::get().begin("console");
 	init_console();
 
+	boot_timer::get().begin("mount filesystems");
+
 	// Mount the root filesystem
 	auto *root = vfs::get().lookup("/");
 	if (!root) {
 		panic("unable to acquire fs root");
 	}
 
-	auto &dev = device_manager::get().get_device_by_name<partition>("part0");
-	auto *fs = filesystem::create_from_bdev(dev, fs_type_hint::fat);
-	if (!fs) {
-		panic("unable to create filesystem");
+	// A tar image passed as a boot module is already in memory, so if there is one it is used as
+	// the root filesystem, and any disk is mounted under /disk.  Otherwise, the root filesystem
+	// comes from the first partition of the disk.
+	device *disk;
+	bool have_disk = device_manager::get().try_get_device_by_name("part0", disk) && disk->devclass().is_a(partition::partition_device_class);
+
+	if (boot_modules::get().count() > 0) {
+		auto &initrd_module = boot_modules::get().get(0);
+		main_logger.log(log_level::info, "using boot module as root filesystem");
+
+		auto *initrd = new ram_block_device(device_manager::get().sysbus(), (void *)initrd_module.data(), initrd_module.length);
+		device_manager::get().register_device(*initrd);
+		device_manager::get().add_device_alias(*initrd, "initrd");
+
+		auto *fs = filesystem::create_from_bdev(*initrd, fs_type_hint::tarfs);
+		if (!fs) {
+			panic("unable to create filesystem");
+		}
+
+		root->mount(*fs);
+
+		if (have_disk) {
+			auto *disk_fs = filesystem::create_from_bdev(*static_cast<partition *>(disk), fs_type_hint::fat);
+			auto *disk_dir = vfs::get().lookup("/")->mkdir("disk");
+
+			if (disk_fs && disk_dir) {
+				disk_dir->mount(*disk_fs);
+			}
+		}
+	} else {
+		if (!have_disk) {
+			panic("no root filesystem");
+		}
+
+		auto *fs = filesystem::create_from_bdev(*static_cast<partition *>(disk), fs_type_hint::fat);
+		if (!fs) {
+			panic("unable to create filesystem");
+		}
+
+		root->mount(*fs);
 	}
 
-	root->mount(*fs);
+	// Cached writes to the filesystem are written back periodically from here on.
+	block_cache::start_writeback();
 
 	auto *devfs_dir = vfs::get().lookup("/")->mkdir("dev");
 	if (!devfs_dir) {
@@ -121,6 +186,7 @@ static void continue_main()
 	devfs_dir->mount(*new devfs());
 
 	// Launch the init process
+	boot_timer::get().begin("start init");
 	auto init_proc = process_manager::get().create_process("/usr/init", "");
 	if (!init_proc) {
 		panic("unable to create init process");
@@ -128,6 +194,13 @@ static void continue_main()
 
 	main_logger.log(log_level::info, "starting init process");
 	init_proc->start();
+
+	// Now that init is running, bring the rest of physical memory online in the background.
+	boot_timer::get().begin("mem: deferred init");
+	stacsos::kernel::mem::memory_manager::get().complete_deferred_init();
+	boot_timer::get().end();
+
+	boot_timer::get().report();
 }
 
 __noreturn void main(const char *cmdline)
@@ -140,21 +213,26 @@ __noreturn void main(const char *cmdline)
 	stacsos::kernel::mem::memory_manager::get().init();
 
 	// Now, initialise the core manager, which looks after CPU resources.
+	boot_timer::get().begin("core manager");
 	stacsos::kernel::arch::core_manager::get().init();
 
 	// Next, initialise the VFS.
+	boot_timer::get().begin("vfs");
 	stacsos::kernel::fs::vfs::get().init();
 
 	// Initialise the device manager, and probe the platform.
+	boot_timer::get().begin("platform probe");
 	stacsos::kernel::dev::device_manager::get().init();
 	stacsos::kernel::arch::x86::x86_platform::get().probe();
 
 	// Initialise the process manager, so we can start running threads.
+	boot_timer::get().begin("process manager");
 	stacsos::kernel::sched::process_manager::get().init();
 
 	// Create the kernel process, and start it.
 	auto kp = stacsos::kernel::sched::process_manager::get().create_kernel_process(continue_main);
 	kp->start();
+	boot_timer::get().end();
 
 	main_logger.log(log_level::info, "continuing in kernel process");
 
@@ -21,11 +21,32 @@ address_space *address_space::create_linked(u64 alloc_rgn_start)
 
 address_space_region *address_space::alloc_region(u64 size, region_flags flags, bool allocate)
 {
+	if (size == 0) {
+		return nullptr;
+	}
+
 	u64 aligned_size = PAGE_ALIGN_UP(size);
-	u64 base = next_alloc_rgn_;
-	next_alloc_rgn_ += aligned_size;
+	u64 base;
+
+	{
+		unique_irq_lock l(lock_);
+
+		base = take_free_range(aligned_size);
+		if (base == 0) {
+			base = next_alloc_rgn_;
+			next_alloc_rgn_ += aligned_size;
+		}
+	}
 
-	return add_region(base, size, flags, allocate);
+	auto rgn = add_region(base, size, flags, allocate);
+	if (rgn == nullptr) {
+		unique_irq_lock l(lock_);
+		release_range(base, aligned_size);
+	} else {
+		rgn->allocated = true;
+	}
+
+	return rgn;
 }
 
 address_space_region *address_space::add_region(u64 base, u64 size, region_flags flags, bool allocate)
@@ -34,12 +55,21 @@ address_space_region *address_space::add_region(u64 base, u64 size, region_flags
 	rgn->base = base;
 	rgn->size = size;
 	rgn->flags = flags;
+	rgn->allocated = false;
+	rgn->pin_count = 0;
+	rgn->removed = false;
 
 	//dprintf("as: add-region base=%lx size=%lx flags=%d alloc=%d\n", base, size, flags, allocate);
 
+	unique_irq_lock l(lock_);
+
 	if (allocate) {
 		u64 pages = (size + (PAGE_SIZE - 1)) / PAGE_SIZE;
 		rgn->storage = memory_manager::get().pgalloc().allocate_pages(log2_ceil(pages), page_allocation_flags::zero);
+		if (rgn->storage == nullptr) {
+			delete rgn;
+			return nullptr;
+		}
 
 		u64 cur_virt = base;
 		u64 cur_phys = rgn->storage->base_address();
@@ -54,12 +84,168 @@ address_space_region *address_space::add_region(u64 base, u64 size, region_flags
 		rgn->storage = nullptr;
 	}
 
-	regions_.append(rgn);
+	regions_.add(base, rgn);
 
 	return rgn;
 }
 
-void address_space::remove_region(u64 base, u64 size, region_flags flags)
+bool address_space::remove_region(u64 base)
+{
+	unique_irq_lock l(lock_);
+
+	address_space_region *rgn;
+	if (!regions_.try_get_value(base, rgn)) {
+		return false;
+	}
+
+	remove_region_locked(rgn);
+	return true;
+}
+
+bool address_space::free_region(u64 base)
+{
+	unique_irq_lock l(lock_);
+
+	address_space_region *rgn;
+	if (!regions_.try_get_value(base, rgn) || !rgn->allocated) {
+		return false;
+	}
+
+	remove_region_locked(rgn);
+	return true;
+}
+
+void address_space::remove_region_locked(address_space_region *rgn)
+{
+	regions_.remove(rgn->base);
+
+	if (rgn->pin_count > 0) {
+		// A transfer is still using the storage, and the device may not yet have translated the
+		// buffer (e.g. if the request is still queued), so the mapping and the address range are
+		// kept until the last unpin.
+		rgn->removed = true;
+		return;
+	}
+
+	release_region(rgn);
+}
+
+/**
+ * Unmaps a region that is no longer in the region index, makes its address range available for
+ * reuse, and frees its backing storage.
+ */
+void address_space::release_region(address_space_region *rgn)
+{
+	u64 base = rgn->base;
+	u64 aligned_size = PAGE_ALIGN_UP(rgn->size);
+
+	if (rgn->storage) {
+		for (u64 cur_virt = base; cur_virt < base + aligned_size; cur_virt += PAGE_SIZE) {
+			pt_->unmap(pta_, cur_virt);
+		}
+	}
+
+	// Only ranges carved out of the allocation area are recycled -- fixed regions (e.g. ELF
+	// segments, thread stacks) are managed by their owners.
+	if (base >= alloc_rgn_start_ && base < next_alloc_rgn_) {
+		release_range(base, aligned_size);
+	}
+
+	if (rgn->storage) {
+		memory_manager::get().pgalloc().free_pages(*rgn->storage, log2_ceil(aligned_size >> PAGE_BITS));
+	}
+
+	delete rgn;
+}
+
+address_space_region *address_space::pin_range(u64 base, u64 length, region_flags required_flags)
+{
+	unique_irq_lock l(lock_);
+
+	u64 rgn_base;
+	address_space_region *rgn;
+	if (!regions_.try_get_floor(base, rgn_base, rgn)) {
+		return nullptr;
+	}
+
+	if (!rgn->storage || (rgn->flags & required_flags) != required_flags) {
+		return nullptr;
+	}
+
+	if (base + length < base || base + length > rgn->base + rgn->size) {
+		return nullptr;
+	}
+
+	rgn->pin_count++;
+	return rgn;
+}
+
+void address_space::unpin(address_space_region *rgn)
+{
+	unique_irq_lock l(lock_);
+
+	if (--rgn->pin_count > 0 || !rgn->removed) {
+		return;
+	}
+
+	release_region(rgn);
+}
+
+/**
+ * Finds the smallest free range that can satisfy an allocation of the given size, and carves the
+ * allocation from the bottom of it.  Returns zero if there is no suitable range.
+ */
+u64 address_space::take_free_range(u64 size)
+{
+	free_range_key key;
+	u64 base;
+
+	if (!free_ranges_by_size_.try_get_ceiling(free_range_key { size, 0 }, key, base)) {
+		return 0;
+	}
+
+	remove_free_range(key.base, key.size);
+	if (key.size > size) {
+		insert_free_range(key.base + size, key.size - size);
+	}
+
+	return key.base;
+}
+
+/**
+ * Returns a range to the free index, coalescing it with any adjacent free ranges.  A range that
+ * ends at the allocation high-water mark lowers the mark instead, so the index stays small.
+ */
+void address_space::release_range(u64 base, u64 size)
+{
+	u64 prev_base, prev_size;
+	if (free_ranges_.try_get_floor(base, prev_base, prev_size) && prev_base + prev_size == base) {
+		remove_free_range(prev_base, prev_size);
+		base = prev_base;
+		size += prev_size;
+	}
+
+	u64 next_base, next_size;
+	if (free_ranges_.try_get_ceiling(base + size, next_base, next_size) && next_base == base + size) {
+		remove_free_range(next_base, next_size);
+		size += next_size;
+	}
+
+	if (base + size == next_alloc_rgn_) {
+		next_alloc_rgn_ = base;
+	} else {
+		insert_free_range(base, size);
+	}
+}
+
+void address_space::insert_free_range(u64 base, u64 size)
+{
+	free_ranges_.add(base, size);
+	free_ranges_by_size_.add(free_range_key { size, base }, base);
+}
+
+void address_space::remove_free_range(u64 base, u64 size)
 {
-	//
+	free_ranges_.remove(base);
+	free_ranges_by_size_.remove(free_range_key { size, base });
 }
@@ -0,0 +1,181 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/arch/x86/tsc.h>
+#include <stacsos/kernel/arch/x86/x86-core.h>
+#include <stacsos/kernel/mem/alloc-tracker.h>
+#include <stacsos/printf.h>
+
+using namespace stacsos;
+using namespace stacsos::kernel::mem;
+using namespace stacsos::kernel::arch::x86;
+
+// The number of call sites to include in the report.
+static const int report_top_sites = 24;
+
+static inline unsigned int hash_ptr(const void *ptr, unsigned int capacity)
+{
+	// Fibonacci hashing -- heap objects are at least 16-byte aligned, so ignore the low bits.
+	return (unsigned int)((((u64)ptr >> 4) * 0x9e3779b97f4a7c15ull) >> 40) & (capacity - 1);
+}
+
+int alloc_tracker::find_or_add_site(void *site)
+{
+	unsigned int slot = hash_ptr(site, max_sites);
+
+	for (int i = 0; i < max_sites; i++) {
+		if (sites_[slot].site == site) {
+			return slot;
+		}
+
+		if (sites_[slot].site == nullptr) {
+			sites_[slot].site = site;
+			nr_sites_++;
+			return slot;
+		}
+
+		slot = (slot + 1) & (max_sites - 1);
+	}
+
+	return -1;
+}
+
+void alloc_tracker::track_alloc(void *ptr, size_t size, void *site)
+{
+	if (!ptr) {
+		return;
+	}
+
+	u64 now = __builtin_ia32_rdtsc();
+
+	unique_irq_lock l(lock_);
+
+	int site_slot = find_or_add_site(site);
+	if (site_slot < 0 || nr_live_ == max_live_objects) {
+		dropped_++;
+		return;
+	}
+
+	alloc_site &s = sites_[site_slot];
+	s.nr_allocs++;
+	s.live_bytes += size;
+	s.total_bytes += size;
+	s.last_timestamp = now;
+
+	unsigned int slot = hash_ptr(ptr, max_live_objects);
+	while (live_[slot].ptr != nullptr) {
+		slot = (slot + 1) & (max_live_objects - 1);
+	}
+
+	live_[slot].ptr = ptr;
+	live_[slot].size = (u32)size;
+	live_[slot].site = (u16)site_slot;
+	live_[slot].timestamp = now;
+	nr_live_++;
+}
+
+void alloc_tracker::track_free(void *ptr)
+{
+	if (!ptr) {
+		return;
+	}
+
+	unique_irq_lock l(lock_);
+
+	unsigned int slot = hash_ptr(ptr, max_live_objects);
+	for (int i = 0; i < max_live_objects; i++) {
+		if (live_[slot].ptr == nullptr) {
+			// Not tracked, e.g. because the table was full when it was allocated.
+			return;
+		}
+
+		if (live_[slot].ptr == ptr) {
+			break;
+		}
+
+		slot = (slot + 1) & (max_live_objects - 1);
+	}
+
+	if (live_[slot].ptr != ptr) {
+		return;
+	}
+
+	alloc_site &s = sites_[live_[slot].site];
+	s.nr_frees++;
+	s.live_bytes -= live_[slot].size;
+
+	live_[slot].ptr = nullptr;
+	nr_live_--;
+
+	// Shift any following entries in the probe sequence back into the hole, so that lookups
+	// never stop early at an empty slot (this avoids the need for tombstones).
+	unsigned int hole = slot;
+	unsigned int next = (slot + 1) & (max_live_objects - 1);
+	while (live_[next].ptr != nullptr) {
+		unsigned int home = hash_ptr(live_[next].ptr, max_live_objects);
+
+		// Only move the entry if its home slot is not between the hole and its current slot.
+		bool can_move = (hole <= next) ? (home <= hole || home > next) : (home <= hole && home > next);
+		if (can_move) {
+			live_[hole] = live_[next];
+			live_[next].ptr = nullptr;
+			hole = next;
+		}
+
+		next = (next + 1) & (max_live_objects - 1);
+	}
+}
+
+size_t alloc_tracker::report(char *buffer, size_t size)
+{
+	unique_irq_lock l(lock_);
+
+	u64 now = __builtin_ia32_rdtsc();
+	u64 ticks_per_ms = max(x86_core::this_core().local_tsc().frequency() / 1000, 1ull);
+
+	// Select the sites with the most outstanding bytes.
+	int top[report_top_sites];
+	int nr_top = 0;
+
+	for (int i = 0; i < max_sites; i++) {
+		if (sites_[i].site == nullptr) {
+			continue;
+		}
+
+		int pos = nr_top;
+		while (pos > 0 && sites_[top[pos - 1]].live_bytes < sites_[i].live_bytes) {
+			if (pos < report_top_sites) {
+				top[pos] = top[pos - 1];
+			}
+			pos--;
+		}
+
+		if (pos < report_top_sites) {
+			top[pos] = i;
+			if (nr_top < report_top_sites) {
+				nr_top++;
+			}
+		}
+	}
+
+	u64 live_bytes = 0;
+	for (int i = 0; i < max_sites; i++) {
+		live_bytes += sites_[i].live_bytes;
+	}
+
+	size_t n = snprintf(buffer, size, "%d live objects (%lu bytes), %d call sites, %lu untracked\n", nr_live_, live_bytes, nr_sites_, dropped_);
+	n += snprintf(buffer + n, size - n, "%18s %12s %8s %8s %12s %10s\n", "site", "live-bytes", "allocs", "frees", "total-bytes", "last-ms");
+
+	for (int i = 0; i < nr_top && n < size; i++) {
+		const alloc_site &s = sites_[top[i]];
+
+		n += snprintf(buffer + n, size - n, "  %016lx %12lu %8lu %8lu %12lu %10lu\n", (u64)s.site, s.live_bytes, s.nr_allocs, s.nr_frees, s.total_bytes,
+			(now - s.last_timestamp) / ticks_per_ms);
+	}
+
+	return n;
+}
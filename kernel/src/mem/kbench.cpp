@@ -0,0 +1,243 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/arch/x86/pio.h>
+#include <stacsos/kernel/arch/x86/tsc.h>
+#include <stacsos/kernel/arch/x86/x86-core.h>
+#include <stacsos/kernel/debug.h>
+#include <stacsos/kernel/lock.h>
+#include <stacsos/kernel/mem/kbench.h>
+#include <stacsos/kernel/mem/memory-manager.h>
+#include <stacsos/kernel/mem/page.h>
+#include <stacsos/memops.h>
+#include <stacsos/meminfo.h>
+#include <stacsos/printf.h>
+
+using namespace stacsos;
+using namespace stacsos::kernel;
+using namespace stacsos::kernel::mem;
+using namespace stacsos::kernel::arch::x86;
+
+enum class free_pattern { lifo, fifo, random };
+static const char *free_pattern_names[] = { "lifo", "fifo", "random" };
+
+// The maximum number of live objects in a single benchmark run.
+static const int max_samples = 1024;
+
+// The page allocator benchmark is limited to this much memory per run, so that the higher
+// orders do not exhaust the allocator.
+static const u64 pgalloc_budget = MB(64);
+
+// The page table benchmark maps pages into this (otherwise unused) region of the kernel
+// address space.
+static const u64 map_bench_area = 0xffff'c000'0000'0000;
+
+// Samples, and objects, are kept out of the heap so that they do not disturb the allocators
+// being measured.
+static u64 alloc_samples[max_samples], free_samples[max_samples];
+static void *objects[max_samples];
+static int free_order[max_samples];
+
+static u64 rng_state = 0x2545f4914f6cdd1dull;
+
+static u64 next_random()
+{
+	// xorshift64
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+
+	return rng_state;
+}
+
+static void prepare_free_order(free_pattern pattern, int count)
+{
+	for (int i = 0; i < count; i++) {
+		free_order[i] = pattern == free_pattern::lifo ? (count - 1 - i) : i;
+	}
+
+	if (pattern == free_pattern::random) {
+		for (int i = count - 1; i > 0; i--) {
+			int j = next_random() % (i + 1);
+
+			int tmp = free_order[i];
+			free_order[i] = free_order[j];
+			free_order[j] = tmp;
+		}
+	}
+}
+
+static void sort_samples(u64 *samples, int count)
+{
+	for (int i = 1; i < count; i++) {
+		u64 v = samples[i];
+
+		int j = i - 1;
+		while (j >= 0 && samples[j] > v) {
+			samples[j + 1] = samples[j];
+			j--;
+		}
+
+		samples[j + 1] = v;
+	}
+}
+
+static void report(const char *name, free_pattern pattern, const char *op, u64 *samples, int count)
+{
+	if (count == 0) {
+		dprintf("kbench: %s %s %s: no samples\n", name, free_pattern_names[(int)pattern], op);
+		return;
+	}
+
+	sort_samples(samples, count);
+
+	u64 ticks_per_us = max(x86_core::this_core().local_tsc().frequency() / 1000000, 1ull);
+	u64 p50 = samples[(count * 50) / 100];
+	u64 p90 = samples[(count * 90) / 100];
+	u64 p99 = samples[(count * 99) / 100];
+
+	dprintf("kbench: %s %s %s: n=%d p50=%lu p90=%lu p99=%lu max=%lu cycles (p50=%lu ns)\n", name, free_pattern_names[(int)pattern], op, count, p50, p90,
+		p99, samples[count - 1], (p50 * 1000) / ticks_per_us);
+}
+
+/**
+ * Allocates up to count objects, then frees them in each of the free patterns, timing each
+ * individual operation.  Interrupts are disabled while each pattern runs, so that the timer
+ * does not show up in the results.
+ */
+template <typename AllocFn, typename FreeFn> static void run_patterns(const char *name, int count, AllocFn alloc, FreeFn free)
+{
+	spinlock_irq bench_lock;
+
+	for (int p = 0; p <= (int)free_pattern::random; p++) {
+		free_pattern pattern = (free_pattern)p;
+
+		unique_irq_lock l(bench_lock);
+
+		int nr_allocated = 0;
+		for (int i = 0; i < count; i++) {
+			u64 start = __builtin_ia32_rdtsc();
+			void *obj = alloc(i);
+			u64 end = __builtin_ia32_rdtsc();
+
+			if (!obj) {
+				break;
+			}
+
+			objects[i] = obj;
+			alloc_samples[i] = end - start;
+			nr_allocated++;
+		}
+
+		prepare_free_order(pattern, nr_allocated);
+
+		for (int i = 0; i < nr_allocated; i++) {
+			int idx = free_order[i];
+
+			u64 start = __builtin_ia32_rdtsc();
+			free(idx, objects[idx]);
+			u64 end = __builtin_ia32_rdtsc();
+
+			free_samples[i] = end - start;
+		}
+
+		l.unlock();
+
+		report(name, pattern, "alloc", alloc_samples, nr_allocated);
+		report(name, pattern, "free", free_samples, nr_allocated);
+	}
+}
+
+static void bench_pgalloc()
+{
+	auto &pga = memory_manager::get().pgalloc();
+	char name[32];
+
+	for (int order = 0; order < meminfo::max_orders; order++) {
+		int count = (int)min((u64)max_samples, max((pgalloc_budget >> PAGE_BITS) >> order, 1ull));
+
+		snprintf(name, sizeof(name), "pgalloc order %d", order);
+		run_patterns(
+			name, count, [&](int) { return (void *)pga.allocate_pages(order); }, [&](int, void *obj) { pga.free_pages(*(page *)obj, order); });
+	}
+}
+
+static void bench_objalloc()
+{
+	auto &oa = memory_manager::get().objalloc();
+	char name[32];
+
+	for (size_t size = 16; size <= 1024; size <<= 1) {
+		snprintf(name, sizeof(name), "objalloc %lu", size);
+		run_patterns(name, max_samples, [&](int) { return oa.alloc(size); }, [&](int, void *obj) { oa.free(obj); });
+	}
+}
+
+static void bench_loa()
+{
+	auto &oa = memory_manager::get().objalloc();
+	char name[32];
+
+	// Large objects consume (and currently never give back) their virtual address space, so
+	// keep these runs small.
+	for (size_t size = KB(4); size <= KB(256); size <<= 2) {
+		snprintf(name, sizeof(name), "loa %lu", size);
+		run_patterns(name, 128, [&](int) { return oa.alloc(size); }, [&](int, void *obj) { oa.free(obj); });
+	}
+}
+
+static void bench_map()
+{
+	auto &mm = memory_manager::get();
+	auto &pt = mm.root_address_space().pgtable();
+
+	page *target = mm.pgalloc().allocate_pages(0, page_allocation_flags::zero);
+	if (!target) {
+		dprintf("kbench: unable to allocate target page for map benchmark\n");
+		return;
+	}
+
+	run_patterns(
+		"map 4k", max_samples,
+		[&](int i) {
+			u64 va = map_bench_area + ((u64)i << PAGE_BITS);
+			pt.map(mm.ptalloc(), va, target->base_address(), mapping_flags::present | mapping_flags::writable);
+			return (void *)va;
+		},
+		[&](int, void *obj) { pt.unmap(mm.ptalloc(), (u64)obj); });
+
+	mm.pgalloc().free_pages(*target, 0);
+}
+
+__noreturn void kbench::run(const char *mode)
+{
+	bool all = memops::strcmp(mode, "all") == 0;
+
+	dprintf("kbench: mode=%s tsc=%lu Hz\n", mode, x86_core::this_core().local_tsc().frequency());
+
+	if (all || memops::strcmp(mode, "pgalloc") == 0) {
+		bench_pgalloc();
+	}
+
+	if (all || memops::strcmp(mode, "objalloc") == 0) {
+		bench_objalloc();
+	}
+
+	if (all || memops::strcmp(mode, "loa") == 0) {
+		bench_loa();
+	}
+
+	if (all || memops::strcmp(mode, "map") == 0) {
+		bench_map();
+	}
+
+	dprintf("kbench: done\n");
+
+	// Power off the machine (via the ACPI PM1a control register).
+	pio::outw(0x604, 0x2000);
+	abort();
+}
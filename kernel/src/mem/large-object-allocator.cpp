@@ -71,6 +71,8 @@ void *large_object_allocator::allocate(size_t size)
 
 	// Advance the base pointer by the number of pages we've just allocated (and mapped)
 	base_ = (void *)((uintptr_t)base_ + (nr_pages * PAGE_SIZE));
+	live_objects_++;
+
 	return (void *)target;
 }
 
@@ -86,6 +88,7 @@ bool large_object_allocator::free(void *p)
 	}
 
 	// TODO
+	live_objects_--;
 
 	return true;
 }
@@ -5,11 +5,16 @@
  * Copyright (c) University of St Andrews 2024
  * Tom Spink <tcs6@st-andrews.ac.uk>
  */
+#include <stacsos/kernel/arch/x86/cpuid.h>
+#include <stacsos/kernel/boot-timer.h>
 #include <stacsos/kernel/config.h>
 #include <stacsos/kernel/debug.h>
+#include <stacsos/kernel/dev/storage/block-cache.h>
 #include <stacsos/kernel/mem/memory-manager.h>
 #include <stacsos/kernel/mem/page-allocator-buddy.h>
 #include <stacsos/kernel/mem/page-allocator-linear.h>
+#include <stacsos/kernel/mem/page-allocator-numa.h>
+#include <stacsos/kernel/mem/numa.h>
 #include <stacsos/kernel/mem/page.h>
 
 extern "C" const char *_IMAGE_START;
@@ -17,32 +22,59 @@ extern "C" const char *_IMAGE_END;
 
 using namespace stacsos::kernel;
 using namespace stacsos::kernel::mem;
+using namespace stacsos::kernel::arch::x86;
 
 struct memory_block {
 	u64 start, length;
 	bool avail;
 };
 
-static memory_block memory_blocks[16];
-static int nr_memory_blocks;
+// The memory block table is sized from the boot memory map, and lives in the dynamic data area
+// immediately after the page descriptor array.
+static memory_block *memory_blocks;
+static int nr_memory_blocks, max_memory_blocks;
 
-static char page_allocator_structure[0x1000];
+struct exclusion {
+	u64 start, length;
+};
 
-void memory_manager::init()
-{
-	dprintf("mem: init\n");
+// Memory holding data handed over by the boot loader, which must not be allocated.
+static const int max_boot_reservations = 4;
+static exclusion boot_reservations[max_boot_reservations];
+static int nr_boot_reservations;
+
+// The boot page tables (see start32.S) only provide a usable direct map for the first 4GB of
+// physical memory, so memory above this cannot be touched until the primary mapping is active.
+static const u64 boot_direct_map_limit = GB(4);
+
+// Memory above the boot direct map is initialised lazily, in chunks of this size.
+static const u64 deferred_init_chunk_size = MB(2);
 
+// The kernel high mapping covers the first 2GB of physical memory, which must contain the kernel
+// image and the dynamic data area.
+static const u64 kernel_high_map_limit = GB(2);
+
+static char page_allocator_structure[numa_topology::max_nodes][0x1000];
+
+page_allocator *memory_manager::create_page_allocator(void *storage)
+{
 	const char *pgalloc_algorithm_name = config::get().get_option_or_default("pgalloc", "linear");
-	dprintf("\e\x04mem: *** using the '%s' page allocator\e\x07\n", pgalloc_algorithm_name);
 
-	void *page_allocator_object = (void *)page_allocator_structure;
 	if (memops::strcmp(pgalloc_algorithm_name, "buddy") == 0) {
-		pgalloc_ = new (page_allocator_object) page_allocator_buddy(*this);
+		return new (storage) page_allocator_buddy(*this);
 	} else if (memops::strcmp(pgalloc_algorithm_name, "linear") == 0) {
-		pgalloc_ = new (page_allocator_object) page_allocator_linear(*this);
+		return new (storage) page_allocator_linear(*this);
 	} else {
 		panic("Invalid page allocator algoritm: %s", pgalloc_algorithm_name);
 	}
+}
+
+void memory_manager::init()
+{
+	dprintf("mem: init\n");
+
+	dprintf("\e\x04mem: *** using the '%s' page allocator\e\x07\n", config::get().get_option_or_default("pgalloc", "linear"));
+	pgalloc_ = create_page_allocator(page_allocator_structure[0]);
 
 	dprintf("memory:\n");
 	u64 last_addr = 0;
@@ -57,67 +89,246 @@ void memory_manager::init()
 		}
 	}
 
-	u64 nr_page_descriptors = (last_addr + 1) >> PAGE_BITS;
-	initialise_page_descriptors(nr_page_descriptors);
-	initialise_page_allocator(nr_page_descriptors);
+	nr_page_descriptors_ = (last_addr + 1) >> PAGE_BITS;
+
+	// Indicate to the user how many page descriptors have been detected.
+	dprintf("%lu pages (%lu Mb)\n", nr_page_descriptors_, (nr_page_descriptors_ << PAGE_BITS) / 1048576);
+
+	// Only the page descriptors for memory that is reachable through the boot direct map are
+	// initialised now -- this is enough to build the primary mapping and bring up the rest of the
+	// kernel.  The remainder is initialised later, by complete_deferred_init().
+	u64 nr_early_page_descriptors = min(nr_page_descriptors_, boot_direct_map_limit >> PAGE_BITS);
+
+	boot_timer::get().begin("mem: page descriptors");
+	initialise_page_descriptors(0, nr_early_page_descriptors);
+
+	// Determine whether or not we're running in self-test mode for the page allocator.
+	if (memops::strcmp(config::get().get_option_or_default("pgalloc-selftest", "no"), "yes") == 0) {
+		// Do the self-test, which should hang the system.
+		pgalloc_->perform_selftest();
+
+		// Which means, we never get here.
+		__unreachable();
+	}
+
+	boot_timer::get().begin("mem: early free memory");
+	initialise_page_allocator(0, nr_early_page_descriptors << PAGE_BITS);
 	initialise_object_allocator();
 
 	dprintf("switching to primary page table mapping...\n");
-	activate_primary_mapping();
+	boot_timer::get().begin("mem: primary mapping");
+	activate_primary_mapping(last_addr + 1);
+
+	deferred_init_pfn_ = nr_early_page_descriptors;
+	boot_timer::get().end();
 
 	dprintf("done\n");
 }
 
+/**
+ * @brief Initialises the next chunk of deferred page descriptors, and gives the free memory
+ * they describe to the page allocator.  Chunks are small, and interrupts are only disabled while
+ * the page allocator is being extended, so that it is not re-entered.
+ *
+ * @return Returns true if a chunk was initialised, or false if there is nothing left to do.
+ */
+bool memory_manager::initialise_deferred_chunk()
+{
+	u64 first_pfn, last_pfn;
+
+	{
+		unique_irq_lock l(deferred_init_lock_);
+
+		if (deferred_init_pfn_ >= nr_page_descriptors_) {
+			return false;
+		}
+
+		first_pfn = deferred_init_pfn_;
+		last_pfn = min(nr_page_descriptors_, first_pfn + (deferred_init_chunk_size >> PAGE_BITS));
+		deferred_init_pfn_ = last_pfn;
+	}
+
+	// Nothing else can refer to these pages until they are given to the page allocator.
+	initialise_page_descriptors(first_pfn, last_pfn);
+
+	unique_irq_lock l(deferred_init_lock_);
+	initialise_page_allocator(first_pfn << PAGE_BITS, last_pfn << PAGE_BITS, false);
+
+	return true;
+}
+
+void memory_manager::complete_deferred_init()
+{
+	if (deferred_init_pfn_ >= nr_page_descriptors_) {
+		return;
+	}
+
+	dprintf("mem: initialising deferred memory %016lx -- %016lx\n", deferred_init_pfn_ << PAGE_BITS, nr_page_descriptors_ << PAGE_BITS);
+
+	// Interrupts are enabled in between chunks, so other threads can be scheduled while this
+	// is in progress.
+	int nr_chunks = 0;
+	while (initialise_deferred_chunk()) {
+		nr_chunks++;
+	}
+
+	dprintf("mem: initialised %d deferred chunk(s), %lu pages now managed\n", nr_chunks, managed_pages_);
+}
+
+/*
+ * A free block that has been drained from the boot page allocator, while memory is being
+ * redistributed into per-node zones.  This lives in the free block itself.
+ */
+struct drained_block {
+	drained_block *next;
+	page *base;
+	u64 nr_pages;
+};
+
+void memory_manager::init_numa()
+{
+	auto &topology = numa_topology::get();
+	topology.finalise();
+
+	if (!topology.is_numa()) {
+		return;
+	}
+
+	// The boot page allocator becomes the zone for node zero, and we create zones for the
+	// remaining nodes.  This must happen before draining, as it may need to allocate.
+	page_allocator *zones[numa_topology::max_nodes];
+	zones[0] = pgalloc_;
+	for (int node = 1; node < topology.nr_nodes(); node++) {
+		zones[node] = create_page_allocator(page_allocator_structure[node]);
+	}
+
+	auto numa_allocator = new page_allocator_numa(*this, topology, zones, topology.nr_nodes());
+
+	// Drain all free memory out of the boot allocator, largest blocks first (so that nothing
+	// needs to be split), and thread the drained blocks together through their own memory.
+	drained_block *drained = nullptr;
+	for (int order = meminfo::max_orders - 1; order >= 0; order--) {
+		page *pg;
+		while ((pg = pgalloc_->allocate_pages(order)) != nullptr) {
+			drained_block *block = (drained_block *)pg->base_address_ptr();
+			block->next = drained;
+			block->base = pg;
+			block->nr_pages = 1ull << order;
+			drained = block;
+		}
+	}
+
+	// Now, redistribute the drained memory into the zone of the node it belongs to.
+	pgalloc_ = numa_allocator;
+	while (drained) {
+		drained_block *next = drained->next;
+		pgalloc_->insert_free_pages(*drained->base, drained->nr_pages);
+		drained = next;
+	}
+}
+
+u64 memory_manager::reserve_memory_blocks(int count, u64 end_address)
+{
+	u64 page_descriptors_size = PAGE_ALIGN_UP(sizeof(page) * (PAGE_ALIGN_UP(end_address) >> PAGE_BITS));
+	u64 dynamic_data_end = ((u64)&_DYNAMIC_DATA_START - 0xffff'ffff'8000'0000) + page_descriptors_size + (sizeof(memory_block) * count);
+
+	if (dynamic_data_end > kernel_high_map_limit) {
+		panic("page descriptors for %lu Mb of memory do not fit in the kernel mapping", end_address / MB(1));
+	}
+
+	memory_blocks = (memory_block *)((u64)&_DYNAMIC_DATA_START + page_descriptors_size);
+	max_memory_blocks = count;
+	nr_memory_blocks = 0;
+
+	return PAGE_ALIGN_UP(dynamic_data_end);
+}
+
+void memory_manager::reserve_boot_memory(u64 start, u64 length)
+{
+	if (nr_boot_reservations == max_boot_reservations) {
+		panic("too many boot memory reservations");
+	}
+
+	boot_reservations[nr_boot_reservations++] = { PAGE_ALIGN_DOWN(start), PAGE_ALIGN_UP(start + length) - PAGE_ALIGN_DOWN(start) };
+}
+
 void memory_manager::add_memory_block(u64 start, u64 length, bool avail)
 {
+	if (nr_memory_blocks == max_memory_blocks) {
+		panic("too many memory blocks");
+	}
+
 	memory_blocks[nr_memory_blocks].start = start;
 	memory_blocks[nr_memory_blocks].length = length;
 	memory_blocks[nr_memory_blocks].avail = avail;
 	nr_memory_blocks++;
 }
 
-void memory_manager::initialise_page_descriptors(u64 nr_page_descriptors)
+/**
+ * Initialises the page descriptors in the range [first_pfn, last_pfn).
+ */
+void memory_manager::initialise_page_descriptors(u64 first_pfn, u64 last_pfn)
 {
-	// Indicate to the user how many page descriptors have been detected.
-	dprintf("%lu pages (%lu Mb)\n", nr_page_descriptors, (nr_page_descriptors << PAGE_BITS) / 1048576);
+	// Initialise the page descriptors to zero.
+	memops::bzero(&page::get_from_pfn(first_pfn), sizeof(page) * (last_pfn - first_pfn));
 
-	// Initialise all page descriptors to zero.
-	memops::bzero(page::get_pagearray(), sizeof(page) * nr_page_descriptors);
-}
-
-struct exclusion {
-	u64 start, length;
-};
+	// Mark the pages in unavailable memory blocks as reserved.
+	for (int i = 0; i < nr_memory_blocks; i++) {
+		const memory_block *mb = &memory_blocks[i];
+		if (mb->avail) {
+			continue;
+		}
 
-void memory_manager::initialise_page_allocator(u64 nr_page_descriptors)
-{
-	// Determine whether or not we're running in self-test mode for the page allocator.
-	if (memops::strcmp(config::get().get_option_or_default("pgalloc-selftest", "no"), "yes") == 0) {
-		// Do the self-test, which should hang the system.
-		pgalloc_->perform_selftest();
+		u64 block_first_pfn = max(mb->start >> PAGE_BITS, first_pfn);
+		u64 block_last_pfn = min((mb->start + mb->length) >> PAGE_BITS, last_pfn);
 
-		// Which means, we never get here.
-		__unreachable();
+		for (u64 pfn = block_first_pfn; pfn < block_last_pfn; pfn++) {
+			auto &pg = page::get_from_pfn(pfn);
+			pg.type_ = page_type::reserved;
+		}
 	}
+}
 
-	dprintf("mem: initialising page allocator...\n");
+/**
+ * Inserts the available memory in the physical address range [low, high) into the page allocator.
+ * Progress is only logged if verbose is set, as deferred initialisation calls this many times.
+ */
+void memory_manager::initialise_page_allocator(u64 low, u64 high, bool verbose)
+{
+	if (verbose) {
+		dprintf("mem: initialising page allocator (%016lx -- %016lx)...\n", low, high);
+	}
 
 	// Define the memory exclusion ranges, so that we don't add these to the page allocator's free lists.
 	// NOTE: This list *MUST* be ordered on base address.
-	static const exclusion exclusions[] = {
+	exclusion exclusions[4 + max_boot_reservations] = {
 		{ 0, MB(1) }, // Early BIOS data, and the ZERO page.
 		{ 0x100000, KB(24) }, // 24 kB (6 pages) of early page tables -- we should probably put these back later.
 		{ (u64)&_IMAGE_START, PAGE_ALIGN_UP((u64)&_IMAGE_END) - ((u64)&_IMAGE_START) }, // The loaded kernel image,
 		{ (u64)&_DYNAMIC_DATA_START - 0xffff'ffff'8000'0000,
-			PAGE_ALIGN_UP(sizeof(page) * nr_page_descriptors) } // Dynamic data, containing the page descriptors.
+			PAGE_ALIGN_UP((u64)&memory_blocks[max_memory_blocks] - (u64)&_DYNAMIC_DATA_START) } // Dynamic data, containing the page descriptors and memory blocks.
 	};
 
-	dprintf("excluion range:\n");
-	for (int i = 0; i < ARRAY_SIZE(exclusions); i++) {
-		dprintf("  %016lx -- %016lx\n", exclusions[i].start, exclusions[i].start + exclusions[i].length);
+	// Insert any boot memory reservations, keeping the list in order.
+	int nr_exclusions = 4;
+	for (int r = 0; r < nr_boot_reservations; r++) {
+		int i = nr_exclusions++;
+		while (i > 0 && exclusions[i - 1].start > boot_reservations[r].start) {
+			exclusions[i] = exclusions[i - 1];
+			i--;
+		}
+
+		exclusions[i] = boot_reservations[r];
 	}
 
-	dprintf("registering free memory blocks...\n");
+	if (verbose) {
+		dprintf("excluion range:\n");
+		for (int i = 0; i < nr_exclusions; i++) {
+			dprintf("  %016lx -- %016lx\n", exclusions[i].start, exclusions[i].start + exclusions[i].length);
+		}
+
+		dprintf("registering free memory blocks...\n");
+	}
 	// Loop through each memory block that we received from the
 	// startup code.
 	for (int i = 0; i < nr_memory_blocks; i++) {
@@ -125,21 +336,30 @@ void memory_manager::initialise_page_allocator(u64 nr_page_descriptors)
 
 		// If the memory block is available, then insert them into the page allocator.
 		if (mb->avail) {
-			auto free_range_base = mb->start;
-			auto free_range_length = (mb->length & ~PAGE_BITS); // Make sure we align down
-			auto free_range_end = free_range_base + free_range_length;
+			// Clip the block to the requested range, and make sure we only consider whole pages.
+			auto free_range_base = PAGE_ALIGN_UP(max(mb->start, low));
+			auto free_range_end = PAGE_ALIGN_DOWN(min(mb->start + mb->length, high));
+			if (free_range_base >= free_range_end) {
+				continue;
+			}
 
-			dprintf("candidate memory block: %016lx -- %016lx\n", free_range_base, free_range_end);
+			if (verbose) {
+				dprintf("candidate memory block: %016lx -- %016lx\n", free_range_base, free_range_end);
+			}
 
 			auto max_end = free_range_end;
 			while (free_range_base < free_range_end) {
-				dprintf("  considering %016lx -- %016lx\n", free_range_base, free_range_end);
+				if (verbose) {
+					dprintf("  considering %016lx -- %016lx\n", free_range_base, free_range_end);
+				}
 
 				// Find any exclusions that this candidate free range intersects
 				bool retry = false;
-				for (int i = 0; i < ARRAY_SIZE(exclusions); i++) {
+				for (int i = 0; i < nr_exclusions; i++) {
 					if (free_range_base >= exclusions[i].start && free_range_base < (exclusions[i].start + exclusions[i].length)) {
-						dprintf("  range start intersects exclusion %016lx -- %016lx\n", exclusions[i].start, exclusions[i].start + exclusions[i].length);
+						if (verbose) {
+							dprintf("  range start intersects exclusion %016lx -- %016lx\n", exclusions[i].start, exclusions[i].start + exclusions[i].length);
+						}
 						free_range_base = exclusions[i].start + exclusions[i].length;
 						retry = true;
 						break;
@@ -153,29 +373,28 @@ void memory_manager::initialise_page_allocator(u64 nr_page_descriptors)
 				// At this point, we have a free range base that doesn't intersect with any exclusion.
 				// But, we need to make sure there are no exclusions within this candidate range.
 				max_end = free_range_end;
-				for (int i = 0; i < ARRAY_SIZE(exclusions); i++) {
+				for (int i = 0; i < nr_exclusions; i++) {
 					if (exclusions[i].start >= free_range_base && exclusions[i].start < max_end) {
 						// We've found an exclusion that is within this free range
-						dprintf(
-							"  exclusion intersects candidate free range %016lx -- %016lx\n", exclusions[i].start, exclusions[i].start + exclusions[i].length);
+						if (verbose) {
+							dprintf("  exclusion intersects candidate free range %016lx -- %016lx\n", exclusions[i].start,
+								exclusions[i].start + exclusions[i].length);
+						}
 						max_end = exclusions[i].start;
 						break;
 					}
 				}
 
-				dprintf("  free range chunk %016lx -- %016lx\n", free_range_base, max_end);
+				if (verbose) {
+					dprintf("  free range chunk %016lx -- %016lx\n", free_range_base, max_end);
+				}
 
 				// Add these pages to the page allocator
 				pgalloc_->insert_free_pages(page::get_from_base_address(free_range_base), (max_end - free_range_base) >> PAGE_BITS);
+				managed_pages_ += (max_end - free_range_base) >> PAGE_BITS;
 
 				free_range_base = max_end;
 			}
-		} else {
-			// Otherwise, mark these pages as reserved.
-			for (u64 pfn = (mb->start >> PAGE_BITS); pfn < ((mb->start + mb->length) >> PAGE_BITS); pfn++) {
-				auto &pg = page::get_from_pfn(pfn);
-				pg.type_ = page_type::reserved;
-			}
 		}
 	}
 }
@@ -185,28 +404,70 @@ void memory_manager::initialise_object_allocator()
 	// Nothing to do to initialise the object allocator!
 }
 
-void memory_manager::activate_primary_mapping()
+void memory_manager::activate_primary_mapping(u64 end_address)
 {
 	root_address_space_ = new address_space(ptalloc_, (u64)0);
 
-	// Insert a mapping that allows us to access physical memory 1-1 (4 gigabytyes) -- this allows the phys_to_virt()
-	// function to work, and is highly convenient.
-	u64 phys_base = 0;
+	// Use the largest page size supported by the CPU for the linear mappings.
+	cpuid c;
+	c.initialise();
+
+	bool use_1g_pages = c.get_feature(cpuid_features::pdpe1gb);
+	u64 granule = use_1g_pages ? GB(1) : MB(2);
+	mapping_size granule_size = use_1g_pages ? mapping_size::m1g : mapping_size::m2m;
 
-	// TODO: Should do this up until the last physical memory block.
-	for (int i = 0; i < 12; i++) {
+	// Insert a mapping that allows us to access physical memory 1-1 -- this allows the phys_to_virt() function to work, and
+	// is highly convenient.  This covers all of the detected memory blocks, and at least the first 4GB, since the 32-bit
+	// MMIO hole (e.g. the IOAPIC and PCI configuration space) is also accessed this way.
+	u64 direct_map_end = (max(end_address, GB(4)) + (granule - 1)) & ~(granule - 1);
+
+	for (u64 phys_base = 0; phys_base < direct_map_end; phys_base += granule) {
 		root_address_space_->pgtable().map(
-			ptalloc_, 0xffff'8000'0000'0000 + phys_base, phys_base, mapping_flags::present | mapping_flags::writable, mapping_size::m1g);
-		phys_base += GB(1);
+			ptalloc_, direct_map_base + phys_base, phys_base, mapping_flags::present | mapping_flags::writable, granule_size);
 	}
 
+	dprintf("mem: direct map covers %lu Gb, using %s pages\n", direct_map_end / GB(1), use_1g_pages ? "1G" : "2M");
+
 	// This mapping is for the kernel high address space.  It's used mainly for executing kernel code, and is how gcc compiles
 	// the kernel code with -mcmodel=kernel
-	root_address_space_->pgtable().map(ptalloc_, 0xffff'ffff'8000'0000, GB(0), mapping_flags::present | mapping_flags::writable, mapping_size::m1g);
-	root_address_space_->pgtable().map(ptalloc_, 0xffff'ffff'c000'0000, GB(1), mapping_flags::present | mapping_flags::writable, mapping_size::m1g);
+	for (u64 phys_base = 0; phys_base < kernel_high_map_limit; phys_base += granule) {
+		root_address_space_->pgtable().map(
+			ptalloc_, 0xffff'ffff'8000'0000 + phys_base, phys_base, mapping_flags::present | mapping_flags::writable, granule_size);
+	}
 
 	// Activate the mapping (flushing the TLB along the way)
 	root_address_space_->pgtable().activate();
 }
 
 bool memory_manager::try_handle_page_fault(u64 faulting_address) { return false; }
+
+void memory_manager::collect_stats(meminfo &info)
+{
+	memops::bzero(&info, sizeof(info));
+
+	info.total_memory = managed_pages_ << PAGE_BITS;
+	pgalloc_->collect_stats(info);
+	objalloc_.collect_stats(info);
+	info.page_table_pages = ptalloc_.allocated_pages();
+	dev::storage::block_cache::collect_stats(info);
+
+	// Without a NUMA topology, all memory is on node zero.
+	if (info.nr_nodes == 0) {
+		info.nr_nodes = 1;
+		info.nodes[0].size = info.total_memory;
+		info.nodes[0].free_memory = info.free_memory;
+	}
+
+	// Compute the unusable free space index for each order, i.e. the fraction of free memory
+	// that is held in blocks too small to satisfy an allocation of that order.
+	u64 free_pages = info.free_memory >> PAGE_BITS;
+	if (free_pages == 0) {
+		return;
+	}
+
+	u64 usable_pages = 0;
+	for (int order = info.nr_orders - 1; order >= 0; order--) {
+		usable_pages += info.free_blocks[order] << order;
+		info.unusable_free_index[order] = ((free_pages - min(usable_pages, free_pages)) * 1000) / free_pages;
+	}
+}
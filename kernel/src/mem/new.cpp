@@ -6,6 +6,7 @@
  * Tom Spink <tcs6@st-andrews.ac.uk>
  */
 #include <stacsos/kernel/debug.h>
+#include <stacsos/kernel/mem/alloc-tracker.h>
 #include <stacsos/kernel/mem/memory-manager.h>
 #include <stacsos/kernel/mem/object-allocator.h>
 
@@ -17,6 +18,33 @@ void *__dso_handle = &__dso_handle;
 int __cxa_atexit(void (*destructor)(void *), void *arg, void *dso) { return 0; }
 }
 
+#ifdef USE_ALLOC_TRACKER
+static inline void *tracked_alloc(size_t size, void *site)
+{
+	void *p = memory_manager::get().objalloc().alloc(size);
+	alloc_tracker::get().track_alloc(p, size, site);
+
+	return p;
+}
+
+static inline void tracked_free(void *p)
+{
+	alloc_tracker::get().track_free(p);
+	memory_manager::get().objalloc().free(p);
+}
+
+void *operator new(size_t size) { return tracked_alloc(size, __builtin_return_address(0)); }
+
+void *operator new[](size_t size) { return tracked_alloc(size, __builtin_return_address(0)); }
+
+void operator delete(void *p) { tracked_free(p); }
+
+void operator delete[](void *p) { tracked_free(p); }
+
+void operator delete[](void *p, size_t sz) { tracked_free(p); }
+
+void operator delete(void *p, size_t sz) { tracked_free(p); }
+#else
 void *operator new(size_t size) { return memory_manager::get().objalloc().alloc(size); }
 
 void *operator new[](size_t size) { return memory_manager::get().objalloc().alloc(size); }
@@ -28,3 +56,4 @@ void operator delete[](void *p) { memory_manager::get().objalloc().free(p); }
 void operator delete[](void *p, size_t sz) { memory_manager::get().objalloc().free(p); }
 
 void operator delete(void *p, size_t sz) { memory_manager::get().objalloc().free(p); }
+#endif
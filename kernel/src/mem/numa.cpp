@@ -0,0 +1,170 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/debug.h>
+#include <stacsos/kernel/mem/numa.h>
+
+using namespace stacsos::kernel::mem;
+
+numa_topology::numa_topology()
+	: nr_nodes_(0)
+	, nr_memory_ranges_(0)
+{
+	for (int i = 0; i < max_apic_ids; i++) {
+		apic_nodes_[i] = -1;
+	}
+
+	for (int i = 0; i < arch::core_manager::max_cores; i++) {
+		core_apics_[i] = -1;
+	}
+
+	for (int from = 0; from < max_nodes; from++) {
+		for (int to = 0; to < max_nodes; to++) {
+			distances_[from][to] = from == to ? local_distance : remote_distance;
+			fallback_[from][to] = to;
+		}
+	}
+}
+
+int numa_topology::node_for_domain(u32 domain)
+{
+	for (int node = 0; node < nr_nodes_; node++) {
+		if (node_domains_[node] == domain) {
+			return node;
+		}
+	}
+
+	if (nr_nodes_ == max_nodes) {
+		dprintf("numa: too many proximity domains -- folding domain %u into node 0\n", domain);
+		return 0;
+	}
+
+	node_domains_[nr_nodes_] = domain;
+	return nr_nodes_++;
+}
+
+void numa_topology::add_memory_range(u32 domain, u64 base, u64 length)
+{
+	if (nr_memory_ranges_ == max_memory_ranges) {
+		dprintf("numa: too many memory ranges -- ignoring %lx--%lx\n", base, base + length);
+		return;
+	}
+
+	numa_memory_range &range = memory_ranges_[nr_memory_ranges_++];
+	range.base = base;
+	range.length = length;
+	range.node = node_for_domain(domain);
+}
+
+void numa_topology::add_processor(u32 domain, u32 apic_id)
+{
+	int node = node_for_domain(domain);
+
+	if (apic_id < max_apic_ids) {
+		apic_nodes_[apic_id] = node;
+	}
+}
+
+void numa_topology::set_distance(u32 from_domain, u32 to_domain, u8 distance)
+{
+	int from = node_for_domain(from_domain);
+	int to = node_for_domain(to_domain);
+
+	distances_[from][to] = distance;
+}
+
+void numa_topology::register_core(int core_id, u32 apic_id)
+{
+	if (core_id < arch::core_manager::max_cores) {
+		core_apics_[core_id] = apic_id;
+	}
+}
+
+void numa_topology::finalise()
+{
+	if (!is_numa()) {
+		return;
+	}
+
+	// Order the fallback list of each node by distance from that node.  The node itself always
+	// comes first, as its local distance is the smallest.
+	for (int from = 0; from < nr_nodes_; from++) {
+		int *order = fallback_[from];
+
+		for (int i = 1; i < nr_nodes_; i++) {
+			int candidate = order[i];
+			int j = i;
+
+			while (j > 0 && distances_[from][order[j - 1]] > distances_[from][candidate]) {
+				order[j] = order[j - 1];
+				j--;
+			}
+
+			order[j] = candidate;
+		}
+	}
+
+	dprintf("numa: %d nodes\n", nr_nodes_);
+	for (int node = 0; node < nr_nodes_; node++) {
+		dprintf("  node %d: domain=%u, memory=%lu Mb, distances:", node, node_domains_[node], node_size(node) / MB(1));
+		for (int to = 0; to < nr_nodes_; to++) {
+			dprintf(" %u", distances_[node][to]);
+		}
+		dprintf("\n");
+	}
+}
+
+int numa_topology::node_of_core(int core_id) const
+{
+	if (core_id >= arch::core_manager::max_cores || core_apics_[core_id] < 0 || core_apics_[core_id] >= max_apic_ids) {
+		return 0;
+	}
+
+	int node = apic_nodes_[core_apics_[core_id]];
+	return node < 0 ? 0 : node;
+}
+
+int numa_topology::node_of_address(u64 address) const
+{
+	u64 extent_end;
+	return node_extent_of_address(address, extent_end);
+}
+
+int numa_topology::node_extent_of_address(u64 address, u64 &extent_end) const
+{
+	// Addresses that are not described by any range (e.g. holes) are attributed to node zero, up
+	// until the start of the next described range.
+	int node = 0;
+	extent_end = ~0ull;
+
+	for (int i = 0; i < nr_memory_ranges_; i++) {
+		const numa_memory_range &range = memory_ranges_[i];
+
+		if (address >= range.base && address < (range.base + range.length)) {
+			extent_end = range.base + range.length;
+			return range.node;
+		}
+
+		if (range.base > address && range.base < extent_end) {
+			extent_end = range.base;
+		}
+	}
+
+	return node;
+}
+
+u64 numa_topology::node_size(int node) const
+{
+	u64 size = 0;
+	for (int i = 0; i < nr_memory_ranges_; i++) {
+		if (memory_ranges_[i].node == node) {
+			size += memory_ranges_[i].length;
+		}
+	}
+
+	return size;
+}
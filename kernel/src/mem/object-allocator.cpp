@@ -70,3 +70,19 @@ void object_allocator::free(void *ptr)
 		panic("unable to free object");
 	}
 }
+
+void object_allocator::collect_stats(meminfo &info)
+{
+	unique_irq_lock l(object_allocator_lock_);
+
+	cache16_.collect_stats(info.slab_caches[0]);
+	cache32_.collect_stats(info.slab_caches[1]);
+	cache64_.collect_stats(info.slab_caches[2]);
+	cache128_.collect_stats(info.slab_caches[3]);
+	cache256_.collect_stats(info.slab_caches[4]);
+	cache512_.collect_stats(info.slab_caches[5]);
+	cache1024_.collect_stats(info.slab_caches[6]);
+	info.nr_slab_caches = 7;
+
+	loa_.collect_stats(info);
+}
@@ -52,6 +52,22 @@ void page_allocator_buddy::dump() const
 	}
 }
 
+/**
+ * @brief Reports the number of free pages, and the number of free blocks in each order.  The
+ * per-order counts are maintained as blocks move on and off the free lists, so this is O(orders).
+ */
+void page_allocator_buddy::collect_stats(meminfo &info) const
+{
+	static_assert(LastOrder < meminfo::max_orders);
+
+	info.nr_orders = LastOrder + 1;
+	info.free_memory = total_free_ << PAGE_BITS;
+
+	for (int order = 0; order <= LastOrder; order++) {
+		info.free_blocks[order] = free_blocks_[order];
+	}
+}
+
 /**
  * @brief Inserts pages that are known to be free into the buddy allocator.
  *
@@ -111,6 +127,8 @@ void page_allocator_buddy::insert_free_block(int order, page &block_start)
 
 	((page_metadata *)target->base_address_ptr())->next_free = *slot;
 	*slot = target;
+
+	free_blocks_[order]++;
 }
 
 /**
@@ -138,6 +156,7 @@ void page_allocator_buddy::remove_free_block(int order, page &block_start)
 
 	*candidate_slot = ((page_metadata *)target->base_address_ptr())->next_free;
 	((page_metadata *)target->base_address_ptr())->next_free = nullptr;
+	free_blocks_[order]--;
 
 	// target->next_free_ = nullptr;
 }
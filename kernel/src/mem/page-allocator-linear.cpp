@@ -18,17 +18,52 @@ struct page_metadata {
 
 static inline page_metadata *metadata(page *page) { return (page_metadata *)page->base_address_ptr(); }
 
+/**
+ * Adds a free block to (or removes it from) the statistics.  The linear allocator has no notion of
+ * orders, so each free block is counted under the largest order it could satisfy.  The first page
+ * of each block is never handed out.
+ */
+void page_allocator_linear::account_block(page *free_block, bool add)
+{
+	u64 usable_pages = metadata(free_block)->free_block_size - 1;
+	if (usable_pages == 0) {
+		return;
+	}
+
+	u64 order = min(log2(usable_pages), (u64)meminfo::max_orders - 1);
+
+	if (add) {
+		total_free_ += usable_pages;
+		free_blocks_[order]++;
+	} else {
+		total_free_ -= usable_pages;
+		free_blocks_[order]--;
+	}
+}
+
 void page_allocator_linear::insert_free_pages(page &range_start, u64 page_count)
 {
 	page **slot = &free_list_;
+	page *last = nullptr;
 
 	while (*slot) {
+		last = *slot;
 		slot = &(metadata(*slot)->next_free);
 	}
 
+	// Memory is inserted in small chunks during deferred initialisation, so a range that follows
+	// on from the last free block extends it, rather than becoming a block of its own.
+	if (last && last->pfn() + metadata(last)->free_block_size == range_start.pfn()) {
+		account_block(last, false);
+		metadata(last)->free_block_size += page_count;
+		account_block(last, true);
+		return;
+	}
+
 	*slot = &range_start;
 	metadata(&range_start)->next_free = nullptr;
 	metadata(&range_start)->free_block_size = page_count;
+	account_block(&range_start, true);
 }
 
 page *page_allocator_linear::allocate_pages(int order, page_allocation_flags flags)
@@ -45,7 +80,9 @@ page *page_allocator_linear::allocate_pages(int order, page_allocation_flags fla
 		// block from the list when it's fully used up, since metadata is stored at the start
 		// of the free block.
 		if ((metadata(free_block)->free_block_size - 1) >= page_count) {
+			account_block(free_block, false);
 			metadata(free_block)->free_block_size -= page_count;
+			account_block(free_block, true);
 
 			u64 start_pfn = free_block->pfn() + metadata(free_block)->free_block_size;
 			if ((flags & page_allocation_flags::zero) == page_allocation_flags::zero) {
@@ -63,7 +100,36 @@ page *page_allocator_linear::allocate_pages(int order, page_allocation_flags fla
 
 void page_allocator_linear::free_pages(page &base, int order)
 {
-	// TODO
+	u64 page_count = 1ull << order;
+
+	// Pages are handed out from the end of a free block, so freed pages usually follow straight
+	// on from one, and can simply be given back to it.  Pages that lead up to the start of a free
+	// block take over as the start of that block.
+	for (page **slot = &free_list_; *slot; slot = &(metadata(*slot)->next_free)) {
+		page *free_block = *slot;
+
+		if (free_block->pfn() + metadata(free_block)->free_block_size == base.pfn()) {
+			account_block(free_block, false);
+			metadata(free_block)->free_block_size += page_count;
+			account_block(free_block, true);
+			return;
+		}
+
+		if (base.pfn() + page_count == free_block->pfn()) {
+			account_block(free_block, false);
+			metadata(&base)->next_free = metadata(free_block)->next_free;
+			metadata(&base)->free_block_size = metadata(free_block)->free_block_size + page_count;
+			account_block(&base, true);
+			*slot = &base;
+			return;
+		}
+	}
+
+	// Otherwise, the pages become a free block of their own.
+	metadata(&base)->next_free = free_list_;
+	metadata(&base)->free_block_size = page_count;
+	account_block(&base, true);
+	free_list_ = &base;
 }
 
 void page_allocator_linear::dump() const
@@ -85,3 +151,13 @@ void page_allocator_linear::dump() const
 		free_block = metadata(free_block)->next_free;
 	}
 }
+
+void page_allocator_linear::collect_stats(meminfo &info) const
+{
+	info.nr_orders = meminfo::max_orders;
+	info.free_memory = total_free_ << PAGE_BITS;
+
+	for (int order = 0; order < meminfo::max_orders; order++) {
+		info.free_blocks[order] = free_blocks_[order];
+	}
+}
@@ -0,0 +1,105 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/arch/core.h>
+#include <stacsos/kernel/debug.h>
+#include <stacsos/kernel/mem/page-allocator-numa.h>
+#include <stacsos/kernel/mem/page.h>
+#include <stacsos/memops.h>
+
+using namespace stacsos;
+using namespace stacsos::kernel::mem;
+
+page_allocator_numa::page_allocator_numa(memory_manager &mm, numa_topology &topology, page_allocator **zones, int nr_zones)
+	: page_allocator(mm)
+	, topology_(topology)
+	, nr_zones_(nr_zones)
+{
+	for (int i = 0; i < nr_zones; i++) {
+		zones_[i] = zones[i];
+		allocations_[i] = 0;
+		remote_allocations_[i] = 0;
+	}
+}
+
+void page_allocator_numa::insert_free_pages(page &range_start, u64 page_count)
+{
+	u64 cur = range_start.base_address();
+	u64 end = cur + (page_count << PAGE_BITS);
+
+	// Hand each part of the range to the zone of the node it belongs to.
+	while (cur < end) {
+		u64 extent_end;
+		int node = topology_.node_extent_of_address(cur, extent_end);
+		extent_end = min(extent_end, end);
+
+		zones_[node]->insert_free_pages(page::get_from_base_address(cur), (extent_end - cur) >> PAGE_BITS);
+		cur = extent_end;
+	}
+}
+
+page *page_allocator_numa::allocate_pages(int order, page_allocation_flags flags)
+{
+	return allocate_pages_on_node(topology_.node_of_core(arch::core::this_core_id()), order, flags);
+}
+
+page *page_allocator_numa::allocate_pages_on_node(int node, int order, page_allocation_flags flags)
+{
+	const int *fallback = topology_.fallback_order(node);
+
+	for (int i = 0; i < nr_zones_; i++) {
+		int candidate = fallback[i];
+
+		page *pg = zones_[candidate]->allocate_pages(order, flags);
+		if (pg) {
+			allocations_[candidate]++;
+			if (candidate != node) {
+				remote_allocations_[node]++;
+			}
+
+			return pg;
+		}
+	}
+
+	return nullptr;
+}
+
+void page_allocator_numa::free_pages(page &base, int order)
+{
+	zones_[topology_.node_of_address(base.base_address())]->free_pages(base, order);
+}
+
+void page_allocator_numa::dump() const
+{
+	for (int node = 0; node < nr_zones_; node++) {
+		dprintf("*** node %d ***\n", node);
+		zones_[node]->dump();
+	}
+}
+
+void page_allocator_numa::collect_stats(meminfo &info) const
+{
+	info.nr_nodes = nr_zones_;
+
+	for (int node = 0; node < nr_zones_; node++) {
+		meminfo zone_info;
+		memops::bzero(&zone_info, sizeof(zone_info));
+		zones_[node]->collect_stats(zone_info);
+
+		info.nr_orders = max(info.nr_orders, zone_info.nr_orders);
+		info.free_memory += zone_info.free_memory;
+		for (u32 order = 0; order < zone_info.nr_orders; order++) {
+			info.free_blocks[order] += zone_info.free_blocks[order];
+		}
+
+		meminfo_node &node_info = info.nodes[node];
+		node_info.size = topology_.node_size(node);
+		node_info.free_memory = zone_info.free_memory;
+		node_info.allocations = allocations_[node];
+		node_info.remote_allocations = remote_allocations_[node];
+	}
+}
@@ -7,4 +7,50 @@
  */
 #include <stacsos/kernel/obj/object.h>
 
+using namespace stacsos::kernel;
 using namespace stacsos::kernel::obj;
+
+using namespace stacsos;
+
+/**
+ * Issues one operation per segment.  A failure is only reported if it happens before anything
+ * has been transferred.
+ */
+template <typename Operation> static operation_result for_each_segment(const io_segment *segments, size_t count, Operation op)
+{
+	operation_result failure = operation_result::not_supported();
+
+	u64 total;
+	bool ok = fs::for_each_io_segment(segments, count, total, [&](const io_segment &s, u64 &transferred) {
+		operation_result r = op(s);
+		if (r.code != operation_result_code::ok) {
+			failure = r;
+			return false;
+		}
+
+		transferred = r.data;
+		return true;
+	});
+
+	return ok ? operation_result::ok(total) : failure;
+}
+
+operation_result object::readv(const io_segment *segments, size_t count)
+{
+	return for_each_segment(segments, count, [this](const io_segment &s) { return read(s.buffer, s.length); });
+}
+
+operation_result object::preadv(const io_segment *segments, size_t count)
+{
+	return for_each_segment(segments, count, [this](const io_segment &s) { return pread(s.buffer, s.length, s.offset); });
+}
+
+operation_result object::writev(const io_segment *segments, size_t count)
+{
+	return for_each_segment(segments, count, [this](const io_segment &s) { return write(s.buffer, s.length); });
+}
+
+operation_result object::pwritev(const io_segment *segments, size_t count)
+{
+	return for_each_segment(segments, count, [this](const io_segment &s) { return pwrite(s.buffer, s.length, s.offset); });
+}
@@ -6,25 +6,32 @@
  * Tom Spink <tcs6@st-andrews.ac.uk>
  */
 #include <stacsos/kernel/debug.h>
+#include <stacsos/kernel/lock.h>
 #include <stacsos/kernel/sched/event.h>
 #include <stacsos/kernel/sched/thread.h>
 
+using namespace stacsos::kernel;
 using namespace stacsos::kernel::sched;
 
 template <bool AUTO_RESET> void event<AUTO_RESET>::wait()
 {
+	// Interrupts are disabled until this thread has been suspended, so that a trigger from an
+	// interrupt handler cannot be lost in between checking the event and going to sleep.
+	u64 flags = irq_save();
+
 	if (!AUTO_RESET && triggered_) {
+		irq_restore(flags);
 		return;
 	}
 
-	// TODO: Race Condition!
-
 	thread *ct = &thread::current();
 
 	wait_list_.append(ct);
 	ct->suspend();
 
 	asm volatile("int $0xff");
+
+	irq_restore(flags);
 }
 
 template <bool AUTO_RESET> void event<AUTO_RESET>::trigger()
@@ -24,6 +24,7 @@ thread::thread(process &owner, u64 ep, void *ep_arg, u64 user_stack)
 	, state_(thread_states::created)
 	, kernel_stack_(nullptr)
 	, user_stack_(user_stack)
+	, current_plug_(nullptr)
 {
 	init_tcb();
 	change_state(thread_states::created);
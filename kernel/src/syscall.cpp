@@ -17,7 +17,6 @@
 #include <stacsos/kernel/sched/sleeper.h>
 #include <stacsos/kernel/sched/thread.h>
 #include <stacsos/syscalls.h>
-#include <stacsos/kernel/fs/fat.h>
 
 using namespace stacsos;
 using namespace stacsos::kernel;
@@ -112,6 +111,29 @@ extern "C" syscall_result handle_syscall(syscall_numbers index, u64 arg0, u64 ar
 		return operation_result_to_syscall_result(o->pread((void *)arg1, arg2, arg3));
 	}
 
+	case syscall_numbers::readv:
+	case syscall_numbers::preadv:
+	case syscall_numbers::writev:
+	case syscall_numbers::pwritev: {
+		auto o = object_manager::get().get_object(current_process, arg0);
+		if (!o) {
+			return syscall_result { syscall_result_code::not_found, 0 };
+		}
+
+		const io_segment *segments = (const io_segment *)arg1;
+
+		switch (index) {
+		case syscall_numbers::readv:
+			return operation_result_to_syscall_result(o->readv(segments, arg2));
+		case syscall_numbers::preadv:
+			return operation_result_to_syscall_result(o->preadv(segments, arg2));
+		case syscall_numbers::writev:
+			return operation_result_to_syscall_result(o->writev(segments, arg2));
+		default:
+			return operation_result_to_syscall_result(o->pwritev(segments, arg2));
+		}
+	}
+
 	case syscall_numbers::ioctl: {
 		auto o = object_manager::get().get_object(current_process, arg0);
 		if (!o) {
@@ -121,12 +143,32 @@ extern "C" syscall_result handle_syscall(syscall_numbers index, u64 arg0, u64 ar
 		return operation_result_to_syscall_result(o->ioctl(arg1, (void *)arg2, arg3));
 	}
 
+	case syscall_numbers::fsync: {
+		auto o = object_manager::get().get_object(current_process, arg0);
+		if (!o) {
+			return syscall_result { syscall_result_code::not_found, 0 };
+		}
+
+		return operation_result_to_syscall_result(o->fsync());
+	}
+
 	case syscall_numbers::alloc_mem: {
 		auto rgn = current_thread.owner().addrspace().alloc_region(PAGE_ALIGN_UP(arg0), region_flags::readwrite, true);
+		if (!rgn) {
+			return syscall_result { syscall_result_code::not_supported, 0 };
+		}
 
 		return syscall_result { syscall_result_code::ok, rgn->base };
 	}
 
+	case syscall_numbers::free_mem: {
+		if (!current_thread.owner().addrspace().free_region(arg0)) {
+			return syscall_result { syscall_result_code::not_found, 0 };
+		}
+
+		return syscall_result { syscall_result_code::ok, 0 };
+	}
+
 	case syscall_numbers::start_process: {
 		dprintf("start process: %s %s\n", arg0, arg1);
 
@@ -201,13 +243,6 @@ extern "C" syscall_result handle_syscall(syscall_numbers index, u64 arg0, u64 ar
 			return syscall_result { syscall_result_code::not_supported, 0 };
 		}
 
-		// having guaranteed that the node is an exisiting directory,
-		// can cast to a fat_node, as we are also guaranteed FAT filesystem usage
-		auto *fat_dir = static_cast<fat_node *>(node);
-
-		// get the list of children of directory using helper method
-		auto &children = fat_dir->children();
-
 		// interpret second argument as pointer to list of directory entry structs,
 		// where their properties will be stored
 		auto *out_entries = reinterpret_cast<directory_entry *>(arg1);
@@ -221,17 +256,17 @@ extern "C" syscall_result handle_syscall(syscall_numbers index, u64 arg0, u64 ar
 		// PART OF OPTIMISATION: 2 PHASE API
 		// first call handler which just returns number of entries
 		if (out_entries == nullptr && max_entries == 0) {
-			for (auto child : children) {
+			while (node->child_at(count)) {
 				count++;
 			}
 			return syscall_result { syscall_result_code::ok, count };
 		}
 
-		// iterate over children list, making each a directory entry struct 
+		// iterate over children, making each a directory entry struct
 		// with its properties (name, size, type)
-		for (auto child : children) {
-			// check if entries limit is passed
-			if (count >= max_entries) {
+		while (count < max_entries) {
+			auto *child = node->child_at(count);
+			if (!child) {
 				break;
 			}
 
@@ -239,15 +274,11 @@ extern "C" syscall_result handle_syscall(syscall_numbers index, u64 arg0, u64 ar
 			directory_entry entry{};
 			
 			// appropriately copy child name 
-			const char *name = child->name().c_str();
-			if (!name) { // fallback: if name null, name will be empty string
-				name = "";
-			}
-			memops::strncpy(entry.name, name, sizeof(entry.name) - 1); // use given stacsos string copy method
+			memops::strncpy(entry.name, child->name().c_str(), sizeof(entry.name) - 1); // use given stacsos string copy method
 			entry.name[sizeof(entry.name) - 1] = '\0'; // manually ensure null-termination
 
 			// get entry's size and type (0 for file or 1 for directory)
-			entry.size = child->data_size();
+			entry.size = child->size();
 			entry.type = (child->kind() == fs_node_kind::directory) ? 1 : 0;
 
 			// add entry to list and increment counter
@@ -259,6 +290,49 @@ extern "C" syscall_result handle_syscall(syscall_numbers index, u64 arg0, u64 ar
 		return syscall_result { syscall_result_code::ok, count };
 	}
 
+	case syscall_numbers::getdents: {
+		auto node = vfs::get().lookup((const char *)arg0);
+		if (!node) {
+			return syscall_result { syscall_result_code::not_found, 0 };
+		}
+
+		if (node->kind() != fs_node_kind::directory) {
+			return syscall_result { syscall_result_code::not_supported, 0 };
+		}
+
+		u8 *buffer = (u8 *)arg1;
+		u64 length = arg2;
+		u64 *cursor = (u64 *)arg3;
+
+		// Pack as many records as will fit, starting from the cursor, and advance the cursor past
+		// them.  Nothing written (with an ok result) means the end of the directory was reached.
+		u64 offset = 0;
+		while (auto *child = node->child_at(*cursor)) {
+			u64 name_length = child->name().length();
+			u64 record_length = (sizeof(dirent) + name_length + 1 + 7) & ~7ull;
+
+			if (offset + record_length > length) {
+				if (offset == 0) {
+					// The buffer cannot hold even one record -- report the size needed.
+					return syscall_result { syscall_result_code::buffer_too_small, record_length };
+				}
+
+				break;
+			}
+
+			dirent *entry = (dirent *)&buffer[offset];
+			entry->size = child->size();
+			entry->record_length = record_length;
+			entry->type = (child->kind() == fs_node_kind::directory) ? 1 : 0;
+			memops::memcpy(entry->name, child->name().c_str(), name_length + 1);
+
+			offset += record_length;
+			(*cursor)++;
+		}
+
+		return syscall_result { syscall_result_code::ok, offset };
+	}
+
 	default:
 		dprintf("ERROR: unsupported syscall: %lx\n", index);
 		return syscall_result { syscall_result_code::not_supported, 0 };
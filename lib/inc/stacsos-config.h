@@ -1,3 +1,7 @@
 #pragma once
 
 #define USE_FSGSBASE
+
+// Records the call site of every kernel heap allocation, which can then be read from
+// /dev/allocinfo.  This adds overhead to every allocation, so is disabled by default.
+// #define USE_ALLOC_TRACKER
@@ -22,27 +22,22 @@ public:
 		, data_(data)
 		, left_(nullptr)
 		, right_(nullptr)
+		, height_(1)
 	{
 	}
 
-	int height() const
-	{
-		int lh = left_ == nullptr ? 0 : left_->height();
-		int rh = right_ == nullptr ? 0 : right_->height();
-
-		return max(lh, rh) + 1;
-	}
-
-	int balance_factor() const
-	{
-		int lh = left_ == nullptr ? 0 : left_->height();
-		int rh = right_ == nullptr ? 0 : right_->height();
+	int height() const { return height_; }
+	int balance_factor() const { return node_height(left_) - node_height(right_); }
 
-		return lh - rh;
-	}
+	/**
+	 * @brief Recomputes the cached height of this node from its children.  Must be
+	 * called whenever a child pointer changes.
+	 */
+	void update_height() { height_ = max(node_height(left_), node_height(right_)) + 1; }
 
 	const K &key() const { return key_; }
 	const D &data() const { return data_; }
+	void data(const D &data) { data_ = data; }
 
 	avl_tree_node *left() const { return left_; }
 	avl_tree_node *right() const { return right_; }
@@ -55,6 +50,9 @@ private:
 	D data_;
 
 	avl_tree_node *left_, *right_;
+	int height_;
+
+	static int node_height(const avl_tree_node *n) { return n == nullptr ? 0 : n->height_; }
 };
 
 template <class N> struct avl_tree_iterator_pair {
@@ -126,10 +124,45 @@ public:
 
 	avl_tree()
 		: root_(nullptr)
+		, count_(0)
+	{
+	}
+
+	~avl_tree() { do_clear(root_); }
+
+	void add(const K &key, const D &data)
+	{
+		root_ = do_insert(root_, key, data);
+		count_++;
+	}
+
+	/**
+	 * @brief Removes the node with the given key from the tree.
+	 *
+	 * @param key The key to remove.
+	 * @return true if a node was removed, false if the key was not present.
+	 */
+	bool remove(const K &key)
+	{
+		bool removed = false;
+		root_ = do_remove(root_, key, removed);
+
+		if (removed) {
+			count_--;
+		}
+
+		return removed;
+	}
+
+	void clear()
 	{
+		do_clear(root_);
+		root_ = nullptr;
+		count_ = 0;
 	}
 
-	void add(const K &key, const D &data) { root_ = do_insert(root_, key, data); }
+	u64 count() const { return count_; }
+	bool empty() const { return root_ == nullptr; }
 
 	bool try_get_value(const K &key, D &data)
 	{
@@ -148,6 +181,70 @@ public:
 		return false;
 	}
 
+	/**
+	 * @brief Finds the node with the greatest key that is less than or equal to the given key.
+	 *
+	 * @param key The key to search for.
+	 * @param found_key Receives the key of the node that was found.
+	 * @param data Receives the data of the node that was found.
+	 * @return true if such a node exists, false otherwise.
+	 */
+	bool try_get_floor(const K &key, K &found_key, D &data) const
+	{
+		node *ref = root_, *best = nullptr;
+		while (ref) {
+			if (ref->key() == key) {
+				best = ref;
+				break;
+			} else if (key < ref->key()) {
+				ref = ref->left();
+			} else {
+				best = ref;
+				ref = ref->right();
+			}
+		}
+
+		if (best == nullptr) {
+			return false;
+		}
+
+		found_key = best->key();
+		data = best->data();
+		return true;
+	}
+
+	/**
+	 * @brief Finds the node with the smallest key that is greater than or equal to the given key.
+	 *
+	 * @param key The key to search for.
+	 * @param found_key Receives the key of the node that was found.
+	 * @param data Receives the data of the node that was found.
+	 * @return true if such a node exists, false otherwise.
+	 */
+	bool try_get_ceiling(const K &key, K &found_key, D &data) const
+	{
+		node *ref = root_, *best = nullptr;
+		while (ref) {
+			if (ref->key() == key) {
+				best = ref;
+				break;
+			} else if (key < ref->key()) {
+				best = ref;
+				ref = ref->left();
+			} else {
+				ref = ref->right();
+			}
+		}
+
+		if (best == nullptr) {
+			return false;
+		}
+
+		found_key = best->key();
+		data = best->data();
+		return true;
+	}
+
 	void dump() const { do_dump(root_); }
 
 	const_iterator begin() const { return const_iterator(root_); }
@@ -155,6 +252,7 @@ public:
 
 private:
 	node *root_;
+	u64 count_;
 
 	node *alloc_node(const K &key, const D &data) { return new node(key, data); }
 
@@ -163,6 +261,9 @@ private:
 		node *t = ref->left();
 		ref->left(t->right());
 		t->right(ref);
+
+		ref->update_height();
+		t->update_height();
 		return t;
 	}
 
@@ -186,14 +287,18 @@ private:
 		ref->right(t->left());
 		t->left(ref);
 
+		ref->update_height();
+		t->update_height();
 		return t;
 	}
 
 	node *balance(node *ref)
 	{
+		ref->update_height();
+
 		int bf = ref->balance_factor();
 		if (bf > 1) {
-			if (ref->left()->balance_factor() > 0) {
+			if (ref->left()->balance_factor() >= 0) {
 				return ll_rot(ref);
 			} else {
 				return lr_rot(ref);
@@ -221,5 +326,59 @@ private:
 			return balance(ref);
 		}
 	}
+
+	node *do_remove(node *ref, const K &key, bool &removed)
+	{
+		if (ref == nullptr) {
+			return nullptr;
+		}
+
+		if (ref->key() == key) {
+			removed = true;
+
+			node *l = ref->left();
+			node *r = ref->right();
+			delete ref;
+
+			if (r == nullptr) {
+				return l;
+			}
+
+			// Replace the removed node with its in-order successor.
+			node *successor;
+			r = detach_min(r, successor);
+			successor->left(l);
+			successor->right(r);
+			return balance(successor);
+		} else if (key < ref->key()) {
+			ref->left(do_remove(ref->left(), key, removed));
+		} else {
+			ref->right(do_remove(ref->right(), key, removed));
+		}
+
+		return balance(ref);
+	}
+
+	node *detach_min(node *ref, node *&min_node)
+	{
+		if (ref->left() == nullptr) {
+			min_node = ref;
+			return ref->right();
+		}
+
+		ref->left(detach_min(ref->left(), min_node));
+		return balance(ref);
+	}
+
+	void do_clear(node *ref)
+	{
+		if (ref == nullptr) {
+			return;
+		}
+
+		do_clear(ref->left());
+		do_clear(ref->right());
+		delete ref;
+	}
 };
 } // namespace stacsos
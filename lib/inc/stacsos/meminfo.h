@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Utility Library
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+namespace stacsos {
+struct meminfo_slab_cache {
+	u64 object_size; // size of each object in the cache, in bytes
+	u64 nr_slabs; // number of slabs currently held by the cache
+	u64 objects_in_use; // number of objects currently allocated
+	u64 objects_capacity; // number of objects the current slabs can hold
+} __packed;
+
+struct meminfo_node {
+	u64 size; // memory attributed to the node by the firmware
+	u64 free_memory; // memory currently free in the node
+	u64 allocations; // page allocations served from the node
+	u64 remote_allocations; // page allocations requested on the node, but served by another
+} __packed;
+
+/*
+ * A snapshot of the kernel's memory statistics, returned by reading the meminfo device.  All
+ * sizes are in bytes, unless otherwise noted.
+ */
+struct meminfo {
+	static const int max_orders = 17;
+	static const int max_slab_caches = 8;
+	static const int max_nodes = 8;
+
+	u64 total_memory; // memory managed by the page allocator
+	u64 free_memory; // memory currently free in the page allocator
+
+	u32 nr_orders; // number of valid entries in the per-order arrays
+	u64 free_blocks[max_orders]; // number of free blocks of each order
+	u16 unusable_free_index[max_orders]; // per-mille of free memory that cannot satisfy an allocation of each order
+
+	u32 nr_slab_caches;
+	meminfo_slab_cache slab_caches[max_slab_caches];
+
+	u64 loa_region_size; // size of the large object allocator's virtual region
+	u64 loa_mapped; // amount of the large object allocator's region that has been mapped
+	u64 loa_live_objects; // number of large objects currently allocated
+
+	u64 page_table_pages; // number of pages in use as page tables
+
+	u64 bcache_memory; // memory holding cached block device data
+	u64 bcache_hits; // block cache lookups satisfied from memory
+	u64 bcache_misses; // block cache lookups that went to the device
+	u64 bcache_evictions; // cached buffers recycled to make room for others
+	u64 bcache_writebacks; // dirty buffers written back to the device
+	u64 bcache_prefetches; // buffers read ahead of being asked for
+
+	u32 nr_nodes;
+	meminfo_node nodes[max_nodes];
+} __packed;
+} // namespace stacsos
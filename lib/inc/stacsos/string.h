@@ -61,7 +61,7 @@ public:
 		: size_(str.size_)
 		, data_(str.data_)
 		, has_hash_(str.has_hash_)
-		, hash_(str.has_hash_)
+		, hash_(str.hash_)
 	{
 		str.data_ = nullptr;
 		str.size_ = 0;
@@ -8,7 +8,7 @@
 #pragma once
 
 namespace stacsos {
-enum class syscall_result_code : u64 { ok = 0, not_found = 1, not_supported = 2 };
+enum class syscall_result_code : u64 { ok = 0, not_found = 1, not_supported = 2, buffer_too_small = 3 };
 
 enum class syscall_numbers {
 	exit = 0,
@@ -29,9 +29,36 @@ enum class syscall_numbers {
 	sleep = 15,
 	poweroff = 16,
 	ioctl = 17,
-	listdir = 18 // P3: new system call for listing directories
+	listdir = 18, // P3: new system call for listing directories
+	free_mem = 19,
+	fsync = 20,
+	getdents = 21,
+	readv = 22,
+	writev = 23,
+	preadv = 24,
+	pwritev = 25
 };
 
+// ioctl commands understood by files on block device backed filesystems.
+enum class file_ioctl_cmd : u64 { get_readahead = 0x100, set_readahead = 0x101, enable_direct_io = 0x102, disable_direct_io = 0x103 };
+
+// Read-ahead tuning for an open file, used with the get_readahead and set_readahead ioctls.
+struct readahead_params {
+	u64 min_window; // smallest read-ahead window, in bytes
+	u64 max_window; // largest read-ahead window, in bytes, or zero to disable read-ahead
+	u64 window; // current read-ahead window, in bytes (ignored by set_readahead)
+	u64 hits; // reads whose data had already been read ahead (ignored by set_readahead)
+	u64 misses; // reads that had to wait for the device (ignored by set_readahead)
+} __packed;
+
+// One segment of a vectored read or write.  The offset is only used by preadv and pwritev; readv
+// and writev transfer the segments back to back from the object's current position.
+struct io_segment {
+	void *buffer;
+	u64 length;
+	u64 offset;
+} __packed;
+
 struct syscall_result {
 	syscall_result_code code;
 	u64 data;
@@ -44,4 +71,13 @@ struct directory_entry {
 	u64 size; // file size: in bytes of files, can be 0 for directories
 	u8 type; // type of file: 0 for file or 1 for directory
 } __packed;
+
+// A directory entry returned by getdents.  Records are variable length and packed back to back,
+// each padded so that the next begins on an 8-byte boundary.
+struct dirent {
+	u64 size; // file size in bytes, can be 0 for directories
+	u16 record_length; // length of this record in bytes, including the name and padding
+	u8 type; // type of file: 0 for file or 1 for directory
+	char name[]; // null-terminated name
+} __packed;
 } // namespace stacsos
@@ -66,16 +66,27 @@ static void logo()
 		object *fb = object::open("/dev/virtcon0");
 		const u8 *pixel_data = (const u8 *)logo_data;
 
+		// Convert the logo to screen pixels, and draw it with a single pwritev of one segment per row.
+		u32 *pixels = new u32[width * height];
+		io_segment *rows = new io_segment[height];
+
 		for (int y = 0; y < height; y++) {
 			for (int x = 0; x < width; x++) {
 				u32 data_pixel_offset = (x + (y * width)) * 3;
-				u32 screen_pixel_offset = (x + ((640 - width) / 2)) + (y * 640);
-
-				u32 pixel = pixel_data[data_pixel_offset] << 16 | pixel_data[data_pixel_offset + 1] << 8 | pixel_data[data_pixel_offset + 2] << 0;
 
-				fb->pwrite((const void *)&pixel, 4, screen_pixel_offset);
+				pixels[x + (y * width)]
+					= pixel_data[data_pixel_offset] << 16 | pixel_data[data_pixel_offset + 1] << 8 | pixel_data[data_pixel_offset + 2] << 0;
 			}
+
+			rows[y].buffer = &pixels[y * width];
+			rows[y].length = width * sizeof(u32);
+			rows[y].offset = ((640 - width) / 2) + (y * 640);
 		}
+
+		fb->pwritev(rows, height);
+
+		delete[] rows;
+		delete[] pixels;
 	}
 }
 
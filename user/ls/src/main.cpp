@@ -16,6 +16,53 @@ static void print_usage() {
 	console::get().write("error: usage: ls [-l or -n or -s or -ln or -ls] <path>\n");
 }
 
+// buffer that directory entries are read into, a batch at a time
+static u8 batch[4096];
+
+// print a single directory entry, with appropriate info (depending on flag)
+static void print_entry(const dirent &e, bool long_mode, u64 max_name_len)
+{
+	// skip entries "." and ".." (current and parent dirs)
+	if (memops::strcmp(e.name, ".") == 0 || memops::strcmp(e.name, "..") == 0) {
+		return;
+	}
+
+	// if "-l" isn't given, just print file names
+	if (!long_mode) {
+		console::get().writef("%s\n", e.name);
+		return;
+	}
+
+	// if it is, print file type, name and size nicely alligned
+	char type_char = (e.type == 1) ? 'D' : 'F'; // as type is defined as 0 for file and 1 for directory
+
+	// first just write type and name
+	console::get().writef("[%c] %s", type_char, e.name);
+
+	if (e.type == 1) { // if dir, no size
+		console::get().write("\n");
+		return;
+	}
+
+	// if file, first pad with whitespaces, then print size
+	// calculate number of spaces needed
+	u64 name_len = memops::strlen(e.name);
+	u64 padding = 5; // min distance of 5 spaces
+
+	// padding is difference between max length and this name's length
+	if (max_name_len > name_len) {
+		padding += (max_name_len - name_len);
+	}
+
+	// print calculated number of spaces
+	for (u64 p = 0; p < padding; p++) {
+		console::get().write(" ");
+	}
+
+	// print alligned size
+	console::get().writef("%lu\n", e.size);
+}
+
 // main method to return the list of directories
 int main(const char *cmdline) {
     // if no command lines arguments were provided, print accepted usage
@@ -98,61 +145,85 @@ int main(const char *cmdline) {
     // extracted path from args
 	const char *path = cmdline;
 
-	// OPTIMISATION: 2 PHASE API
+	// Entries are read from the kernel a batch at a time, with a cursor recording how far through
+	// the directory we are.  Plain listings print each batch as it arrives, so memory use does
+	// not grow with the size of the directory.  Sorting, and aligning sizes in long mode, need to
+	// see every entry first, so in those modes the records are collected.
+	bool collect = long_mode || mode != sort_mode::none;
 
-	// first call to get how many entries are there from kernel
-	auto res1 = syscalls::listdir(path, nullptr, 0);
+	u8 *records = nullptr;
+	u64 records_length = 0, records_capacity = 0;
+	u64 count = 0;
 
-    // analyse possible error results
-	if (res1.code == syscall_result_code::not_found) {
-		console::get().writef("error: path '%s' not found\n", path);
-		return 1;
-	} else if (res1.code == syscall_result_code::not_supported) {
-		console::get().writef("error: path '%s' is not a directory\n", path);
-		return 1;
-	} else if (res1.code != syscall_result_code::ok) {
-		console::get().writef("error: listdir failed for '%s'\n", path);
-		return 1;
-	}
+	u64 cursor = 0;
+	while (true) {
+		auto res = syscalls::getdents(path, batch, sizeof(batch), &cursor);
 
-	// get number of entries
-	u64 count = res1.length;
+		// analyse possible error results
+		if (res.code == syscall_result_code::not_found) {
+			console::get().writef("error: path '%s' not found\n", path);
+			return 1;
+		} else if (res.code == syscall_result_code::not_supported) {
+			console::get().writef("error: path '%s' is not a directory\n", path);
+			return 1;
+		} else if (res.code != syscall_result_code::ok) {
+			console::get().writef("error: listdir failed for '%s'\n", path);
+			return 1;
+		}
 
-	// knowing number of entries, only have to allocate exactly enough 
-	// space for all directory entries in user memory
-	// (instead of having static limit)
-	u64 bytes = count * sizeof(directory_entry);
-	auto alloc = syscalls::alloc_mem(bytes);
+		// no more entries
+		if (res.length == 0) {
+			break;
+		}
 
-	// check allocation successful
-	if (alloc.code != syscall_result_code::ok || alloc.ptr == nullptr) {
-		console::get().write("error: memory allocation for directory entries failed\n");
-		return 1;
-	}
+		if (!collect) {
+			for (u64 offset = 0; offset < res.length;) {
+				auto *e = (const dirent *)&batch[offset];
+				print_entry(*e, false, 0);
+				offset += e->record_length;
+			}
 
-	// interpret pointer to the allocated array of directory entry structs
-	auto *entries = reinterpret_cast<directory_entry *>(alloc.ptr);
+			continue;
+		}
 
-	// second call to actually get the directory entries into the buffer
-	auto res2 = syscalls::listdir(path, entries, count);
+		// append this batch to the collected records, growing the storage as needed
+		if (records_length + res.length > records_capacity) {
+			records_capacity = (records_capacity ? records_capacity * 2 : sizeof(batch)) + res.length;
 
-	// check call sussessful
-	if (res2.code != syscall_result_code::ok) {
-		console::get().writef("error: listdir failed for '%s'\n", path);
-		return 1;
+			u8 *new_records = new u8[records_capacity];
+			if (records) {
+				memops::memcpy(new_records, records, records_length);
+				delete[] records;
+			}
+
+			records = new_records;
+		}
+
+		memops::memcpy(&records[records_length], batch, res.length);
+		records_length += res.length;
+
+		for (u64 offset = 0; offset < res.length; offset += ((const dirent *)&batch[offset])->record_length) {
+			count++;
+		}
 	}
 
-	// number of entries actually written
-	// if works correctly should be equal to count
-	u64 actual = res2.length;
+	if (!collect) {
+		return 0;
+	}
+
+	// index the collected records, so that they can be sorted
+	const dirent **entries = new const dirent *[count];
+
+	u64 index = 0;
+	for (u64 offset = 0; offset < records_length; offset += entries[index++]->record_length) {
+		entries[index] = (const dirent *)&records[offset];
+	}
 
 	// calculate the biggest name length for proper allignment in output
 	u64 max_name_len = 0;
 	if (long_mode) {
-		for (u64 i = 0; i < actual; i++) {
-			auto &e = entries[i];
-
-			u64 name_len = memops::strlen(e.name);
+		for (u64 i = 0; i < count; i++) {
+			u64 name_len = memops::strlen(entries[i]->name);
 			if (name_len > max_name_len) {
 				max_name_len = name_len;
 			}
@@ -162,20 +233,20 @@ int main(const char *cmdline) {
 	// sort by name or size if flags given
 	// using selection sort O(n^2)
 	if (mode == sort_mode::name) {
-		for (u64 i = 0; i + 1 < actual; i++) {
-			for (u64 j = i + 1; j < actual; j++) {
-				if (memops::strcmp(entries[i].name, entries[j].name) > 0) {
-					directory_entry tmp = entries[i];
+		for (u64 i = 0; i + 1 < count; i++) {
+			for (u64 j = i + 1; j < count; j++) {
+				if (memops::strcmp(entries[i]->name, entries[j]->name) > 0) {
+					const dirent *tmp = entries[i];
 					entries[i] = entries[j];
 					entries[j] = tmp;
 				}
 			}
 		}
 	} else if (mode == sort_mode::size) {
-		for (u64 i = 0; i + 1 < actual; i++) {
-			for (u64 j = i + 1; j < actual; j++) {
-				if (entries[i].size > entries[j].size) { // smallest to biggest
-					directory_entry tmp = entries[i];
+		for (u64 i = 0; i + 1 < count; i++) {
+			for (u64 j = i + 1; j < count; j++) {
+				if (entries[i]->size > entries[j]->size) { // smallest to biggest
+					const dirent *tmp = entries[i];
 					entries[i] = entries[j];
 					entries[j] = tmp;
 				}
@@ -183,45 +254,12 @@ int main(const char *cmdline) {
 		}
 	}
 
-    // iterate over list of entries, printing each with appropriate info (depending on flag)
-	for (u64 i = 0; i < actual; i++) {
-		auto &e = entries[i];
-
-		// skip entries "." and ".." (current and parent dirs)
-		if (memops::strcmp(e.name, ".") == 0 || memops::strcmp(e.name, "..") == 0) {
-			continue;
-		}
-
-		// if "-l" isn't given, just print file names
-		if (!long_mode) {
-            console::get().writef("%s\n", e.name);
-		} else { // if it is, print file type, name and size nicely alligned
-			char type_char = (e.type == 1) ? 'D' : 'F'; // as type is defined as 0 for file and 1 for directory
-			
-			// first just write type and name
-			console::get().writef("[%c] %s", type_char, e.name);
-
-			if (e.type == 1) { // if dir, no size
-				console::get().write("\n");
-			} else { // if file, first pad with whitespaces, then print size
-				// calculate number of spaces needed 
-				u64 name_len = memops::strlen(e.name);
-				u64 padding = 5; // min distance of 5 spaces
-
-				// padding is difference between max length and this name's length
-				if (max_name_len > name_len) {
-					padding += (max_name_len - name_len);
-				}
+	for (u64 i = 0; i < count; i++) {
+		print_entry(*entries[i], long_mode, max_name_len);
+	}
 
-				// print calculated number of spaces
-				for (u64 p = 0; p < padding; p++) {
-					console::get().write(" ");
-				}
+	delete[] entries;
+	delete[] records;
 
-				// print alligned size
-				console::get().writef("%lu\n", e.size);
-			}
-		}
-	}
 	return 0;
 }
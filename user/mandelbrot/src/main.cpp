@@ -55,45 +55,72 @@ u32 last_pixel;
 
 object *fb;
 
-static void drawchar(int x, int y, int attr, unsigned char c)
+// Characters are drawn in batches, so that each thread makes one pwritev per batch rather than
+// one pwrite per character.
+struct cell_batch {
+	static const int capacity = 16;
+
+	u16 cells[capacity];
+	io_segment segments[capacity];
+	int count = 0;
+
+	void flush()
+	{
+		if (count) {
+			fb->pwritev(segments, count);
+			count = 0;
+		}
+	}
+};
+
+static void drawchar(cell_batch &batch, int x, int y, int attr, unsigned char c)
 {
-	u16 u = (attr << 8) | c;
-	fb->pwrite((const char *)&u, sizeof(u), x + (y * 80));
+	int i = batch.count++;
+
+	batch.cells[i] = (attr << 8) | c;
+	batch.segments[i].buffer = &batch.cells[i];
+	batch.segments[i].length = sizeof(u16);
+	batch.segments[i].offset = x + (y * 80);
+
+	if (batch.count == cell_batch::capacity) {
+		batch.flush();
+	}
 }
 
-void output(int value, int i, int j)
+void output(cell_batch &batch, int value, int i, int j)
 {
 	if (value == 10000000) {
-		drawchar(j, i, BLACK, ' ');
+		drawchar(batch, j, i, BLACK, ' ');
 	} else if (value > 9000000) {
-		drawchar(j, i, RED, '*');
+		drawchar(batch, j, i, RED, '*');
 	} else if (value > 5000000) {
-		drawchar(j, i, L_RED, '*');
+		drawchar(batch, j, i, L_RED, '*');
 	} else if (value > 1000000) {
-		drawchar(j, i, ORANGE, '*');
+		drawchar(batch, j, i, ORANGE, '*');
 	} else if (value > 500) {
-		drawchar(j, i, YELLOW, '*');
+		drawchar(batch, j, i, YELLOW, '*');
 	} else if (value > 100) {
-		drawchar(j, i, L_GREEN, '*');
+		drawchar(batch, j, i, L_GREEN, '*');
 	} else if (value > 10) {
-		drawchar(j, i, GREEN, '*');
+		drawchar(batch, j, i, GREEN, '*');
 	} else if (value > 5) {
-		drawchar(j, i, L_CYAN, '*');
+		drawchar(batch, j, i, L_CYAN, '*');
 	} else if (value > 4) {
-		drawchar(j, i, CYAN, '*');
+		drawchar(batch, j, i, CYAN, '*');
 	} else if (value > 3) {
-		drawchar(j, i, L_BLUE, '*');
+		drawchar(batch, j, i, L_BLUE, '*');
 	} else if (value > 2) {
-		drawchar(j, i, BLUE, '*');
+		drawchar(batch, j, i, BLUE, '*');
 	} else if (value > 1) {
-		drawchar(j, i, MAGENTA, '*');
+		drawchar(batch, j, i, MAGENTA, '*');
 	} else {
-		drawchar(j, i, L_MAGENTA, '*');
+		drawchar(batch, j, i, L_MAGENTA, '*');
 	}
 }
 
 static void *mandelbrot(void *arg)
 {
+	cell_batch batch;
 	u32 my_next_pixel = next_pixel++;
 
 	while (my_next_pixel <= last_pixel) {
@@ -119,10 +146,12 @@ static void *mandelbrot(void *arg)
 			real = realq - imagq + real0;
 		}
 
-		output(count, y, x);
+		output(batch, count, y, x);
 		my_next_pixel = next_pixel++;
 	}
 
+	batch.flush();
+
 	return nullptr;
 }
 
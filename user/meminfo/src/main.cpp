@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - meminfo utility
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/console.h>
+#include <stacsos/meminfo.h>
+#include <stacsos/memops.h>
+#include <stacsos/objects.h>
+#include <stacsos/user-syscall.h>
+
+using namespace stacsos;
+
+static void print_meminfo(const meminfo &info)
+{
+	console::get().writef("total: %lu kB, free: %lu kB, page tables: %lu kB\n", info.total_memory / 1024, info.free_memory / 1024,
+		info.page_table_pages * (PAGE_SIZE / 1024));
+
+	console::get().write("order  free-blocks  unusable\n");
+	for (u32 order = 0; order < info.nr_orders; order++) {
+		u16 index = info.unusable_free_index[order];
+		console::get().writef("   %2u  %11lu     %u.%03u\n", order, info.free_blocks[order], index / 1000, index % 1000);
+	}
+
+	console::get().write(" size  slabs     in-use   capacity\n");
+	for (u32 i = 0; i < info.nr_slab_caches; i++) {
+		const meminfo_slab_cache &c = info.slab_caches[i];
+		console::get().writef("%5lu  %5lu  %9lu  %9lu\n", c.object_size, c.nr_slabs, c.objects_in_use, c.objects_capacity);
+	}
+
+	console::get().writef("large objects: %lu live, %lu kB mapped of %lu kB\n", info.loa_live_objects, info.loa_mapped / 1024, info.loa_region_size / 1024);
+
+	console::get().writef("block cache: %lu kB, %lu hits, %lu misses, %lu evictions, %lu writebacks, %lu prefetches\n", info.bcache_memory / 1024,
+		info.bcache_hits, info.bcache_misses, info.bcache_evictions, info.bcache_writebacks, info.bcache_prefetches);
+
+	console::get().write("node     size kB     free kB  allocations  remote\n");
+	for (u32 node = 0; node < info.nr_nodes; node++) {
+		const meminfo_node &n = info.nodes[node];
+		console::get().writef("%4u  %10lu  %10lu  %11lu  %6lu\n", node, n.size / 1024, n.free_memory / 1024, n.allocations, n.remote_allocations);
+	}
+}
+
+int main(const char *cmdline)
+{
+	bool watch = cmdline && memops::strcmp(cmdline, "-w") == 0;
+
+	object *dev = object::open("/dev/meminfo");
+	if (!dev) {
+		console::get().write("error: unable to open /dev/meminfo\n");
+		return 1;
+	}
+
+	do {
+		meminfo info;
+		if (dev->pread(&info, sizeof(info), 0) != sizeof(info)) {
+			console::get().write("error: unable to read memory statistics\n");
+			delete dev;
+			return 1;
+		}
+
+		print_meminfo(info);
+
+		if (watch) {
+			syscalls::sleep(1000);
+		}
+	} while (watch);
+
+	delete dev;
+	return 0;
+}
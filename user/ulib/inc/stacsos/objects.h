@@ -7,6 +7,8 @@
  */
 #pragma once
 
+#include <stacsos/syscalls.h>
+
 namespace stacsos {
 class object {
 public:
@@ -20,8 +22,15 @@ public:
 	size_t read(void *buffer, size_t length);
 	size_t pread(void *buffer, size_t length, size_t offset);
 
+	size_t readv(const io_segment *segments, size_t count);
+	size_t writev(const io_segment *segments, size_t count);
+	size_t preadv(const io_segment *segments, size_t count);
+	size_t pwritev(const io_segment *segments, size_t count);
+
 	u64 ioctl(u64 cmd, void *buffer, size_t length);
 
+	bool fsync();
+
 private:
 	u64 handle_;
 
@@ -64,6 +64,35 @@ public:
 		return rw_result { r.code, r.data };
 	}
 
+	// Vectored reads and writes, which transfer each of the given segments in turn with a single
+	// system call.  readv and writev ignore the segment offsets, and use the object's current
+	// position.  Returns the total number of bytes transferred.
+	static rw_result readv(u64 object, const io_segment *segments, u64 count)
+	{
+		auto r = syscall3(syscall_numbers::readv, object, (u64)segments, count);
+		return rw_result { r.code, r.data };
+	}
+
+	static rw_result writev(u64 object, const io_segment *segments, u64 count)
+	{
+		auto r = syscall3(syscall_numbers::writev, object, (u64)segments, count);
+		return rw_result { r.code, r.data };
+	}
+
+	static rw_result preadv(u64 object, const io_segment *segments, u64 count)
+	{
+		auto r = syscall3(syscall_numbers::preadv, object, (u64)segments, count);
+		return rw_result { r.code, r.data };
+	}
+
+	static rw_result pwritev(u64 object, const io_segment *segments, u64 count)
+	{
+		auto r = syscall3(syscall_numbers::pwritev, object, (u64)segments, count);
+		return rw_result { r.code, r.data };
+	}
+
+	static syscall_result_code fsync(u64 object) { return syscall1(syscall_numbers::fsync, object).code; }
+
 	static rw_result ioctl(u64 object, u64 cmd, void *buffer, u64 length)
 	{
 		auto r = syscall4(syscall_numbers::ioctl, object, cmd, (u64)buffer, length);
@@ -76,6 +105,8 @@ public:
 		return alloc_result { r.code, (void *)r.data };
 	}
 
+	static syscall_result_code free_mem(void *ptr) { return syscall1(syscall_numbers::free_mem, (u64)ptr).code; }
+
 	// P3: listdir system call wrapper
 	// arg0: given path of directory to list
 	// arg1: pointer to list of directory entry structs
@@ -85,6 +116,15 @@ public:
 		return rw_result { r.code, r.data };
 	}
 
+	// Reads entries of the directory at the given path into the buffer, as packed dirent records,
+	// starting from the cursor (which should initially be zero) and advancing it.  Returns the
+	// number of bytes written, which is zero once the end of the directory has been reached.
+	static rw_result getdents(const char *path, void *buffer, u64 length, u64 *cursor)
+	{
+		auto r = syscall4(syscall_numbers::getdents, (u64)path, (u64)buffer, length, (u64)cursor);
+		return rw_result { r.code, r.data };
+	}
+
 	static syscall_result start_process(const char *path, const char *args) { return syscall2(syscall_numbers::start_process, (u64)path, (u64)args); }
 	static syscall_result wait_process(u64 id) { return syscall1(syscall_numbers::wait_for_process, id); }
 
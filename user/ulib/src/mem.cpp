@@ -55,8 +55,51 @@ struct memory_block {
 	void *ptr() { return (void *)((u64)this + sizeof(this)); }
 };
 
+/*
+ * Large allocations are given a region of their own, so that they can be handed straight back to
+ * the kernel when they are freed.  They are identified by a header at the start of the region.
+ */
+static const size_t large_allocation_threshold = 0x10000;
+static const u64 large_block_magic = 0x4b4c424547524c41ul;
+
+struct large_block {
+	u64 magic;
+	size_t size;
+
+	void *ptr() { return (void *)((u64)this + sizeof(*this)); }
+
+	static large_block *from_ptr(void *ptr)
+	{
+		if (((u64)ptr & (PAGE_SIZE - 1)) != sizeof(large_block)) {
+			return nullptr;
+		}
+
+		large_block *block = (large_block *)((u64)ptr - sizeof(large_block));
+		return block->magic == large_block_magic ? block : nullptr;
+	}
+};
+
+static void *allocate_large(size_t size)
+{
+	size_t region_size = PAGE_ALIGN_UP(size + sizeof(large_block));
+	auto alloc_result = stacsos::syscalls::alloc_mem(region_size);
+	if (alloc_result.code != stacsos::syscall_result_code::ok) {
+		return nullptr;
+	}
+
+	large_block *block = (large_block *)alloc_result.ptr;
+	block->magic = large_block_magic;
+	block->size = region_size;
+
+	return block->ptr();
+}
+
 static void *allocate(size_t size)
 {
+	if (size >= large_allocation_threshold) {
+		return allocate_large(size);
+	}
+
 	memory_block *candidate_block = free_list;
 
 	while (candidate_block) {
@@ -95,7 +138,11 @@ static void *allocate(size_t size)
 
 void free(void *ptr)
 {
-	//
+	large_block *block = large_block::from_ptr(ptr);
+	if (block) {
+		block->magic = 0;
+		stacsos::syscalls::free_mem(block);
+	}
 }
 
 void *operator new(size_t size) { return allocate(size); }
@@ -26,4 +26,9 @@ size_t object::read(void *buffer, size_t length) { return syscalls::read(handle_
 size_t object::write(const void *buffer, size_t length) { return syscalls::write(handle_, buffer, length).length; }
 size_t object::pwrite(const void *buffer, size_t length, size_t offset) { return syscalls::pwrite(handle_, buffer, length, offset).length; }
 size_t object::pread(void *buffer, size_t length, size_t offset) { return syscalls::pread(handle_, buffer, length, offset).length; }
+size_t object::readv(const io_segment *segments, size_t count) { return syscalls::readv(handle_, segments, count).length; }
+size_t object::writev(const io_segment *segments, size_t count) { return syscalls::writev(handle_, segments, count).length; }
+size_t object::preadv(const io_segment *segments, size_t count) { return syscalls::preadv(handle_, segments, count).length; }
+size_t object::pwritev(const io_segment *segments, size_t count) { return syscalls::pwritev(handle_, segments, count).length; }
 u64 object::ioctl(u64 cmd, void *buffer, size_t length) { return syscalls::ioctl(handle_, cmd, buffer, length).length; }
+bool object::fsync() { return syscalls::fsync(handle_) == syscall_result_code::ok; }